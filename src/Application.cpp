@@ -1,6 +1,7 @@
 ﻿#include "Application.h"
 #include "utils/Fonts.h"
 #include "utils/Config.h"
+#include "utils/Redraw.h"
 #include "widgets/MainMenu.h"
 #include "widgets/Logger.h"
 #include "widgets/Options.h"
@@ -10,6 +11,15 @@
 #include <iostream>
 #include <windows.h>
 
+static void OnMouseButton(GLFWwindow* window, int button, int action, int mods);
+static void OnScroll(GLFWwindow* window, double xoffset, double yoffset);
+static void OnKey(GLFWwindow* window, int key, int scancode, int action, int mods);
+static void OnChar(GLFWwindow* window, unsigned int c);
+static void OnCursorPos(GLFWwindow* window, double x, double y);
+static void OnWindowSize(GLFWwindow* window, int w, int h);
+static void OnWindowRefresh(GLFWwindow* window);
+static void OnWindowFocus(GLFWwindow* window, int focused);
+
 
 Application::Application(void)
 {
@@ -44,6 +54,9 @@ Application::Application(void)
     /* Unlock the framerate */
     glfwSwapInterval(1);
 
+    /* Frames are only drawn when something changes, let the background threads wake us up */
+    Redraw::Init(glfwPostEmptyEvent);
+
     /* Initialize the GLEW library */
     if (glewInit() != GLEW_OK)
     {
@@ -63,6 +76,15 @@ Application::Application(void)
     ImGui::CreateContext();
 
     ImGui::StyleColorsDark();
+    /* Draw new frames when an event comes in. ImGui chains the input callbacks to these, so set them first */
+    glfwSetMouseButtonCallback(m_window, OnMouseButton);
+    glfwSetScrollCallback(m_window, OnScroll);
+    glfwSetKeyCallback(m_window, OnKey);
+    glfwSetCharCallback(m_window, OnChar);
+    glfwSetCursorPosCallback(m_window, OnCursorPos);
+    glfwSetWindowSizeCallback(m_window, OnWindowSize);
+    glfwSetWindowRefreshCallback(m_window, OnWindowRefresh);
+    glfwSetWindowFocusCallback(m_window, OnWindowFocus);
     ImGui_ImplGlfw_InitForOpenGL(m_window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
@@ -107,6 +129,9 @@ Application::Application(void)
 
 Application::~Application(void)
 {
+    /* Let the pending database writes complete */
+    Viewer::Shutdown();
+
     /* Terminate OpenGL, GLFW, GLEW and ImGui */
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -121,6 +146,10 @@ void Application::AddWidget(std::function<void()> widgetFunction)
 
 void Application::Run()
 {
+    /* The frames that aren't drawn are counted at the refresh rate of the monitor */
+    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    const double refreshRate = mode != nullptr ? double(mode->refreshRate) : 60.0;
+
     while (!glfwWindowShouldClose(m_window))
     {
         GLCall(glClearColor(RENDER_COLOR_BLACK));
@@ -153,8 +182,21 @@ void Application::Run()
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
         glfwSwapBuffers(m_window);
+        Redraw::AddRenderedFrame();
 
-        glfwPollEvents();
+        /* If nothing changed, sleep until an event comes in instead of drawing the same frame again */
+        if (Redraw::ShouldDraw())
+        {
+            glfwPollEvents();
+        }
+        else
+        {
+            double idleStart = glfwGetTime();
+            glfwWaitEventsTimeout(Redraw::GetMaxIdleTime());
+            Redraw::AddSkippedFrames(uint64_t((glfwGetTime() - idleStart) * refreshRate));
+
+            /* The events that woke us up requested their own frames, a timeout only gets the next one */
+        }
     }
 }
 
@@ -164,3 +206,47 @@ void Application::windowSizeCallback(GLFWwindow* win, int w, int h)
     m_width = float(w);
     m_heigth = float(h);
 }
+
+/**
+ * @brief   GLFW callbacks of the events that change what is shown, each asking for new frames to be drawn.
+ *          The input ones are chained by ImGui's own callbacks.
+ */
+void OnMouseButton(GLFWwindow* window, int button, int action, int mods)
+{
+    Redraw::Request();
+}
+
+void OnScroll(GLFWwindow* window, double xoffset, double yoffset)
+{
+    Redraw::Request();
+}
+
+void OnKey(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    Redraw::Request();
+}
+
+void OnChar(GLFWwindow* window, unsigned int c)
+{
+    Redraw::Request();
+}
+
+void OnCursorPos(GLFWwindow* window, double x, double y)
+{
+    Redraw::Request();
+}
+
+void OnWindowSize(GLFWwindow* window, int w, int h)
+{
+    Redraw::Request();
+}
+
+void OnWindowRefresh(GLFWwindow* window)
+{
+    Redraw::Request();
+}
+
+void OnWindowFocus(GLFWwindow* window, int focused)
+{
+    Redraw::Request();
+}
@@ -1,12 +1,20 @@
 ﻿#include "FilterUtils.h"
 #include "utils/db/Item.h"
 #include "utils/db/Bom.h"
+#include "utils/Redraw.h"
 #include "utils/StringUtils.h"
 #include "vendor/imgui/imgui.h"
 #include "boost/algorithm/string.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iterator>
 
 namespace FilterUtils
 {
+static bool CompareNumber(float value, const QueryTerm& term);
+static bool CompareText(const std::string& value, const QueryTerm& term);
+
 FilterUtils::FilterHandler::FilterHandler(const std::vector<std::string>& categories)
 {
     m_categories = categories;
@@ -15,82 +23,180 @@ FilterUtils::FilterHandler::FilterHandler(const std::vector<std::string>& catego
 }
 
 /**
- * @brief   Check if the passed `DB::Item::Item`'s `category` matches the filter.
+ * @brief   Check if a `DB::Item::Item` satisfies all the query terms of the filter.
+ *          Prices and quantities are compared as numbers, everything else as text.
  * @param   item: The Item to verify.
- * @param   category [optional]: The Item's category to verify.
- *                               If not specified, the currently selected category will be used instead.
- * @retval  `true` if the Item matches the filter, `false` otherwise.
+ * @retval  `true` if all the terms are satisfied, `false` otherwise.
  */
-template<> bool FilterHandler::CheckMatch<DB::Item::Item>(const DB::Item::Item& item, int category)
+template<> bool FilterHandler::MatchTerms<DB::Item::Item>(const DB::Item::Item& item) const
 {
-    // Create a string from the filter input buffer.
-    std::string filterText = m_filterText;
-    // Transforms the input to all caps.
-    boost::to_upper(filterText);
-
-    // If no `category` was provided, used the selected one.
-    // Otherwise use the one provided.
-    switch (category == -1 ? m_selectedCategory : category)
+    for (const QueryTerm& term : m_terms)
     {
-        case 0:     // ID.
+        bool isMatch = false;
+        switch (term.field)
         {
-            std::string id = item.GetId();
-            boost::to_upper(id);
-            return (id.find(filterText) != std::string::npos);
+            case QueryField::id:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::id), term);
+                break;
+            case QueryField::description:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::description), term);
+                break;
+            case QueryField::category:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::category), term);
+                break;
+            case QueryField::referenceLink:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::referenceLink), term);
+                break;
+            case QueryField::location:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::location), term);
+                break;
+            case QueryField::price:
+                isMatch = CompareNumber(item.GetPrice(), term);
+                break;
+            case QueryField::quantity:
+                isMatch = CompareNumber(item.GetQuantity(), term);
+                break;
+            case QueryField::unit:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::unit), term);
+                break;
+            case QueryField::status:
+                isMatch = CompareText(item.GetSearchKey(DB::Item::SearchKey::status), term);
+                break;
+            default:
+                // Items don't have that field.
+                break;
         }
-        case 1:     // Description.
-        {
-            std::string description = item.GetDescription();
-            boost::to_upper(description);
-            return (description.find(filterText) != std::string::npos);
-        }
-        case 2:     // Category.
-        {
-            std::string category = item.GetCategory().GetName();
-            boost::to_upper(category);
-            return (category.find(filterText) != std::string::npos);
-        }
-        case 3:     // Reference Link.
-        {
-            std::string refLink = item.GetReferenceLink();
-            boost::to_upper(refLink);
-            return (refLink.find(filterText) != std::string::npos);
-        }
-        case 4:     // Location.
+
+        if (isMatch == false)
         {
-            std::string location = item.GetLocation();
-            boost::to_upper(location);
-            return (location.find(filterText) != std::string::npos);
+            return false;
         }
-        case 5:     // Price.
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Check if a `DB::BOM::BOM` satisfies all the query terms of the filter.
+ * @param   item: The BOM to verify.
+ * @retval  `true` if all the terms are satisfied, `false` otherwise.
+ */
+template<> bool FilterHandler::MatchTerms<DB::BOM::BOM>(const DB::BOM::BOM& item) const
+{
+    for (const QueryTerm& term : m_terms)
+    {
+        bool isMatch = false;
+        switch (term.field)
         {
-            // Price is a float, transform it into a string.
-            std::string price = StringUtils::NumToString(item.GetPrice());
-            boost::to_upper(price);
-            return (price.find(filterText) != std::string::npos);
+            case QueryField::id:
+                isMatch = CompareText(item.GetSearchKey(DB::BOM::SearchKey::id), term);
+                break;
+            case QueryField::description:
+                isMatch = CompareText(item.GetSearchKey(DB::BOM::SearchKey::name), term);
+                break;
+            case QueryField::outputId:
+                isMatch = CompareText(item.GetSearchKey(DB::BOM::SearchKey::outputId), term);
+                break;
+            default:
+                // BOMs don't have that field.
+                break;
         }
-        case 6:     // Quantity.
+
+        if (isMatch == false)
         {
-            // Quantity is a float, transform it into a string.
-            std::string quantity = StringUtils::NumToString(item.GetQuantity());
-            boost::to_upper(quantity);
-            return (quantity.find(filterText) != std::string::npos);
+            return false;
         }
-        case 7:     // Unit.
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Score how well the passed `DB::Item::Item`'s `category` matches the filter.
+ * @param   item: The Item to verify.
+ * @param   category [optional]: The Item's category to verify.
+ *                               If not specified, the currently selected category will be used instead.
+ * @retval  -1 if the Item doesn't match the filter. Otherwise, the number of typos
+ *          in the match: 0 is a perfect match, lower is better.
+ */
+template<> int FilterHandler::GetScore<DB::Item::Item>(const DB::Item::Item& item, int category) const
+{
+    // All the query terms must be satisfied.
+    if (MatchTerms(item) == false)
+    {
+        return -1;
+    }
+
+    // If no `category` was provided, used the selected one.
+    // Otherwise use the one provided.
+    int column = category == -1 ? m_selectedCategory : category;
+    if (column == int(DB::Item::SearchKey::count))
+    {
+        // Look in all the text fields.
+        const std::string* keys[std::size(DB::Item::TEXT_SEARCH_KEYS)];
+        for (size_t i = 0; i < std::size(DB::Item::TEXT_SEARCH_KEYS); i++)
         {
-            std::string unit = item.GetUnit();
-            boost::to_upper(unit);
-            return (unit.find(filterText) != std::string::npos);
+            keys[i] = &item.GetSearchKey(DB::Item::TEXT_SEARCH_KEYS[i]);
         }
-        case 8:     // Status.
+        return MatchKeys(keys, std::size(keys));
+    }
+    else if (column < 0 || column >= int(DB::Item::SearchKey::count))
+    {
+        return -1;
+    }
+
+    const std::string* key = &item.GetSearchKey(DB::Item::SearchKey(column));
+    return MatchKeys(&key, 1);
+}
+
+/**
+ * @brief   Check if the passed `DB::Item::Item`'s `category` matches the filter.
+ * @param   item: The Item to verify.
+ * @param   category [optional]: The Item's category to verify.
+ *                               If not specified, the currently selected category will be used instead.
+ * @retval  `true` if the Item matches the filter, `false` otherwise.
+ */
+template<> bool FilterHandler::CheckMatch<DB::Item::Item>(const DB::Item::Item& item, int category) const
+{
+    return GetScore(item, category) != -1;
+}
+
+/**
+ * @brief   Score how well the passed `DB::BOM::BOM`'s `category` matches the filter.
+ * @param   item: The BOM to verify.
+ * @param   category [optional]: The BOM's category to verify.
+ *                               If not specified, the currently selected category will be used instead.
+ * @retval  -1 if the BOM doesn't match the filter. Otherwise, the number of typos
+ *          in the match: 0 is a perfect match, lower is better.
+ */
+template<> int FilterHandler::GetScore<DB::BOM::BOM>(const DB::BOM::BOM& item, int category) const
+{
+    // All the query terms must be satisfied.
+    if (MatchTerms(item) == false)
+    {
+        return -1;
+    }
+
+    // If no `category` was provided, used the selected one.
+    // Otherwise use the one provided.
+    int column = category == -1 ? m_selectedCategory : category;
+    if (column == int(DB::BOM::SearchKey::count))
+    {
+        // Look in all the fields.
+        const std::string* keys[size_t(DB::BOM::SearchKey::count)];
+        for (size_t i = 0; i < std::size(keys); i++)
         {
-            std::string status = DB::Item::GetStatusString(DB::Item::ItemStatus(item.GetStatus()));
-            boost::to_upper(status);
-            return (status.find(filterText) != std::string::npos);
+            keys[i] = &item.GetSearchKey(DB::BOM::SearchKey(i));
         }
-        default:
-            return false;
+        return MatchKeys(keys, std::size(keys));
     }
+    else if (column < 0 || column >= int(DB::BOM::SearchKey::count))
+    {
+        return -1;
+    }
+
+    const std::string* key = &item.GetSearchKey(DB::BOM::SearchKey(column));
+    return MatchKeys(&key, 1);
 }
 
 /**
@@ -100,38 +206,56 @@ template<> bool FilterHandler::CheckMatch<DB::Item::Item>(const DB::Item::Item&
  *                               If not specified, the currently selected category will be used instead.
  * @retval  `true` if the Item matches the filter, `false` otherwise.
  */
-template<> bool FilterHandler::CheckMatch<DB::BOM::BOM>(const DB::BOM::BOM& item, int category)
+template<> bool FilterHandler::CheckMatch<DB::BOM::BOM>(const DB::BOM::BOM& item, int category) const
 {
-    // Create a string from the filter input text's buffer.
-    std::string filterText = m_filterText;
-    // Transform the string into all caps to make the filter case insensitive.
-    boost::to_upper(filterText);
+    return GetScore(item, category) != -1;
+}
 
-    // If no `category` was provided, used the selected one.
-    // Otherwise use the one provided.
-    switch (category == -1 ? m_selectedCategory : category)
+/**
+ * @brief   Match the filter's text against the search keys of an object.
+ *          Without typo tolerance, one of the keys has to contain the text.
+ *          With it, each word of the text has to be found, give or take a few typos, in one of the keys.
+ * @param   keys: The search keys, in all caps.
+ * @param   count: The number of keys.
+ * @retval  -1 if the keys don't match. Otherwise, the number of typos in the match.
+ */
+int FilterUtils::FilterHandler::MatchKeys(const std::string* const* keys, size_t count) const
+{
+    if (m_isFuzzy == false)
     {
-        case 0:     // ID.
+        for (size_t i = 0; i < count; i++)
         {
-            std::string id = item.GetId();
-            boost::to_upper(id);
-            return (id.find(filterText) != std::string::npos);
+            if (keys[i]->find(m_appliedText) != std::string::npos)
+            {
+                return 0;
+            }
         }
-        case 1:     // Description.
+        return -1;
+    }
+
+    int total = 0;
+    // For each word of the filter:
+    for (const FuzzyPattern& pattern : m_patterns)
+    {
+        // Use its best match amongst the keys.
+        int best = -1;
+        for (size_t i = 0; i < count && best != 0; i++)
         {
-            std::string description = item.GetName();
-            boost::to_upper(description);
-            return (description.find(filterText) != std::string::npos);
+            int score = pattern.Match(*keys[i]);
+            if (score != -1 && (best == -1 || score < best))
+            {
+                best = score;
+            }
         }
-        case 2:     // Output Item ID.
+        // If a word is nowhere to be found, the object doesn't match.
+        if (best == -1)
         {
-            std::string id = item.GetRawOutput().GetId();
-            boost::to_upper(id);
-            return (id.find(filterText) != std::string::npos);
+            return -1;
         }
-        default:
-            return false;
+        total += best;
     }
+
+    return total;
 }
 
 void FilterUtils::FilterHandler::Render()
@@ -145,11 +269,32 @@ void FilterUtils::FilterHandler::Render()
     ImGui::Columns(2, nullptr, false);
 
     // Input box of text for user to write the filter in, bound to the FilterUtils' input buffer.
-    ImGui::InputText("Filter", m_filterText, sizeof(m_filterText));
+    if (ImGui::InputText("Filter", m_filterText, sizeof(m_filterText)))
+    {
+        m_isTextPending = true;
+        m_lastEdit = ImGui::GetTime();
+    }
+    // If the user stopped typing for long enough, start using the new text.
+    if (m_isTextPending == true && ImGui::GetTime() - m_lastEdit >= FILTER_DEBOUNCE_S)
+    {
+        ApplyText();
+    }
+    // Otherwise, keep drawing frames until the debounce delay is over.
+    else if (m_isTextPending == true)
+    {
+        Redraw::Request();
+    }
 
     // Move to the next column.
     ImGui::NextColumn();
 
+    // Typo tolerance toggle.
+    if (ImGui::Checkbox("Fuzzy", &m_isFuzzy))
+    {
+        m_revision++;
+    }
+    ImGui::SameLine();
+
     // If categories were provided upon instantiation of the FilterUtils:
     if (!m_categories.empty())
     {
@@ -166,6 +311,7 @@ void FilterUtils::FilterHandler::Render()
                 {
                     // Update the selected category to be this one.
                     m_selectedCategory = i;
+                    m_revision++;
                 }
                 i++;
             }
@@ -181,4 +327,447 @@ void FilterUtils::FilterHandler::Render()
     ImGui::EndChildFrame();
 }
 
+/**
+ * @brief   Start using the content of the input buffer as the filter's text.
+ * @param   None
+ * @retval  None
+ */
+void FilterUtils::FilterHandler::ApplyText()
+{
+    std::string text = m_filterText;
+    // Transforms the input to all caps.
+    boost::to_upper(text);
+    // Separate the query terms from the free text.
+    ParseQuery(text);
+
+    // Prepare the typo tolerant matching of each word.
+    m_patterns.clear();
+    std::vector<std::string> words;
+    boost::split(words, m_appliedText, boost::is_any_of(" \t"), boost::token_compress_on);
+    for (const std::string& word : words)
+    {
+        if (!word.empty())
+        {
+            m_patterns.emplace_back(word);
+        }
+    }
+
+    m_isTextPending = false;
+    m_revision++;
+}
+
+/**
+ * @brief   Split a text into query terms, like `cat:resistor`, `qty<10` or `loc:"B-12"`,
+ *          and free text. The terms are sorted so that the cheapest and most selective are checked first.
+ * @param   text: The text to parse, in all caps.
+ * @retval  None
+ */
+void FilterUtils::FilterHandler::ParseQuery(const std::string& text)
+{
+    static const std::unordered_map<std::string, QueryField> fields = {
+        { "ID", QueryField::id },
+        { "DESC", QueryField::description },
+        { "DESCRIPTION", QueryField::description },
+        { "NAME", QueryField::description },
+        { "CAT", QueryField::category },
+        { "CATEGORY", QueryField::category },
+        { "LINK", QueryField::referenceLink },
+        { "REF", QueryField::referenceLink },
+        { "LOC", QueryField::location },
+        { "LOCATION", QueryField::location },
+        { "PRICE", QueryField::price },
+        { "QTY", QueryField::quantity },
+        { "QUANTITY", QueryField::quantity },
+        { "UNIT", QueryField::unit },
+        { "STATUS", QueryField::status },
+        { "OUT", QueryField::outputId },
+        { "OUTPUT", QueryField::outputId },
+    };
+
+    m_terms.clear();
+    m_appliedText.clear();
+
+    size_t i = 0;
+    while (i < text.size())
+    {
+        // Skip the spaces between the tokens.
+        if (isspace(uint8_t(text[i])))
+        {
+            i++;
+            continue;
+        }
+
+        // Read the token, a quoted part counts as a single word.
+        std::string token = "";
+        std::string name = "";
+        size_t opPos = std::string::npos;
+        bool isQuoted = false;
+        for (; i < text.size() && (isQuoted == true || !isspace(uint8_t(text[i]))); i++)
+        {
+            char c = text[i];
+            if (c == '"')
+            {
+                isQuoted = !isQuoted;
+                continue;
+            }
+            if (isQuoted == false && opPos == std::string::npos && (c == ':' || c == '=' || c == '<' || c == '>'))
+            {
+                name = token;
+                opPos = token.size();
+            }
+            token += c;
+        }
+
+        // If the token starts with the name of a field followed by an operator:
+        auto field = fields.find(name);
+        if (opPos != std::string::npos && field != fields.end())
+        {
+            QueryTerm term;
+            term.field = field->second;
+            std::string value = token.substr(opPos);
+            if (value.compare(0, 2, "<=") == 0)
+            {
+                term.op = QueryOp::lessEqual;
+            }
+            else if (value.compare(0, 2, ">=") == 0)
+            {
+                term.op = QueryOp::greaterEqual;
+            }
+            else if (value[0] == '<')
+            {
+                term.op = QueryOp::less;
+            }
+            else if (value[0] == '>')
+            {
+                term.op = QueryOp::greater;
+            }
+            else if (value[0] == '=')
+            {
+                term.op = QueryOp::equal;
+            }
+            else
+            {
+                term.op = QueryOp::contains;
+            }
+            term.text = value.substr(term.op == QueryOp::lessEqual || term.op == QueryOp::greaterEqual ? 2 : 1);
+
+            // A term without a value, like `cat:`, is being typed. Ignore it.
+            if (term.text.empty())
+            {
+                continue;
+            }
+
+            char* end = nullptr;
+            term.number = std::strtof(term.text.c_str(), &end);
+            term.isNumber = end != term.text.c_str() && *end == '\0';
+
+            // Comparing numbers is the cheapest, then comparing whole texts.
+            // Looking for a long text is more selective than looking for a short one.
+            if (term.field == QueryField::price || term.field == QueryField::quantity)
+            {
+                term.cost = 0;
+            }
+            else if (term.op != QueryOp::contains)
+            {
+                term.cost = 1;
+            }
+            else
+            {
+                term.cost = 2 + MAX_INPUT_LENGTH - int(term.text.size());
+            }
+            m_terms.push_back(term);
+        }
+        else
+        {
+            // Otherwise, it is part of the free text.
+            if (!m_appliedText.empty())
+            {
+                m_appliedText += ' ';
+            }
+            m_appliedText += token;
+        }
+    }
+
+    std::stable_sort(m_terms.begin(), m_terms.end(),
+                     [](const QueryTerm& a, const QueryTerm& b)
+                     {
+                         return a.cost < b.cost;
+                     });
+}
+
+/**
+ * @brief   Add a document to the index.
+ * @param   doc: The number identifying the document.
+ * @param   fields: The texts of the document. A trigram never spans two fields.
+ * @retval  None
+ */
+void FilterUtils::TrigramIndex::Add(size_t doc, const std::vector<const std::string*>& fields)
+{
+    std::vector<uint32_t> trigrams;
+    GetTrigrams(fields, trigrams);
+
+    for (uint32_t trigram : trigrams)
+    {
+        std::vector<size_t>& docs = m_postings[trigram];
+        // Documents are mostly added in order, only search for the spot when they aren't.
+        if (docs.empty() || docs.back() < doc)
+        {
+            docs.push_back(doc);
+        }
+        else
+        {
+            auto it = std::lower_bound(docs.begin(), docs.end(), doc);
+            if (it == docs.end() || *it != doc)
+            {
+                docs.insert(it, doc);
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Remove a document from the index.
+ * @param   doc: The number identifying the document.
+ * @param   fields: The texts the document had when it was added.
+ * @retval  None
+ */
+void FilterUtils::TrigramIndex::Remove(size_t doc, const std::vector<const std::string*>& fields)
+{
+    std::vector<uint32_t> trigrams;
+    GetTrigrams(fields, trigrams);
+
+    for (uint32_t trigram : trigrams)
+    {
+        auto match = m_postings.find(trigram);
+        if (match == m_postings.end())
+        {
+            continue;
+        }
+
+        std::vector<size_t>& docs = match->second;
+        auto it = std::lower_bound(docs.begin(), docs.end(), doc);
+        if (it != docs.end() && *it == doc)
+        {
+            docs.erase(it);
+        }
+        if (docs.empty())
+        {
+            m_postings.erase(match);
+        }
+    }
+}
+
+/**
+ * @brief   Remove every document from the index.
+ * @param   None
+ * @retval  None
+ */
+void FilterUtils::TrigramIndex::Clear()
+{
+    m_postings.clear();
+}
+
+/**
+ * @brief   Find the documents that contain every trigram of a text.
+ *          They might not contain the text itself, they still have to be verified.
+ * @param   text: The text to look for.
+ * @param   candidates: Where to store the documents found, in ascending order.
+ * @retval  True if the candidates were found.
+ *          False if the text is too short to use the index, every document is a candidate.
+ */
+bool FilterUtils::TrigramIndex::FindCandidates(const std::string& text, std::vector<size_t>& candidates) const
+{
+    candidates.clear();
+
+    std::vector<uint32_t> trigrams;
+    GetTrigrams({ &text }, trigrams);
+    if (trigrams.empty())
+    {
+        return false;
+    }
+
+    // Start from the rarest trigram, the result can only get smaller.
+    std::vector<const std::vector<size_t>*> lists;
+    lists.reserve(trigrams.size());
+    for (uint32_t trigram : trigrams)
+    {
+        auto match = m_postings.find(trigram);
+        if (match == m_postings.end())
+        {
+            // No document has this trigram, so none can contain the text.
+            return true;
+        }
+        lists.push_back(&match->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<size_t>* a, const std::vector<size_t>* b) { return a->size() < b->size(); });
+
+    candidates = *lists.front();
+    std::vector<size_t> tmp;
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); i++)
+    {
+        tmp.clear();
+        std::set_intersection(candidates.begin(), candidates.end(),
+                              lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(tmp));
+        candidates.swap(tmp);
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Get the distinct trigrams found in a list of texts.
+ * @param   fields: The texts.
+ * @param   trigrams: Where to store the trigrams, sorted. Each is packed in an integer.
+ * @retval  None
+ */
+void FilterUtils::TrigramIndex::GetTrigrams(const std::vector<const std::string*>& fields, std::vector<uint32_t>& trigrams)
+{
+    trigrams.clear();
+    for (const std::string* field : fields)
+    {
+        for (size_t i = 0; i + TRIGRAM_LENGTH <= field->size(); i++)
+        {
+            trigrams.push_back((uint32_t(uint8_t((*field)[i])) << 16) |
+                               (uint32_t(uint8_t((*field)[i + 1])) << 8) |
+                               (uint32_t(uint8_t((*field)[i + 2]))));
+        }
+    }
+
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+/**
+ * @brief   Compare a number to the value of a query term.
+ * @param   value: The number to compare.
+ * @param   term: The query term.
+ * @retval  `true` if the number satisfies the term. A term that isn't a number is never satisfied.
+ */
+bool CompareNumber(float value, const QueryTerm& term)
+{
+    if (term.isNumber == false)
+    {
+        return false;
+    }
+
+    switch (term.op)
+    {
+        case QueryOp::contains:
+        case QueryOp::equal:
+            return value == term.number;
+        case QueryOp::less:
+            return value < term.number;
+        case QueryOp::lessEqual:
+            return value <= term.number;
+        case QueryOp::greater:
+            return value > term.number;
+        case QueryOp::greaterEqual:
+            return value >= term.number;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief   Compare a text to the value of a query term.
+ * @param   value: The text to compare, in all caps.
+ * @param   term: The query term.
+ * @retval  `true` if the text satisfies the term.
+ */
+bool CompareText(const std::string& value, const QueryTerm& term)
+{
+    switch (term.op)
+    {
+        case QueryOp::contains:
+            return value.find(term.text) != std::string::npos;
+        case QueryOp::equal:
+            return value == term.text;
+        case QueryOp::less:
+            return value < term.text;
+        case QueryOp::lessEqual:
+            return value <= term.text;
+        case QueryOp::greater:
+            return value > term.text;
+        case QueryOp::greaterEqual:
+            return value >= term.text;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief   Prepare the matching of a word.
+ * @param   word: The word to look for, in all caps. Only its first `FUZZY_MAX_PATTERN_LENGTH` characters are used.
+ */
+FilterUtils::FuzzyPattern::FuzzyPattern(const std::string& word)
+{
+    m_length = int(std::min(word.size(), size_t(FUZZY_MAX_PATTERN_LENGTH)));
+    // Short words have to match exactly, longer ones can have a typo per 4 characters.
+    m_maxErrors = m_length < 4 ? 0 : m_length / 4;
+
+    // Remember where each character appears in the word.
+    for (int i = 0; i < m_length; i++)
+    {
+        m_peq[uint8_t(word[i])] |= uint64_t(1) << i;
+    }
+}
+
+/**
+ * @brief   Find the part of a text that is the closest to the word, using Myers' bit-parallel algorithm.
+ *          Every column of the edit distance matrix is computed in a handful of operations on 64 bits words.
+ * @param   text: The text to look in, in all caps.
+ * @retval  The smallest number of edits (insertion, deletion or substitution) turning the word into a part
+ *          of the text, or -1 if it is more than the word tolerates.
+ */
+int FilterUtils::FuzzyPattern::Match(const std::string& text) const
+{
+    if (m_length == 0)
+    {
+        return 0;
+    }
+
+    uint64_t pv = ~uint64_t(0);
+    uint64_t mv = 0;
+    const uint64_t last = uint64_t(1) << (m_length - 1);
+    int score = m_length;
+    int best = m_length;
+
+    for (char c : text)
+    {
+        uint64_t eq = m_peq[uint8_t(c)];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & last)
+        {
+            score++;
+        }
+        else if (mh & last)
+        {
+            score--;
+        }
+
+        // The match can start anywhere in the text, nothing is carried in.
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        if (score < best)
+        {
+            best = score;
+            if (best == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    return best <= m_maxErrors ? best : -1;
+}
+
 }
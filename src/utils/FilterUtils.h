@@ -15,7 +15,10 @@
 
 /*****************************************************************************/
 /* Includes */
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -28,6 +31,12 @@ namespace FilterUtils
 /*****************************************************************************/
 /* Exported defines */
 #define MAX_INPUT_LENGTH 400
+//! Time, in seconds, the text has to stay unchanged before the filter applies it.
+#define FILTER_DEBOUNCE_S 0.25
+//! Length of the sequences of characters indexed by FilterUtils::TrigramIndex.
+#define TRIGRAM_LENGTH 3
+//! Longest word the typo tolerant matching can look for. Longer words are truncated.
+#define FUZZY_MAX_PATTERN_LENGTH 64
 
 
 /*****************************************************************************/
@@ -36,6 +45,69 @@ namespace FilterUtils
 
 /*****************************************************************************/
 /* Exported types */
+/**
+ * @enum    QueryField
+ * @brief   The fields a query term can look at, e.g. the `QTY` in `qty<10`.
+ */
+enum class QueryField
+{
+    id = 0,
+    description,
+    category,
+    referenceLink,
+    location,
+    price,
+    quantity,
+    unit,
+    status,
+    outputId,
+};
+
+/**
+ * @enum    QueryOp
+ * @brief   How a query term compares a field to its value.
+ */
+enum class QueryOp
+{
+    contains = 0,   /*!< `:`, equality for numbers */
+    equal,          /*!< `=` */
+    less,           /*!< `<` */
+    lessEqual,      /*!< `<=` */
+    greater,        /*!< `>` */
+    greaterEqual,   /*!< `>=` */
+};
+
+/**
+ * @struct  QueryTerm
+ * @brief   A single predicate of a query, e.g. `cat:resistor` or `qty<10`.
+ */
+struct QueryTerm
+{
+    QueryField field = QueryField::id;
+    QueryOp op = QueryOp::contains;
+    std::string text = "";      /**< The value, in all caps */
+    float number = 0.0f;        /**< The value, if it is a number */
+    bool isNumber = false;      /**< The value is a number */
+    int cost = 0;               /**< Estimated cost of the term, cheapest and most selective first */
+};
+
+/**
+ * @class   FuzzyPattern
+ * @brief   A word looked for with typo tolerance.
+ */
+class FuzzyPattern
+{
+public:
+    FuzzyPattern(const std::string& word);
+
+    int Match(const std::string& text) const;
+
+private:
+    uint64_t m_peq[256] = { 0 };    /**< For each character, a bit mask of where it is in the word */
+    int m_length = 0;               /**< Length of the word */
+    int m_maxErrors = 0;            /**< Number of typos tolerated */
+};
+
 /**
  * @class   FilterHandler
  * @brief   A handler for filtering functions on a set of objects
@@ -58,7 +130,18 @@ public:
      * @note    The definitions of this template are located in the source file.
      */
     template<class T>
-    bool CheckMatch(const T& item, int category = -1);
+    bool CheckMatch(const T& item, int category = -1) const;
+
+    /**
+     * @brief   Score how well the content of the `category` of the `item` matches the filter.
+     * @param   item: The item to check.
+     * @param   category: The category in the `item` to check.
+     * @retval  -1 if it doesn't match, otherwise the number of typos in the match. Lower is better.
+     *
+     * @note    The definitions of this template are located in the source file.
+     */
+    template<class T>
+    int GetScore(const T& item, int category = -1) const;
 
     /**
      * @brief   Render the filter object and handles user inputs.
@@ -79,14 +162,100 @@ public:
     inline void ClearText()
     {
         memset(m_filterText, 0, sizeof(m_filterText));
+        ApplyText();
+    }
+
+    /**
+     * @brief   Get the free text the filter currently uses, in all caps.
+     *          Query terms such as `qty<10` are not part of it.
+     * @param   None
+     * @retval  The text of the filter.
+     */
+    inline const std::string& GetText() const
+    {
+        return m_appliedText;
+    }
+
+    /**
+     * @brief   Check if the filter tolerates typos.
+     * @param   None
+     * @retval  True if it does.
+     */
+    inline bool IsFuzzy() const
+    {
+        return m_isFuzzy;
+    }
+
+    /**
+     * @brief   Get the category the filter currently looks in.
+     * @param   None
+     * @retval  The index of the category, in the list given at construction.
+     */
+    inline int GetSelectedCategory() const
+    {
+        return m_selectedCategory;
+    }
+
+    /**
+     * @brief   Get the revision of the filter, which changes every time what the filter matches changes.
+     *          Anything computed with the filter is stale once it changes.
+     * @param   None
+     * @retval  The revision of the filter.
+     *
+     * @note    While the user is typing, the filter keeps using the previous text
+     *          until the input stayed unchanged for `FILTER_DEBOUNCE_S` seconds.
+     */
+    inline unsigned int GetRevision() const
+    {
+        return m_revision;
     }
 
 private:
-    char m_filterText[MAX_INPUT_LENGTH] = { 0 };    /**< The text used by the filter */
+    void ApplyText();
+    void ParseQuery(const std::string& text);
+    int MatchKeys(const std::string* const* keys, size_t count) const;
+    template<class T>
+    bool MatchTerms(const T& item) const;
+
+    char m_filterText[MAX_INPUT_LENGTH] = { 0 };    /**< The input buffer of the filter */
+    std::string m_appliedText = "";                 /**< The text used by the filter, in all caps */
+    std::vector<QueryTerm> m_terms = {};            /**< The query terms of the text, cheapest first */
+    std::vector<FuzzyPattern> m_patterns = {};      /**< Each word of the applied text, for the typo tolerant matching */
+    bool m_isFuzzy = false;                         /**< The filter tolerates typos */
+    bool m_isTextPending = false;                   /**< The input buffer changed but isn't applied yet */
+    double m_lastEdit = 0.0;                        /**< When the input buffer last changed (ImGui::GetTime) */
+    unsigned int m_revision = 0;                    /**< Incremented every time what the filter matches changes */
     int m_selectedCategory = 0;                     /**< The category to use for the filtering */
     std::vector<std::string> m_categories = {};     /**< All the available categories to use as filters */
 };
 
+/**
+ * @class   TrigramIndex
+ * @brief   An inverted index of every sequence of 3 characters found in a set of documents,
+ *          used to quickly find the few documents that might contain a text.
+ *
+ * @note    The documents are identified by a number chosen by the owner of the index,
+ *          typically their position in a cache.
+ *          The index doesn't change the case of anything, the texts should already be in all caps.
+ */
+class TrigramIndex
+{
+public:
+    TrigramIndex() = default;
+
+    void Add(size_t doc, const std::vector<const std::string*>& fields);
+    void Remove(size_t doc, const std::vector<const std::string*>& fields);
+    void Clear();
+
+    bool FindCandidates(const std::string& text, std::vector<size_t>& candidates) const;
+
+private:
+    static void GetTrigrams(const std::vector<const std::string*>& fields, std::vector<uint32_t>& trigrams);
+
+    //! For each trigram, the sorted list of the documents containing it.
+    std::unordered_map<uint32_t, std::vector<size_t>> m_postings;
+};
+
 /*****************************************************************************/
 /* Exported functions */
 
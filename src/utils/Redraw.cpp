@@ -0,0 +1,126 @@
+﻿#include "Redraw.h"
+#include "utils/Config.h"
+#include <atomic>
+#include <mutex>
+
+namespace Redraw
+{
+// Protects `wakeCallback`.
+static std::mutex wakeMutex;
+static std::function<void()> wakeCallback;
+static std::atomic<int> framesToDraw{ REDRAW_SETTLE_FRAMES };
+static double maxIdleTime = REDRAW_DEFAULT_MAX_IDLE_MS / 1000.0;
+static uint64_t renderedFrames = 0;
+static uint64_t skippedFrames = 0;
+}
+
+using namespace Redraw;
+
+/**
+ * @brief   Set how to wake up the UI thread and load the longest idle time from Config.json.
+ * @param   wake: Interrupts the UI thread's wait for events. Must be safe to call from any thread.
+ * @retval  None
+ */
+void Redraw::Init(std::function<void()> wake)
+{
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeCallback = std::move(wake);
+    }
+
+    int maxIdleMs = Config::GetField<int>("MaxIdleMs");
+    if (maxIdleMs <= 0)
+    {
+        maxIdleMs = REDRAW_DEFAULT_MAX_IDLE_MS;
+        Config::SetField<int>("MaxIdleMs", maxIdleMs);
+    }
+    maxIdleTime = maxIdleMs / 1000.0;
+}
+
+/**
+ * @brief   Ask for the next few frames to be drawn, waking up the UI thread if it's waiting.
+ *          To be called whenever something shown on screen changes outside of user input.
+ * @param   None
+ * @retval  None
+ */
+void Redraw::Request()
+{
+    framesToDraw = REDRAW_SETTLE_FRAMES;
+
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    if (wakeCallback)
+    {
+        wakeCallback();
+    }
+}
+
+/**
+ * @brief   Check if a frame must be drawn right away rather than waiting for an event.
+ *          Each call uses up one of the frames requested.
+ * @param   None
+ * @retval  True if a frame must be drawn, false if the application can wait.
+ */
+bool Redraw::ShouldDraw()
+{
+    int frames = framesToDraw.load();
+    while (frames > 0)
+    {
+        if (framesToDraw.compare_exchange_weak(frames, frames - 1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief   Get the longest time the application waits for an event before drawing a frame anyway,
+ *          so that timers (e.g. the periodic refreshes) keep running.
+ * @param   None
+ * @retval  The time, in seconds.
+ */
+double Redraw::GetMaxIdleTime()
+{
+    return maxIdleTime;
+}
+
+/**
+ * @brief   Count a frame that was drawn.
+ * @param   None
+ * @retval  None
+ */
+void Redraw::AddRenderedFrame()
+{
+    renderedFrames++;
+}
+
+/**
+ * @brief   Count the frames that weren't drawn while waiting for an event.
+ * @param   count: The number of frames, at the refresh rate of the monitor.
+ * @retval  None
+ */
+void Redraw::AddSkippedFrames(uint64_t count)
+{
+    skippedFrames += count;
+}
+
+/**
+ * @brief   Get the number of frames drawn since the application started.
+ * @param   None
+ * @retval  The number of frames drawn.
+ */
+uint64_t Redraw::GetRenderedFrames()
+{
+    return renderedFrames;
+}
+
+/**
+ * @brief   Get the number of frames that weren't drawn because nothing changed,
+ *          counted at the refresh rate of the monitor.
+ * @param   None
+ * @retval  The number of frames skipped.
+ */
+uint64_t Redraw::GetSkippedFrames()
+{
+    return skippedFrames;
+}
@@ -0,0 +1,73 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup Redraw
+ * @{
+ * @file    Redraw
+ * @author  Samuel Martel
+ * @brief   Header for the Redraw module.
+ *
+ * @date 10/17/2026 4:12:38 PM
+ *
+ * @attention   Request() can be called from any thread, the rest only from the UI thread.
+ *
+ ******************************************************************************
+ */
+#ifndef _Redraw
+#define _Redraw
+
+/*****************************************************************************/
+/* Includes */
+#include <cstdint>
+#include <functional>
+
+/**
+ * @namespace Redraw Redraw.h Redraw
+ * @brief   The namespace deciding when the application has to draw a new frame.
+ *          Frames are only drawn when something changed: user input, a window event,
+ *          a completed background task or a database change.
+ */
+namespace Redraw
+{
+/*****************************************************************************/
+/* Exported defines */
+
+/**
+ * @def     REDRAW_SETTLE_FRAMES
+ * @brief   Number of frames drawn after something changed, the time for ImGui to settle down
+ *          (e.g. a popup needs a frame to size itself before showing up).
+ */
+#define REDRAW_SETTLE_FRAMES 3
+
+/**
+ * @def     REDRAW_DEFAULT_MAX_IDLE_MS
+ * @brief   Longest time without drawing a frame if nothing is set in Config.json.
+ */
+#define REDRAW_DEFAULT_MAX_IDLE_MS 1000
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+
+/*****************************************************************************/
+/* Exported functions */
+void Init(std::function<void()> wake);
+
+void Request();
+bool ShouldDraw();
+double GetMaxIdleTime();
+
+void AddRenderedFrame();
+void AddSkippedFrames(uint64_t count);
+uint64_t GetRenderedFrames();
+uint64_t GetSkippedFrames();
+}
+/* Have a wonderful day :) */
+#endif /* _Redraw */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
@@ -0,0 +1,105 @@
+﻿#include "SearchBenchmark.h"
+#ifdef _DEBUG
+#include "utils/FilterUtils.h"
+#include <chrono>
+#include <iterator>
+#include <random>
+
+/**
+ * @brief   Time the search engine against a synthetic catalog.
+ *          The catalog is always the same, so the results can be compared from one build to the next.
+ *          Nothing is logged, so that it can run outside of the UI thread.
+ * @param   count: The number of items in the catalog.
+ * @retval  The results, one line per measure.
+ */
+std::vector<std::string> SearchBenchmark::Run(size_t count)
+{
+    using FilterUtils::FuzzyPattern;
+    using FilterUtils::TrigramIndex;
+
+    static const char* kinds[] = { "RESISTOR", "CAPACITOR", "INDUCTOR", "DIODE", "TRANSISTOR", "CONNECTOR", "FUSE" };
+    static const char* values[] = { "10K", "4.7K", "100R", "1M", "100NF", "10UF", "22PF", "10UH", "2A" };
+    static const char* packages[] = { "0402", "0603", "0805", "1206", "SOT-23", "SOIC-8", "THT" };
+    static const char* details[] = { "1%", "5%", "X7R", "C0G", "50V", "AUTOMOTIVE", "LOW ESR", "" };
+
+    using Clock = std::chrono::steady_clock;
+    auto msSince = [](Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    // Build the catalog.
+    std::mt19937 rng(0x5EA4C4);
+    std::vector<std::string> catalog;
+    catalog.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        catalog.push_back(std::string(kinds[rng() % std::size(kinds)]) + " " +
+                          values[rng() % std::size(values)] + " " +
+                          packages[rng() % std::size(packages)] + " " +
+                          details[rng() % std::size(details)]);
+    }
+
+    std::vector<std::string> results;
+    results.push_back("Search benchmark, items: " + std::to_string(count));
+
+    // Exact search, looking at every item.
+    const std::string exactText = "10K 0603";
+    Clock::time_point start = Clock::now();
+    size_t found = 0;
+    for (const std::string& description : catalog)
+    {
+        if (description.find(exactText) != std::string::npos)
+        {
+            found++;
+        }
+    }
+    results.push_back("Exact scan (ms): " + std::to_string(msSince(start)) + ", found " + std::to_string(found));
+
+    // Exact search, looking only at the candidates of the trigram index.
+    start = Clock::now();
+    TrigramIndex index;
+    for (size_t i = 0; i < catalog.size(); i++)
+    {
+        index.Add(i, { &catalog[i] });
+    }
+    results.push_back("Trigram index build (ms): " + std::to_string(msSince(start)));
+
+    start = Clock::now();
+    found = 0;
+    std::vector<size_t> candidates;
+    index.FindCandidates(exactText, candidates);
+    for (size_t i : candidates)
+    {
+        if (catalog[i].find(exactText) != std::string::npos)
+        {
+            found++;
+        }
+    }
+    results.push_back("Trigram query (ms): " + std::to_string(msSince(start)) + ", found " + std::to_string(found));
+
+    // Search with typos, looking at every item.
+    start = Clock::now();
+    found = 0;
+    FuzzyPattern words[] = { FuzzyPattern("RESISTR"), FuzzyPattern("10K") };
+    for (const std::string& description : catalog)
+    {
+        bool isMatch = true;
+        for (const FuzzyPattern& word : words)
+        {
+            if (word.Match(description) == -1)
+            {
+                isMatch = false;
+                break;
+            }
+        }
+        if (isMatch == true)
+        {
+            found++;
+        }
+    }
+    results.push_back("Fuzzy scan (ms): " + std::to_string(msSince(start)) + ", found " + std::to_string(found));
+
+    return results;
+}
+#endif /* _DEBUG */
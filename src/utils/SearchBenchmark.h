@@ -0,0 +1,57 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup SearchBenchmark
+ * @{
+ * @file    SearchBenchmark
+ * @author  Samuel Martel
+ * @brief   Header for the SearchBenchmark module.
+ *
+ * @date 10/17/2026 2:41:09 PM
+ *
+ * @attention   Only part of the debug builds.
+ *
+ ******************************************************************************
+ */
+#ifndef _SearchBenchmark
+#define _SearchBenchmark
+#ifdef _DEBUG
+
+/*****************************************************************************/
+/* Includes */
+#include <string>
+#include <vector>
+
+/**
+ * @namespace SearchBenchmark SearchBenchmark.h SearchBenchmark
+ * @brief   The namespace timing the search engine of FilterUtils.
+ */
+namespace SearchBenchmark
+{
+/*****************************************************************************/
+/* Exported defines */
+
+/**
+ * @def     SEARCH_BENCHMARK_DEFAULT_COUNT
+ * @brief   Number of items in the synthetic catalog searched by the benchmark.
+ */
+#define SEARCH_BENCHMARK_DEFAULT_COUNT 100000
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+
+/*****************************************************************************/
+/* Exported functions */
+std::vector<std::string> Run(size_t count = SEARCH_BENCHMARK_DEFAULT_COUNT);
+}
+#endif /* _DEBUG */
+/* Have a wonderful day :) */
+#endif /* _SearchBenchmark */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
@@ -0,0 +1,202 @@
+﻿#include "TaskPool.h"
+#include "utils/Config.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace TaskPool
+{
+/**
+ * @struct  ParallelJob
+ * @brief   The progress of a TaskPool::ParallelFor, shared by everyone working on it.
+ */
+struct ParallelJob
+{
+    std::atomic<size_t> next{ 0 }; /**< The next chunk to work on */
+    size_t total = 0;               /**< The number of chunks */
+    size_t done = 0;                /**< The number of chunks done, protected by `mutex` */
+    std::mutex mutex;
+    std::condition_variable allDone;
+};
+
+static void WorkerLoop();
+static void RunChunks(const std::shared_ptr<ParallelJob>& job, const std::function<void(size_t)>& body);
+
+static std::vector<std::thread> workers;
+// Protects `tasks` and `stopRequested`.
+static std::mutex taskMutex;
+static std::condition_variable taskAvailable;
+static std::deque<std::function<void()>> tasks;
+static bool stopRequested = false;
+}
+
+using namespace TaskPool;
+
+/**
+ * @brief   Start the workers of the pool.
+ *          The number of workers is taken from Config.json, by default one less than the number of cores.
+ * @param   None
+ * @retval  None
+ */
+void TaskPool::Init()
+{
+    if (!workers.empty())
+    {
+        return;
+    }
+
+    int workerCount = Config::GetField<int>("TaskWorkers");
+    if (workerCount <= 0)
+    {
+        // Leave a core to the UI thread.
+        workerCount = std::max(int(std::thread::hardware_concurrency()) - 1, 1);
+    }
+
+    stopRequested = false;
+    for (int i = 0; i < workerCount; i++)
+    {
+        workers.emplace_back(WorkerLoop);
+    }
+}
+
+/**
+ * @brief   Run the tasks still queued then stop the workers.
+ * @param   None
+ * @retval  None
+ */
+void TaskPool::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        stopRequested = true;
+    }
+    taskAvailable.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+/**
+ * @brief   Get the number of workers of the pool.
+ * @param   None
+ * @retval  The number of workers, 0 if the pool isn't started.
+ */
+size_t TaskPool::GetWorkerCount()
+{
+    return workers.size();
+}
+
+/**
+ * @brief   Queue a task for the workers.
+ *          If the pool isn't started, the task is run right away on the calling thread.
+ * @param   task: The task to run.
+ * @retval  None
+ */
+void TaskPool::Post(std::function<void()> task)
+{
+    if (workers.empty())
+    {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+/**
+ * @brief   Get the number of chunks worth splitting some work into.
+ * @param   count: The number of elements to work on.
+ * @param   minChunkSize: The smallest number of elements worth handing to a worker.
+ * @retval  The number of chunks, at least 1 and at most one per worker plus one for the calling thread.
+ */
+size_t TaskPool::GetChunkCount(size_t count, size_t minChunkSize)
+{
+    size_t chunks = count / std::max(minChunkSize, size_t(1));
+    return std::max(std::min(chunks, workers.size() + 1), size_t(1));
+}
+
+/**
+ * @brief   Run a function on every chunk of some work, spread on the workers, and wait for all of them.
+ *          The calling thread works on the chunks too, so this can safely be called from a task.
+ * @param   chunkCount: The number of chunks, see TaskPool::GetChunkCount.
+ * @param   body: The function to run, receiving the number of the chunk.
+ *                It is called concurrently, each chunk should only write to its own data.
+ *                It must not throw.
+ * @retval  None
+ */
+void TaskPool::ParallelFor(size_t chunkCount, const std::function<void(size_t chunk)>& body)
+{
+    if (chunkCount == 0)
+    {
+        return;
+    }
+
+    auto job = std::make_shared<ParallelJob>();
+    job->total = chunkCount;
+
+    // Helpers that start after every chunk was taken just return, without touching `body`.
+    size_t helpers = std::min(chunkCount - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++)
+    {
+        Post([job, &body]() { RunChunks(job, body); });
+    }
+    RunChunks(job, body);
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->allDone.wait(lock, [&job] { return job->done == job->total; });
+}
+
+/**
+ * @brief   Run a worker: execute the queued tasks until the pool is stopped.
+ * @param   None
+ * @retval  None
+ */
+void TaskPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(taskMutex);
+            taskAvailable.wait(lock, [] { return stopRequested == true || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+/**
+ * @brief   Work on the chunks of a TaskPool::ParallelFor until none is left.
+ * @param   job: The progress of the work.
+ * @param   body: The function to run on each chunk.
+ * @retval  None
+ */
+void TaskPool::RunChunks(const std::shared_ptr<ParallelJob>& job, const std::function<void(size_t)>& body)
+{
+    for (size_t chunk = job->next++; chunk < job->total; chunk = job->next++)
+    {
+        body(chunk);
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done++;
+        if (job->done == job->total)
+        {
+            job->allDone.notify_all();
+        }
+    }
+}
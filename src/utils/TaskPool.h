@@ -0,0 +1,156 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup TaskPool
+ * @{
+ * @file    TaskPool
+ * @author  Samuel Martel
+ * @brief   Header for the TaskPool module.
+ *
+ * @date 10/17/2026 2:41:07 PM
+ *
+ * @attention   The tasks run on background workers. They must not touch ImGui
+ *              nor anything the UI thread modifies without synchronization.
+ *
+ ******************************************************************************
+ */
+#ifndef _TaskPool
+#define _TaskPool
+
+/*****************************************************************************/
+/* Includes */
+#include "utils/Redraw.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @namespace TaskPool TaskPool.h TaskPool
+ * @brief   The namespace for the pool of workers running CPU heavy tasks in the background,
+ *          such as filtering and sorting large lists.
+ */
+namespace TaskPool
+{
+/*****************************************************************************/
+/* Exported defines */
+
+/**
+ * @def     TASK_MIN_CHUNK_SIZE
+ * @brief   Smallest number of elements worth handing to a worker on their own.
+ */
+#define TASK_MIN_CHUNK_SIZE 4096
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+
+/*****************************************************************************/
+/* Exported functions */
+void Init();
+void Shutdown();
+size_t GetWorkerCount();
+
+void Post(std::function<void()> task);
+size_t GetChunkCount(size_t count, size_t minChunkSize = TASK_MIN_CHUNK_SIZE);
+void ParallelFor(size_t chunkCount, const std::function<void(size_t chunk)>& body);
+
+/**
+ * @brief   Run a function on a worker.
+ * @param   func: The function to run.
+ * @retval  The future result of the function.
+ */
+template<class F>
+std::future<std::invoke_result_t<F>> Submit(F func)
+{
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(func));
+    std::future<std::invoke_result_t<F>> result = task->get_future();
+    Post([task]()
+         {
+             (*task)();
+             // The result is ready, wake up the UI thread so it picks it up.
+             Redraw::Request();
+         });
+    return result;
+}
+
+/**
+ * @brief   Sort a range in small chunks spread on the workers, then merge the chunks two by two.
+ *          The result is the same as `std::sort`'s as long as `isBefore` is a total order.
+ * @param   first: The beginning of the range.
+ * @param   last: The end of the range.
+ * @param   isBefore: The comparison, as for `std::sort`.
+ * @param   isInterrupted: Checked before sorting each chunk and before each merge.
+ *                         When it returns true, the sort is given up as soon as possible.
+ * @retval  True if the range was sorted, false if it was interrupted. It is then left in no particular order.
+ */
+template<class It, class Compare>
+bool ParallelSort(It first, It last, Compare isBefore, const std::function<bool()>& isInterrupted)
+{
+    size_t count = size_t(last - first);
+    // Small chunks, so that no step of the sort takes long before the next check.
+    size_t chunks = std::max(count / TASK_MIN_CHUNK_SIZE, size_t(1));
+    std::atomic<bool> isStopped(false);
+
+    ParallelFor(chunks, [&](size_t chunk)
+                {
+                    if (isStopped == true || isInterrupted() == true)
+                    {
+                        isStopped = true;
+                        return;
+                    }
+                    std::sort(first + count * chunk / chunks, first + count * (chunk + 1) / chunks, isBefore);
+                });
+
+    // Merge the sorted chunks, two by two. The merges of a pass don't overlap, they run in parallel.
+    for (size_t width = 1; width < chunks && isStopped == false; width *= 2)
+    {
+        ParallelFor((chunks + 2 * width - 1) / (2 * width), [&](size_t pair)
+                    {
+                        size_t chunk = pair * 2 * width;
+                        if (chunk + width >= chunks)
+                        {
+                            return;
+                        }
+                        if (isStopped == true || isInterrupted() == true)
+                        {
+                            isStopped = true;
+                            return;
+                        }
+                        size_t end = std::min(chunk + 2 * width, chunks);
+                        std::inplace_merge(first + count * chunk / chunks,
+                                           first + count * (chunk + width) / chunks,
+                                           first + count * end / chunks,
+                                           isBefore);
+                    });
+    }
+
+    return isStopped == false;
+}
+
+/**
+ * @brief   Sort a range in small chunks spread on the workers, then merge the chunks two by two.
+ *          The result is the same as `std::sort`'s as long as `isBefore` is a total order.
+ * @param   first: The beginning of the range.
+ * @param   last: The end of the range.
+ * @param   isBefore: The comparison, as for `std::sort`.
+ * @retval  None
+ */
+template<class It, class Compare>
+void ParallelSort(It first, It last, Compare isBefore)
+{
+    ParallelSort(first, last, isBefore, []() { return false; });
+}
+}
+/* Have a wonderful day :) */
+#endif /* _TaskPool */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
@@ -1,27 +1,67 @@
 ﻿#include "Bom.h"
 #include "vendor/imgui/imgui.h"
+#include "utils/FilterUtils.h"
 #include "utils/StringUtils.h"
+#include "utils/db/ChangeStream.h"
+#include "utils/db/WriteQueue.h"
 #include "boost/algorithm/string.hpp"
 #include "widgets/Logger.h"
+#include <algorithm>
+
+#define COLLECTION  "BOMs"
 
 using namespace DB::BOM;
 
 static bsoncxx::document::value CreateDocument(BOM bom);
 static bsoncxx::document::value CreateDocument(const std::string& field, const std::string& val);
-static bsoncxx::document::value CreateDocumentForUpdate(BOM bom);
+static bsoncxx::document::value CreateDocumentForInsert(BOM bom);
+static bsoncxx::document::value CreateDocumentForEdit(const BOM& oldBom, const BOM& newBom);
 static BOM CreateObject(const bsoncxx::document::view& doc);
 static ItemReference CreateItemReference(const bsoncxx::document::view& doc);
 static bool RemoveFromCache(const BOM& bom);
+static void RemoveFromCache(size_t pos);
+static void AddToCache(const BOM& bom);
+static void ReplaceInCache(size_t pos, const BOM& bom);
+static void ClearCache();
+static std::vector<const std::string*> GetTextFields(const BOM& bom);
 static std::string FindDiffs(const BOM& a, const BOM& b);
+static void OnWriteAcknowledged(bool r);
+static void OnCreateAcknowledged(bool r, const std::string& oid, const std::string& id);
+static void ApplyChanges();
+static void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid);
+static void ApplyDelete(const std::string& oid);
 
 static std::vector<BOM> boms;
+static unsigned int generation = 0; /**< Incremented every time the cache is modified */
+static FilterUtils::TrigramIndex textIndex; /**< Positions in the cache, by trigram of the text fields */
 static bool isInit = false;
 static bool hasError = false;
+//! Where the cache stands in the synchronization with the collection.
+static DB::SyncState syncState;
+static DB::ChangeStream::Watcher watcher(DATABASE, COLLECTION);
+
 
+/**
+ * @brief   Form the searchable version of every field of the BOM, so that the filters
+ *          don't have to change their case every time they look at the BOM.
+ * @param   None
+ * @retval  None
+ */
+void DB::BOM::BOM::UpdateSearchKeys()
+{
+    m_searchKeys[size_t(SearchKey::id)] = m_id;
+    m_searchKeys[size_t(SearchKey::name)] = m_name;
+    m_searchKeys[size_t(SearchKey::outputId)] = m_output.GetId();
+
+    for (std::string& key : m_searchKeys)
+    {
+        boost::to_upper(key);
+    }
+}
 
 const DB::Item::Item DB::BOM::BOM::GetOutput() const
 {
-    return DB::Item::GetItemByID(m_output.GetId());
+    return m_output.GetItem();
 }
 
 const std::vector<DB::Item::Item> DB::BOM::BOM::GetItems() const
@@ -32,7 +72,7 @@ const std::vector<DB::Item::Item> DB::BOM::BOM::GetItems() const
     for (auto& i : m_items)
     {
         // Fetch the DB::Item::Item instance and adds it to the list.
-        items.emplace_back(DB::Item::GetItemByID(i.GetId()));
+        items.emplace_back(i.GetItem());
     }
 
     return items;
@@ -54,11 +94,20 @@ bool DB::BOM::Init()
         return false;
     }
 
+    // Index the write times and purge the old tombstones, once.
+    static bool isSyncPrepared = false;
+    if (isSyncPrepared == false)
+    {
+        isSyncPrepared = true;
+        DB::PrepareSync(DATABASE, COLLECTION);
+    }
+
     // Clear the cache.
-    boms.clear();
+    ClearCache();
+    syncState = DB::SyncState();
 
     // Get all the BOMs from the database.
-    bsoncxx::stdx::optional<mongocxx::cursor> bs = DB::GetAllDocuments(DATABASE, "BOMs");
+    bsoncxx::stdx::optional<DB::Cursor> bs = DB::GetAllDocuments(DATABASE, COLLECTION, DB::ExcludeDeleted());
 
     // `bs` will be `{}` if the query failed.
     if (!bs)
@@ -74,11 +123,14 @@ bool DB::BOM::Init()
         // For each document returned by the database:
         for (auto b : bs.value())
         {
+            DB::UpdateHighWaterMark(b, syncState.mark);
             // Create a BOM instance and add it to the cache.
-            boms.emplace_back(CreateObject(b));
+            AddToCache(CreateObject(b));
         }
 
         isInit = true;
+        // Follow the changes made to the collection from now on.
+        watcher.Start();
         return true;
     }
     catch (const mongocxx::query_exception & e)
@@ -90,16 +142,25 @@ bool DB::BOM::Init()
 }
 
 /**
- * @brief   Refreshes the cache once every 10 seconds
+ * @brief   Keeps the cache in sync with the database.
+ *          If the database streams the changes made to the BOMs, they are applied to the cache.
+ *          Otherwise, what changed since the last refresh is fetched once every 10 seconds.
  * @param   None
  * @retval  None
  */
 void DB::BOM::Refresh()
 {
+    // If the changes are streamed, there's no need to reload everything.
+    if (watcher.IsRunning() && watcher.IsSupported())
+    {
+        ApplyChanges();
+        return;
+    }
+
     static double elapsedTime = 0;
     static int frameCount = 0;
-    // deltaTime is the time between two frames (e.g. deltaTime @ 60fps is ~16.667ms).
-    const static float deltaTime = ImGui::GetIO().DeltaTime;
+    // deltaTime is the time since the last frame, frames are only drawn when something changes.
+    const float deltaTime = ImGui::GetIO().DeltaTime;
 
     // If we're at a new frame:
     if (frameCount != ImGui::GetFrameCount())
@@ -110,20 +171,23 @@ void DB::BOM::Refresh()
         // If it has been more than 10 seconds since the last refresh:
         if (elapsedTime >= 10.f)
         {
-            // Do the refresh. This is done by just re-initializing the module.
+            // Only get what changed since the last refresh, unless it has been too long to do so.
             elapsedTime = 0;
-            Init();
+            if (DB::SyncChanges(DATABASE, COLLECTION, syncState, ApplyUpsert, ApplyDelete) == false)
+            {
+                Init();
+            }
         }
     }
 }
 
 /**
- * @brief   Adds a new BOM to the database and the cache.
+ * @brief   Adds a new BOM to the cache and queues its insertion into the database.
  * @param   bom The BOM to insert into the database.
- * @retval  True if insertion was successful, false otherwise.
+ * @retval  True if the insertion was queued, false otherwise.
  *
- * @note    BOM will be added to the cache even if insertion into database
- *          fails. It will however be removed at the next Refresh event.
+ * @note    BOM is added to the cache right away. If the insertion fails,
+ *          the cache is reloaded from the database.
  */
 bool DB::BOM::AddBom(const BOM& bom /**< [in] The BOM to insert into the database */)
 {
@@ -133,26 +197,29 @@ bool DB::BOM::AddBom(const BOM& bom /**< [in] The BOM to insert into the databas
     }
 
     // Add the BOM to the cache.
-    boms.emplace_back(bom);
-
-    // Create a mongodb document from the BOM.
-    bsoncxx::document::value doc = CreateDocument(bom);
+    AddToCache(bom);
 
     // Log the event.
     Logging::Audit.Info(R"(Created BOM ")" + bom.GetId(), R"(")", true);
 
-    // Insert the BOM in the database.
-    return DB::InsertDocument(doc, DATABASE, "BOMs");
+    // Queue the insertion of the BOM in the database.
+    // It is an upsert so that the time of the write gets stamped by the server.
+    // It doesn't touch a BOM created by someone else in the meantime, nor a deleted one.
+    std::string id = bom.GetId();
+    DB::WriteQueue::Create(DB::ExcludeDeleted(CreateDocument("id", id)), CreateDocumentForInsert(bom),
+                           DATABASE, COLLECTION,
+                           [id](bool r, const std::string& oid) { OnCreateAcknowledged(r, oid, id); });
+    return true;
 }
 
 /**
- * @brief   Update a currently existing BOM in the cache and the database.
+ * @brief   Update a currently existing BOM in the cache and queue its update in the database.
  * @param   oldBom: The BOM to edit.
  * @param   newBom: The new value of the BOM.
- * @retval  True if successfully edited in the database, false otherwise.
+ * @retval  True if the update was queued, false otherwise.
  *
- * @note    Even if the modification in the database fails, the BOM will be modified in the cache.
- *          It will remain like that until the next refresh event.
+ * @note    The BOM is modified in the cache right away. If the update fails,
+ *          the cache is reloaded from the database.
  * @note    The oldBom in the cache isn't technically modified, but rather deleted. The newBom is then
  *          added to the cache.
  */
@@ -166,23 +233,29 @@ bool DB::BOM::EditBom(const BOM& oldBom     /**< [in] The BOM object to edit  */
 
     // Remove the old bom from the cache.
     RemoveFromCache(oldBom);
-    // Add the new bom to the cache.
-    boms.emplace_back(newBom);
+    // Add the new bom to the cache. It is still the same document in the database.
+    BOM edited = newBom;
+    edited.SetOid(oldBom.GetOid());
+    AddToCache(edited);
     // Log the event.
     Logging::Audit.Info("Edited BOM ", oldBom.GetId() + FindDiffs(oldBom, newBom), true);
 
-    // Update the document in the database:
+    // Queue the update of the document in the database:
     //  - CreateDocument -> Create a mongodb document containing only the id of the old bom to use as a filter.
-    //  - CreateDocumentForUpdate -> Create a mongodb document with the new bom.
-    return DB::UpdateDocument(CreateDocument("id", oldBom.GetId()), CreateDocumentForUpdate(newBom), DATABASE, "BOMs");
+    //  - CreateDocumentForEdit -> Create a mongodb document with only the fields that changed.
+    //  - DB::ExcludeDeleted -> So that the tombstone of a deleted BOM with the same id isn't the one updated.
+    DB::WriteQueue::Update(DB::ExcludeDeleted(CreateDocument("id", oldBom.GetId())),
+                           CreateDocumentForEdit(oldBom, newBom), DATABASE, COLLECTION,
+                           OnWriteAcknowledged);
+    return true;
 }
 
 /**
- * @brief   Delete a BOM from the cache and the database.
+ * @brief   Delete a BOM from the cache and queue its deletion from the database.
  * @param   The BOM to delete. Only the `m_id` field of the bom object is used to query the database.
- * @retval  True if successfully deleted from the database, false otherwise.
- * @note    Even if the bom isn't deleted from the database, it will still be removed from the cache.
- *          This will remain until the next refresh event.
+ * @retval  True if the deletion was queued, false otherwise.
+ * @note    The bom is removed from the cache right away. If the deletion fails,
+ *          the cache is reloaded from the database.
  */
 bool DB::BOM::DeleteBom(const BOM& bom /**< [in] The BOM object to delete */)
 {
@@ -196,8 +269,12 @@ bool DB::BOM::DeleteBom(const BOM& bom /**< [in] The BOM object to delete */)
     // Log the event.
     Logging::Audit.Info("Deleted BOM \"" + bom.GetId(), "\"", true);
 
-    // Delete the BOM from the database.
-    return (DB::DeleteDocument(CreateDocument("id", bom.GetId()), DATABASE, "BOMs"));
+    // Queue the deletion of the BOM from the database.
+    // The document is only marked as deleted, so that the other clients can find out about it.
+    // A tombstone left by an earlier deletion of the same id mustn't be the one matched.
+    DB::WriteQueue::Update(DB::ExcludeDeleted(CreateDocument("id", bom.GetId())), DB::MakeTombstone(), DATABASE, COLLECTION,
+                           OnWriteAcknowledged);
+    return true;
 }
 
 /**
@@ -210,6 +287,44 @@ const std::vector<BOM>& DB::BOM::GetAll()
     return boms;
 }
 
+/**
+ * @brief   Find the cached BOMs that might contain a text, without looking at every BOM.
+ *          The candidates still have to be checked, they only contain every trigram of the text.
+ * @param   text: The text to look for, in all caps.
+ * @param   candidates: Where to store the BOMs found.
+ * @retval  True if the candidates were found.
+ *          False if the text is too short to use the index: every BOM is a candidate.
+ * @note    The pointers are only valid until the cache is modified, see DB::BOM::GetGeneration.
+ */
+bool DB::BOM::FindCandidates(const std::string& text, std::vector<const BOM*>& candidates)
+{
+    candidates.clear();
+
+    std::vector<size_t> positions;
+    if (textIndex.FindCandidates(text, positions) == false)
+    {
+        return false;
+    }
+
+    candidates.reserve(positions.size());
+    for (size_t pos : positions)
+    {
+        candidates.push_back(&boms[pos]);
+    }
+    return true;
+}
+
+/**
+ * @brief   Get the generation of the cache, which changes every time the cache is modified.
+ *          Anything derived from the cache (pointers, filtered lists, etc.) is stale once it changes.
+ * @param   None
+ * @retval  The generation of the cache.
+ */
+unsigned int DB::BOM::GetGeneration()
+{
+    return generation;
+}
+
 /**
  * @brief   Form a new ID for a BOM item by adding 1 to the highest ID found in the cache.
  *          Example:
@@ -242,6 +357,108 @@ std::string DB::BOM::GetNewId(int id)
     return ret;
 }
 
+/**
+ * @brief   Called once the database acknowledged a write queued by this module.
+ *          If the write failed, the optimistic change done to the cache is undone by reloading it.
+ * @param   r: True if the write succeeded.
+ * @retval  None
+ */
+void OnWriteAcknowledged(bool r)
+{
+    if (r == false)
+    {
+        Logging::System.Error("Unable to save the changes made to the BOMs, reloading them.");
+        DB::BOM::Init();
+    }
+}
+
+/**
+ * @brief   Called once the database acknowledged the creation of a BOM.
+ *          If someone else created a BOM with the same id first, ours wasn't written
+ *          and the cache is reloaded to get theirs.
+ * @param   r: True if the write succeeded.
+ * @param   oid: The ObjectId of the created document, empty if another BOM already had that id.
+ * @param   id: The id of the BOM that was created.
+ * @retval  None
+ */
+void OnCreateAcknowledged(bool r, const std::string& oid, const std::string& id)
+{
+    if (r == true && oid.empty())
+    {
+        Logging::System.Error("Unable to create BOM \"" + id, "\", another BOM already has that id. Reloading the BOMs.");
+        DB::BOM::Init();
+        return;
+    }
+
+    OnWriteAcknowledged(r);
+}
+
+/**
+ * @brief   Apply the changes streamed by the database to the cache.
+ * @param   None
+ * @retval  None
+ */
+void ApplyChanges()
+{
+    for (DB::ChangeStream::Event& e : watcher.TakeEvents())
+    {
+        switch (e.type)
+        {
+            case DB::ChangeStream::EventType::Upsert:
+                ApplyUpsert(e.doc.value().view(), e.oid);
+                break;
+            case DB::ChangeStream::EventType::Delete:
+                ApplyDelete(e.oid);
+                break;
+            case DB::ChangeStream::EventType::Reload:
+            default:
+                DB::BOM::Init();
+                break;
+        }
+    }
+}
+
+/**
+ * @brief   Add or update a BOM of the cache with a document read from the database.
+ *          The document is matched to a cached BOM by ObjectId or, for a BOM
+ *          that was added locally and isn't acknowledged yet, by id.
+ * @param   doc: The document read from the database.
+ * @param   oid: The ObjectId of the document.
+ * @retval  None
+ */
+void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid)
+{
+    BOM obj = CreateObject(doc);
+    auto match = std::find_if(boms.begin(), boms.end(), [&](const BOM& o)
+                              {
+                                  return o.GetOid() == oid || (o.GetOid().empty() && o.GetId() == obj.GetId());
+                              });
+    // If the BOM is already in the cache, update it. Otherwise, add it.
+    if (match != boms.end())
+    {
+        ReplaceInCache(size_t(match - boms.begin()), obj);
+    }
+    else
+    {
+        AddToCache(obj);
+    }
+}
+
+/**
+ * @brief   Remove a BOM from the cache.
+ * @param   oid: The ObjectId of the BOM that was deleted.
+ * @retval  None
+ */
+void ApplyDelete(const std::string& oid)
+{
+    auto match = std::find_if(boms.begin(), boms.end(),
+                              [&](const BOM& o) { return o.GetOid() == oid; });
+    if (match != boms.end())
+    {
+        RemoveFromCache(size_t(match - boms.begin()));
+    }
+}
+
 /**
  * @brief   Create a mongodb document from a BOM object.
  *          The created document is pretty much just a JSON dump of the object.
@@ -305,20 +522,27 @@ bsoncxx::document::value CreateDocument(const std::string& field    /**< [in] Th
 }
 
 /**
- * @brief   Create a mongoDB document to use in an update query from a BOM object.
+ * @brief   Create a mongoDB document to use in the upsert creating a BOM.
  * @param   bom The BOM instance to use to create the document.
  * @retval  The created document.
  */
-bsoncxx::document::value CreateDocumentForUpdate(BOM bom    /**< [in] The BOM object to use to create the document */)
+bsoncxx::document::value CreateDocumentForInsert(BOM bom    /**< [in] The BOM object to use to create the document */)
 {
     using bsoncxx::builder::basic::kvp;
-    // Create the builder object.
-    auto builder = bsoncxx::builder::basic::document{};
-    // Create a mongodb document from the bom object and add it to the document.
-    builder.append(kvp("$set", CreateDocument(bom)));
+    // Set every field of the new BOM and have the server stamp the time of the write.
+    return DB::MakeStampedInsert(CreateDocument(bom));
+}
 
-    // Make a `bsoncxx::document::value` from the builder.
-    return builder.extract();
+/**
+ * @brief   Create a mongoDB document to use in an update query that only changes
+ *          the fields that differ between two versions of a BOM.
+ * @param   oldBom: The BOM as it was read.
+ * @param   newBom: The BOM as it should be.
+ * @retval  The created document.
+ */
+bsoncxx::document::value CreateDocumentForEdit(const BOM& oldBom, const BOM& newBom)
+{
+    return DB::MakeDiffUpdate(CreateDocument(oldBom), CreateDocument(newBom));
 }
 
 /**
@@ -361,6 +585,17 @@ BOM CreateObject(const bsoncxx::document::view& doc /**< [in] The document to cr
 
     // And do the same for the rest of the members of the BOM class...
 
+    // Get the ObjectId of the document.
+    std::string oid = "";
+    el = doc["_id"];
+    if (el.raw() != nullptr)
+    {
+        if (el.type() == bsoncxx::type::k_oid)
+        {
+            oid = el.get_oid().value.to_string();
+        }
+    }
+
     el = doc["output"];
     if (el.raw() != nullptr)
     {
@@ -388,7 +623,9 @@ BOM CreateObject(const bsoncxx::document::view& doc /**< [in] The document to cr
     }
 
     // Instantiate BOM with the values we extracted from the document.
-    return BOM(id, name, items, output);
+    BOM bom = BOM(id, name, items, output);
+    bom.SetOid(oid);
+    return bom;
 }
 
 /**
@@ -474,7 +711,7 @@ bool RemoveFromCache(const BOM& bom)
         if (*i == bom)
         {
             // Remove it from the cache.
-            boms.erase(i);
+            RemoveFromCache(size_t(i - boms.begin()));
             return true;
         }
     }
@@ -482,6 +719,79 @@ bool RemoveFromCache(const BOM& bom)
     return false;
 }
 
+/**
+ * @brief   Remove a BOM from the cache.
+ *          The last BOM of the cache takes its place, so nothing else has to move.
+ * @param   pos: The position of the BOM to remove.
+ * @retval  None
+ */
+void RemoveFromCache(size_t pos)
+{
+    size_t last = boms.size() - 1;
+    textIndex.Remove(pos, GetTextFields(boms[pos]));
+    if (pos != last)
+    {
+        textIndex.Remove(last, GetTextFields(boms[last]));
+        boms[pos] = std::move(boms[last]);
+        textIndex.Add(pos, GetTextFields(boms[pos]));
+    }
+    boms.pop_back();
+    generation++;
+}
+
+/**
+ * @brief   Add a BOM to the cache.
+ * @param   bom: The BOM to add.
+ * @retval  None
+ */
+void AddToCache(const BOM& bom)
+{
+    boms.emplace_back(bom);
+    textIndex.Add(boms.size() - 1, GetTextFields(boms.back()));
+    generation++;
+}
+
+/**
+ * @brief   Replace a BOM of the cache.
+ * @param   pos: The position of the BOM to replace.
+ * @param   bom: The new value of the BOM.
+ * @retval  None
+ */
+void ReplaceInCache(size_t pos, const BOM& bom)
+{
+    textIndex.Remove(pos, GetTextFields(boms[pos]));
+    boms[pos] = bom;
+    textIndex.Add(pos, GetTextFields(boms[pos]));
+    generation++;
+}
+
+/**
+ * @brief   Remove every BOM from the cache.
+ * @param   None
+ * @retval  None
+ */
+void ClearCache()
+{
+    boms.clear();
+    textIndex.Clear();
+    generation++;
+}
+
+/**
+ * @brief   Get the text fields of a BOM that are indexed: all of its search keys.
+ * @param   bom: The BOM.
+ * @retval  Its search keys.
+ */
+std::vector<const std::string*> GetTextFields(const BOM& bom)
+{
+    std::vector<const std::string*> fields;
+    for (int key = 0; key < int(SearchKey::count); key++)
+    {
+        fields.push_back(&bom.GetSearchKey(SearchKey(key)));
+    }
+    return fields;
+}
+
 /**
  * @brief   Create a string containing a list of the differences between two BOM objects.
  * @param   const BOM& from: The original BOM object to use.
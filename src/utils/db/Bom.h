@@ -130,6 +130,18 @@ public:
         m_qty = qty;
     }
 
+    /**
+     * @brief   Get the DB::Item::Item represented by `this` from the cache.
+     *          It is only searched for once per modification of the cache.
+     * @param   None
+     * @retval  A pointer to the cached Item, nullptr if it isn't in the cache.
+     * @note    The pointer is only valid until the Item cache is modified.
+     */
+    inline const DB::Item::Item* Resolve() const
+    {
+        return DB::Item::Resolve(m_id, m_handle);
+    }
+
     /**
      * @brief   Return a copy of the DB::Item::Item represented by `this`.
      * @param   None
@@ -137,7 +149,8 @@ public:
      */
     inline DB::Item::Item GetItem() const
     {
-        return DB::Item::GetItemByID(m_id);
+        const DB::Item::Item* item = Resolve();
+        return item != nullptr ? *item : DB::Item::GetItemByID(m_id);
     }
 
     /**
@@ -168,6 +181,20 @@ private:
     std::string m_objectId = "N/A"; /**< The mongodb ObjectId of the item */
     float       m_qty = 0.00f;      /**< The quantity needed by the BOM */
     int         m_position = 0;     /**< The item's position in the list */
+    //! Where the item is in the cache. Only used by the UI thread.
+    mutable DB::Item::Handle m_handle;
+};
+
+/**
+ * @enum    SearchKey
+ * @brief   The fields of a BOM that can be searched, in the order the filters list them.
+ */
+enum class SearchKey
+{
+    id = 0,
+    name,
+    outputId,
+    count,  /*!< The number of search keys, not a key. */
 };
 
 /**
@@ -192,6 +219,27 @@ public:
     BOM(const std::string& id, const std::string& name, const std::vector<ItemReference>& items, const ItemReference& outputItem) :
         m_id(id), m_name(name), m_items(items), m_output(outputItem)
     {
+        UpdateSearchKeys();
+    }
+
+    /**
+     * @brief   Get the mongodb ObjectId of the BOM
+     * @param   None
+     * @retval  The ObjectId of the BOM, empty if it hasn't been assigned by the database yet
+     */
+    inline const std::string& GetOid() const
+    {
+        return m_oid;
+    }
+
+    /**
+     * @brief   Set the mongodb ObjectId of the BOM
+     * @param   oid: The ObjectId assigned by the database
+     * @retval  None
+     */
+    inline void SetOid(const std::string& oid)
+    {
+        m_oid = oid;
     }
 
     /**
@@ -259,11 +307,25 @@ public:
      * @retval  A std::vector of DB::Item::Item objects corresponding to the list of items.
      */
     const std::vector<DB::Item::Item> GetItems() const;
+
+    /**
+     * @brief   Get the value of a field of the BOM, as searched by the filters: in all caps.
+     * @param   key: The field to get.
+     * @retval  The searchable value of the field.
+     */
+    inline const std::string& GetSearchKey(SearchKey key) const
+    {
+        return m_searchKeys[size_t(key)];
+    }
 private:
+    void UpdateSearchKeys();
+
+    std::string m_oid = "";     //!< The mongodb ObjectId of the BOM. Not saved, handled by the database.
     std::string m_id = "N/A";   //!< The CEP id of the BOM.
     std::string m_name = "N/A"; //!< The name of the BOM.
     std::vector<ItemReference> m_items = std::vector<ItemReference>(); //!< A list of the items needed by the BOM.
     ItemReference m_output;     //!< The item used as an output by the BOM.
+    std::string m_searchKeys[size_t(SearchKey::count)]; //!< The searchable fields, in all caps.
 };
 
 /*****************************************************************************/
@@ -278,6 +340,8 @@ bool EditBom(const BOM& oldBom, const BOM& newBom);
 bool DeleteBom(const BOM& bom);
 
 const std::vector<BOM>& GetAll();
+unsigned int GetGeneration();
+bool FindCandidates(const std::string& text, std::vector<const BOM*>& candidates);
 std::string GetNewId(int id = -1);
 }
 }
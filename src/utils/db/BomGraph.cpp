@@ -0,0 +1,606 @@
+﻿#include "BomGraph.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace DB
+{
+namespace BomGraph
+{
+/**
+ * @struct  Line
+ * @brief   A component of a BOM.
+ */
+struct Line
+{
+    std::string id;         /**< The id of the Item */
+    double quantity = 0.0;  /**< The quantity needed per make */
+};
+
+/**
+ * @struct  Recipe
+ * @brief   How a BOM is made, along with what it costs.
+ */
+struct Recipe
+{
+    std::string outputId;           /**< The id of the Item made */
+    double outputQuantity = 1.0;    /**< The number of Items made per make */
+    std::vector<Line> lines;        /**< The components needed per make */
+    bool isCostValid = false;       /**< `cost` and `isCostKnown` are up to date */
+    bool isCostKnown = false;       /**< False if one of the components depends on a cycle or has no price */
+    double cost = 0.0;              /**< The cost of making the BOM once */
+};
+
+/**
+ * @struct  Price
+ * @brief   The price of a raw material, as read from the Item cache.
+ */
+struct Price
+{
+    bool isKnown = false;   /**< False if the Item isn't in the cache */
+    double value = 0.0;     /**< The price of one Item */
+};
+
+/**
+ * @struct  Node
+ * @brief   An assembly: an Item made by a BOM.
+ */
+struct Node
+{
+    std::string bomId;              /**< The id of the BOM making the Item */
+    bool dependsOnCycle = false;    /**< Made from itself, or from a sub-assembly that is, at any level.
+                                         Such an assembly has no per unit requirements nor cost */
+    bool isMemoValid = false;       /**< `perUnit` is up to date */
+    std::vector<Requirement> perUnit;   /**< The raw materials needed per Item made, sorted by id */
+};
+
+static bool IsSameRecipe(const Recipe& a, const Recipe& b);
+static void UpdatePrices();
+static Price ReadPrice(const std::string& id);
+static void Invalidate(const std::vector<std::string>& changed);
+static void SortNodes();
+static const std::vector<Requirement>& GetPerUnit(Node& node);
+static bool GetItemCost(const std::string& id, double& cost);
+static bool GetRecipeCost(Recipe& recipe, double& cost);
+
+//! How each BOM of the cache is made, by id of the BOM.
+static std::unordered_map<std::string, Recipe> recipes;
+//! The assemblies, by id of the Item made.
+static std::unordered_map<std::string, Node> nodes;
+//! The assemblies using each Item as a component, by id of the Item.
+static std::unordered_map<std::string, std::vector<std::string>> parents;
+//! The BOMs using each Item as a component, by id of the Item. Unlike `parents`,
+//! it includes the BOMs making an Item that another BOM is used for.
+static std::unordered_map<std::string, std::vector<std::string>> users;
+//! The assemblies that don't depend on a cycle, each one after all of its sub-assemblies.
+static std::vector<std::string> order;
+//! The prices of the raw materials the costs were computed with, by id of the Item.
+static std::unordered_map<std::string, Price> prices;
+//! Generation of the BOM cache the graph was built from.
+static unsigned int builtGeneration = 0;
+//! Generation of the Item cache the prices were checked at.
+static unsigned int priceGeneration = 0;
+static bool isBuilt = false;
+}
+}
+
+using namespace DB::BomGraph;
+
+/**
+ * @brief   Build the graph again if the BOM cache changed since it was last built,
+ *          and check the prices of the raw materials if the Item cache changed.
+ *          Only the assemblies and BOMs whose recipe or prices changed, and the ones using them,
+ *          lose what was remembered.
+ * @param   None
+ * @retval  None
+ */
+void DB::BomGraph::Update()
+{
+    UpdatePrices();
+
+    if (isBuilt == true && builtGeneration == DB::BOM::GetGeneration())
+    {
+        return;
+    }
+    builtGeneration = DB::BOM::GetGeneration();
+    isBuilt = true;
+
+    std::unordered_map<std::string, Recipe> builtRecipes;
+    std::unordered_set<std::string> changedRecipes;
+    std::unordered_map<std::string, Node> built;
+    for (const DB::BOM::BOM& bom : DB::BOM::GetAll())
+    {
+        Recipe recipe;
+        recipe.outputId = bom.GetRawOutput().GetId();
+        recipe.outputQuantity = bom.GetRawOutput().GetQuantity() > 0.0f ? bom.GetRawOutput().GetQuantity() : 1.0;
+        for (const DB::BOM::ItemReference& line : bom.GetRawItems())
+        {
+            recipe.lines.push_back({ line.GetId(), line.GetQuantity() });
+        }
+
+        // Keep the cost of the BOMs that didn't change.
+        auto old = recipes.find(bom.GetId());
+        if (old != recipes.end() && IsSameRecipe(old->second, recipe))
+        {
+            recipe = std::move(old->second);
+        }
+        else
+        {
+            changedRecipes.insert(bom.GetId());
+        }
+
+        // If several BOMs make the same Item, the one with the smallest id is used,
+        // so that the choice doesn't depend on the order of the cache.
+        auto existing = built.find(recipe.outputId);
+        if (existing == built.end() || bom.GetId() < existing->second.bomId)
+        {
+            Node node;
+            node.bomId = bom.GetId();
+            built[recipe.outputId] = std::move(node);
+        }
+        builtRecipes[bom.GetId()] = std::move(recipe);
+    }
+
+    // Keep what was computed for the assemblies still made the same way.
+    std::vector<std::string> changed;
+    for (auto& node : built)
+    {
+        auto old = nodes.find(node.first);
+        if (old != nodes.end() && old->second.bomId == node.second.bomId &&
+            changedRecipes.count(node.second.bomId) == 0)
+        {
+            node.second.isMemoValid = old->second.isMemoValid;
+            node.second.perUnit = std::move(old->second.perUnit);
+        }
+        else
+        {
+            changed.push_back(node.first);
+        }
+    }
+    // An assembly that isn't made by a BOM anymore is now a raw material.
+    for (const auto& node : nodes)
+    {
+        if (built.count(node.first) == 0)
+        {
+            changed.push_back(node.first);
+        }
+    }
+    recipes = std::move(builtRecipes);
+    nodes = std::move(built);
+
+    parents.clear();
+    users.clear();
+    for (const auto& recipe : recipes)
+    {
+        bool isUsed = nodes[recipe.second.outputId].bomId == recipe.first;
+        for (const Line& line : recipe.second.lines)
+        {
+            users[line.id].push_back(recipe.first);
+            if (isUsed == true)
+            {
+                parents[line.id].push_back(recipe.second.outputId);
+            }
+        }
+    }
+
+    Invalidate(changed);
+    SortNodes();
+}
+
+/**
+ * @brief   Check if an Item is made by a BOM.
+ * @param   itemId: The id of the Item.
+ * @retval  True if it is an assembly, false if it is a raw material.
+ */
+bool DB::BomGraph::IsAssembly(const std::string& itemId)
+{
+    Update();
+    return nodes.count(itemId) != 0;
+}
+
+/**
+ * @brief   Check if an assembly depends on a cycle: it is made from itself, directly or through
+ *          its sub-assemblies, or one of its sub-assemblies is, at any level.
+ *          Such an assembly can't be exploded nor costed.
+ * @param   itemId: The id of the Item.
+ * @retval  True if the assembly depends on a cycle, false otherwise.
+ */
+bool DB::BomGraph::DependsOnCycle(const std::string& itemId)
+{
+    Update();
+    auto node = nodes.find(itemId);
+    return node != nodes.end() && node->second.dependsOnCycle == true;
+}
+
+/**
+ * @brief   Get the assemblies ordered so that each comes after all of its sub-assemblies.
+ * @param   None
+ * @retval  The ids of the Items made, without the assemblies that depend on a cycle.
+ */
+const std::vector<std::string>& DB::BomGraph::GetTopologicalOrder()
+{
+    Update();
+    return order;
+}
+
+/**
+ * @brief   Get the raw materials needed to make a quantity of an Item, through every level of sub-assemblies.
+ * @param   itemId: The id of the Item to make.
+ * @param   quantity: The number of Items to make.
+ * @param   requirements: Set to the raw materials needed, sorted by id.
+ *                        A raw material only needs itself.
+ * @retval  True if the Item could be exploded, false if it depends on a cycle.
+ */
+bool DB::BomGraph::Explode(const std::string& itemId, double quantity, std::vector<Requirement>& requirements)
+{
+    Update();
+    requirements.clear();
+
+    auto node = nodes.find(itemId);
+    if (node == nodes.end())
+    {
+        requirements.push_back({ itemId, quantity });
+        return true;
+    }
+    if (node->second.dependsOnCycle == true)
+    {
+        return false;
+    }
+
+    for (const Requirement& r : GetPerUnit(node->second))
+    {
+        requirements.push_back({ r.id, r.quantity * quantity });
+    }
+    return true;
+}
+
+/**
+ * @brief   Get the raw materials needed to make a BOM a number of times, through every level of sub-assemblies.
+ *          Unlike exploding its output, this uses this BOM even if another one makes the same Item.
+ * @param   bom: The BOM to make.
+ * @param   count: The number of times the BOM is made.
+ * @param   requirements: Set to the raw materials needed, sorted by id.
+ * @retval  True if the BOM could be exploded, false if one of its components depends on a cycle.
+ */
+bool DB::BomGraph::Explode(const DB::BOM::BOM& bom, double count, std::vector<Requirement>& requirements)
+{
+    Update();
+    requirements.clear();
+
+    std::map<std::string, double> totals;
+    std::vector<Requirement> lineRequirements;
+    for (const DB::BOM::ItemReference& line : bom.GetRawItems())
+    {
+        if (Explode(line.GetId(), line.GetQuantity() * count, lineRequirements) == false)
+        {
+            return false;
+        }
+        for (const Requirement& r : lineRequirements)
+        {
+            totals[r.id] += r.quantity;
+        }
+    }
+
+    for (const auto& total : totals)
+    {
+        requirements.push_back({ total.first, total.second });
+    }
+    return true;
+}
+
+/**
+ * @brief   Get the cost of an Item: its price if it is a raw material, or the cost of
+ *          its raw materials if it is an assembly, through every level of sub-assemblies.
+ * @param   itemId: The id of the Item.
+ * @param   cost: Set to the cost of one Item, in $CDN.
+ * @retval  True if the cost is known, false if the Item depends on a cycle or one of its raw materials
+ *          isn't in the Item cache.
+ */
+bool DB::BomGraph::GetUnitCost(const std::string& itemId, double& cost)
+{
+    Update();
+    if (DependsOnCycle(itemId) == true)
+    {
+        return false;
+    }
+    return GetItemCost(itemId, cost);
+}
+
+/**
+ * @brief   Get the cost of making a BOM once, through every level of sub-assemblies.
+ *          The cost of the BOMs of the cache is remembered until their recipe,
+ *          or the price of one of their raw materials, changes.
+ * @param   bom: The BOM. If it isn't in the cache, its cost is computed but not remembered.
+ * @param   cost: Set to the cost of making the BOM once, in $CDN.
+ * @retval  True if the cost is known, false if one of the components depends on a cycle
+ *          or one of the raw materials isn't in the Item cache.
+ */
+bool DB::BomGraph::GetCost(const DB::BOM::BOM& bom, double& cost)
+{
+    Update();
+    auto recipe = recipes.find(bom.GetId());
+    if (recipe != recipes.end())
+    {
+        return GetRecipeCost(recipe->second, cost);
+    }
+
+    Recipe tmp;
+    for (const DB::BOM::ItemReference& line : bom.GetRawItems())
+    {
+        tmp.lines.push_back({ line.GetId(), line.GetQuantity() });
+    }
+    return GetRecipeCost(tmp, cost);
+}
+
+/**
+ * @brief   Check if two BOMs are made the same way.
+ * @param   a: The first BOM.
+ * @param   b: The second BOM.
+ * @retval  True if they make the same Item with the same components.
+ */
+bool DB::BomGraph::IsSameRecipe(const Recipe& a, const Recipe& b)
+{
+    if (a.outputId != b.outputId || a.outputQuantity != b.outputQuantity || a.lines.size() != b.lines.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.lines.size(); i++)
+    {
+        if (a.lines[i].id != b.lines[i].id || a.lines[i].quantity != b.lines[i].quantity)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief   Check if the prices the costs were computed with are still right, once the Item cache changes.
+ *          The costs using a price that changed are computed again.
+ * @param   None
+ * @retval  None
+ */
+void DB::BomGraph::UpdatePrices()
+{
+    if (priceGeneration == DB::Item::GetGeneration())
+    {
+        return;
+    }
+    priceGeneration = DB::Item::GetGeneration();
+
+    std::vector<std::string> changed;
+    for (auto& price : prices)
+    {
+        Price current = ReadPrice(price.first);
+        if (current.isKnown != price.second.isKnown || current.value != price.second.value)
+        {
+            price.second = current;
+            changed.push_back(price.first);
+        }
+    }
+    Invalidate(changed);
+}
+
+/**
+ * @brief   Get the price of an Item from the cache.
+ * @param   id: The id of the Item.
+ * @retval  Its price, unknown if it isn't in the cache.
+ */
+Price DB::BomGraph::ReadPrice(const std::string& id)
+{
+    Price price;
+    const DB::Item::Item* item = DB::Item::FindItemByID(id);
+    if (item != nullptr)
+    {
+        price.isKnown = true;
+        price.value = item->GetPrice();
+    }
+    return price;
+}
+
+/**
+ * @brief   Forget what was computed for the Items that changed and everything using them, directly or not.
+ * @param   changed: The Items whose recipe or price changed.
+ * @retval  None
+ */
+void DB::BomGraph::Invalidate(const std::vector<std::string>& changed)
+{
+    std::deque<std::string> pending(changed.begin(), changed.end());
+    std::unordered_set<std::string> visited(changed.begin(), changed.end());
+    while (pending.empty() == false)
+    {
+        std::string id = std::move(pending.front());
+        pending.pop_front();
+
+        auto node = nodes.find(id);
+        if (node != nodes.end())
+        {
+            node->second.isMemoValid = false;
+            node->second.perUnit.clear();
+        }
+
+        // Every BOM using the Item must be costed again.
+        auto boms = users.find(id);
+        if (boms != users.end())
+        {
+            for (const std::string& bomId : boms->second)
+            {
+                recipes[bomId].isCostValid = false;
+            }
+        }
+
+        auto assemblies = parents.find(id);
+        if (assemblies == parents.end())
+        {
+            continue;
+        }
+        for (const std::string& parent : assemblies->second)
+        {
+            if (visited.insert(parent).second == true)
+            {
+                pending.push_back(parent);
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Order the assemblies so that each one comes after its sub-assemblies (Kahn's algorithm).
+ *          Those that can't be ordered depend on a cycle: they are part of one, or use an assembly that is.
+ * @param   None
+ * @retval  None
+ */
+void DB::BomGraph::SortNodes()
+{
+    // Count the sub-assemblies of each assembly.
+    std::unordered_map<std::string, size_t> remaining;
+    std::deque<std::string> ready;
+    for (auto& node : nodes)
+    {
+        std::unordered_set<std::string> children;
+        for (const Line& line : recipes[node.second.bomId].lines)
+        {
+            if (nodes.count(line.id) != 0)
+            {
+                children.insert(line.id);
+            }
+        }
+        remaining[node.first] = children.size();
+        node.second.dependsOnCycle = true;
+        if (children.empty() == true)
+        {
+            ready.push_back(node.first);
+        }
+    }
+
+    // Take the assemblies whose sub-assemblies are all ordered.
+    order.clear();
+    while (ready.empty() == false)
+    {
+        std::string id = std::move(ready.front());
+        ready.pop_front();
+        nodes[id].dependsOnCycle = false;
+        order.push_back(id);
+
+        // The same parent can use the Item on several lines, it only counts once.
+        std::unordered_set<std::string> users;
+        auto it = parents.find(id);
+        if (it != parents.end())
+        {
+            users.insert(it->second.begin(), it->second.end());
+        }
+        for (const std::string& parent : users)
+        {
+            if (--remaining[parent] == 0)
+            {
+                ready.push_back(parent);
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Get the raw materials needed per Item made by an assembly, computing them if they aren't remembered.
+ * @param   node: The assembly. It must not depend on a cycle.
+ * @retval  The raw materials, sorted by id.
+ */
+const std::vector<Requirement>& DB::BomGraph::GetPerUnit(Node& node)
+{
+    if (node.isMemoValid == true)
+    {
+        return node.perUnit;
+    }
+
+    const Recipe& recipe = recipes[node.bomId];
+    std::map<std::string, double> totals;
+    for (const Line& line : recipe.lines)
+    {
+        double quantity = line.quantity / recipe.outputQuantity;
+        auto child = nodes.find(line.id);
+        if (child == nodes.end())
+        {
+            totals[line.id] += quantity;
+            continue;
+        }
+        // The sub-assembly doesn't depend on a cycle either, since the assembly using it doesn't.
+        for (const Requirement& r : GetPerUnit(child->second))
+        {
+            totals[r.id] += r.quantity * quantity;
+        }
+    }
+
+    node.perUnit.clear();
+    node.perUnit.reserve(totals.size());
+    for (const auto& total : totals)
+    {
+        node.perUnit.push_back({ total.first, total.second });
+    }
+    node.isMemoValid = true;
+    return node.perUnit;
+}
+
+/**
+ * @brief   Get the cost of one Item, computing it if it isn't remembered.
+ * @param   id: The id of the Item. It must not depend on a cycle.
+ * @param   cost: Set to the cost of the Item.
+ * @retval  True if the cost is known, false if the Item, or one of its raw materials, isn't in the Item cache.
+ */
+bool DB::BomGraph::GetItemCost(const std::string& id, double& cost)
+{
+    auto node = nodes.find(id);
+    // If it is a raw material, remember the price used so that a change can be detected.
+    if (node == nodes.end())
+    {
+        auto price = prices.find(id);
+        if (price == prices.end())
+        {
+            price = prices.emplace(id, ReadPrice(id)).first;
+        }
+        cost = price->second.value;
+        return price->second.isKnown;
+    }
+
+    Recipe& recipe = recipes[node->second.bomId];
+    bool isKnown = GetRecipeCost(recipe, cost);
+    cost /= recipe.outputQuantity;
+    return isKnown;
+}
+
+/**
+ * @brief   Get the cost of making a BOM once, computing it if it isn't remembered.
+ * @param   recipe: The recipe of the BOM.
+ * @param   cost: Set to the cost of making the BOM once.
+ * @retval  True if the cost is known, false if one of the components depends on a cycle
+ *          or has no price.
+ */
+bool DB::BomGraph::GetRecipeCost(Recipe& recipe, double& cost)
+{
+    if (recipe.isCostValid == false)
+    {
+        // A component depending on a cycle has no cost, and asking for it would never end.
+        recipe.isCostKnown = std::none_of(recipe.lines.begin(), recipe.lines.end(),
+                                          [](const Line& line)
+                                          {
+                                              auto node = nodes.find(line.id);
+                                              return node != nodes.end() && node->second.dependsOnCycle == true;
+                                          });
+        recipe.cost = 0.0;
+        for (size_t i = 0; i < recipe.lines.size() && recipe.isCostKnown == true; i++)
+        {
+            // A component missing from the Item cache has no price, rather than a free one.
+            double lineCost = 0.0;
+            recipe.isCostKnown = GetItemCost(recipe.lines[i].id, lineCost);
+            recipe.cost += recipe.lines[i].quantity * lineCost;
+        }
+        if (recipe.isCostKnown == false)
+        {
+            recipe.cost = 0.0;
+        }
+        recipe.isCostValid = true;
+    }
+
+    cost = recipe.cost;
+    return recipe.isCostKnown;
+}
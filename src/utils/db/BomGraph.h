@@ -0,0 +1,81 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup BomGraph
+ * @{
+ * @file    BomGraph
+ * @author  Samuel Martel
+ * @brief   Header for the BomGraph module.
+ *
+ * @date 10/17/2026 5:03:21 PM
+ *
+ * @attention   The graph is built from the BOM cache, it must only be used from the UI thread.
+ *
+ ******************************************************************************
+ */
+#ifndef _BomGraph
+#define _BomGraph
+
+/*****************************************************************************/
+/* Includes */
+#include "utils/db/Bom.h"
+#include <string>
+#include <vector>
+
+namespace DB
+{
+/**
+ * @namespace DB::BomGraph BomGraph.h BomGraph
+ * @brief   The namespace for the graph of the BOMs, where the output of a BOM can be
+ *          a component of other BOMs. Used to explode an assembly into the raw materials
+ *          needed to make it, through every level of sub-assemblies.
+ *
+ *          An Item is an assembly if a BOM makes it, a raw material otherwise.
+ *          What an assembly needs per unit made is computed once and remembered,
+ *          until its BOM, or the BOM of one of its sub-assemblies, changes.
+ *          The cost of each BOM is remembered the same way, and also until the price
+ *          of one of its raw materials changes.
+ */
+namespace BomGraph
+{
+/*****************************************************************************/
+/* Exported defines */
+
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+/**
+ * @struct  Requirement
+ * @brief   A quantity of a raw material needed to make something.
+ */
+struct Requirement
+{
+    std::string id;         /**< The id of the Item */
+    double quantity = 0.0;  /**< The quantity needed, in the unit of the Item */
+};
+
+/*****************************************************************************/
+/* Exported functions */
+void Update();
+
+bool IsAssembly(const std::string& itemId);
+bool DependsOnCycle(const std::string& itemId);
+const std::vector<std::string>& GetTopologicalOrder();
+
+bool Explode(const std::string& itemId, double quantity, std::vector<Requirement>& requirements);
+bool Explode(const DB::BOM::BOM& bom, double count, std::vector<Requirement>& requirements);
+
+bool GetUnitCost(const std::string& itemId, double& cost);
+bool GetCost(const DB::BOM::BOM& bom, double& cost);
+}
+}
+/* Have a wonderful day :) */
+#endif /* _BomGraph */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
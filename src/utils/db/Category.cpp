@@ -1,10 +1,14 @@
 ﻿#include "Category.h"
+#include "utils/db/ChangeStream.h"
+#include "utils/db/WriteQueue.h"
 #include "vendor/imgui/imgui.h"
 #include "widgets/Logger.h"
+#include <algorithm>
 #include <vector>
 
 #define CHECK_IS_INIT(...)  if(isInit==false){isInit=true;Init();}
 #define IS_INIT     (isInit == true)
+#define COLLECTION  "Categories"
 
 namespace DB
 {
@@ -13,15 +17,24 @@ namespace Category
 
 static bsoncxx::document::value CreateDocument(Category cat);
 static bsoncxx::document::value CreateDocument(const std::string& field, const std::string& val);
-static bsoncxx::document::value CreateDocumentForUpdate(Category cat);
+static bsoncxx::document::value CreateDocumentForInsert(Category cat);
+static bsoncxx::document::value CreateDocumentForEdit(const Category& oldCat, const Category& newCat);
 static Category CreateObject(const bsoncxx::document::view& doc);
 static bool FindInCache(Category& cat, const std::string& filter);
 static bool FindInCache(Category& cat);
 static bool RemoveFromCache(const Category& cat);
+static void OnWriteAcknowledged(bool r);
+static void OnCreateAcknowledged(bool r, const std::string& oid, const std::string& prefix);
+static void ApplyChanges();
+static void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid);
+static void ApplyDelete(const std::string& oid);
 
 static std::vector<Category> categories; //!< Cache.
 static bool isInit = false;
 static bool hasError = false;
+//! Where the cache stands in the synchronization with the collection.
+static DB::SyncState syncState;
+static DB::ChangeStream::Watcher watcher(DATABASE, COLLECTION);
 
 /**
  * @brief   Initialize the Category module:
@@ -39,10 +52,19 @@ bool DB::Category::Init()
         return false;
     }
 
+    // Index the write times and purge the old tombstones, once.
+    static bool isSyncPrepared = false;
+    if (isSyncPrepared == false)
+    {
+        isSyncPrepared = true;
+        DB::PrepareSync(DATABASE, COLLECTION);
+    }
+
     // Clear the cache.
     categories.clear();
+    syncState = DB::SyncState();
     // Get all the categories from the database.
-    bsoncxx::stdx::optional<mongocxx::cursor> cats = DB::GetAllDocuments(DATABASE, "Categories");
+    bsoncxx::stdx::optional<DB::Cursor> cats = DB::GetAllDocuments(DATABASE, COLLECTION, DB::ExcludeDeleted());
 
     // `cats` will be `{}` if the query failed.
     if (!cats)
@@ -58,10 +80,13 @@ bool DB::Category::Init()
         // For each document returned by the database:
         for (auto cat : cats.value())
         {
+            DB::UpdateHighWaterMark(cat, syncState.mark);
             // Create a Category object from that document and add it to the cache.
             categories.emplace_back(CreateObject(cat));
         }
         isInit = true;
+        // Follow the changes made to the collection from now on.
+        watcher.Start();
         return true;
     }
     catch (const mongocxx::query_exception & e)
@@ -73,16 +98,25 @@ bool DB::Category::Init()
 }
 
 /**
- * @brief   Refreshes the cache once every 10 seconds
+ * @brief   Keeps the cache in sync with the database.
+ *          If the database streams the changes made to the Categories, they are applied to the cache.
+ *          Otherwise, what changed since the last refresh is fetched once every 10 seconds.
  * @param   None
  * @retval  None
  */
 void Refresh()
 {
+    // If the changes are streamed, there's no need to reload everything.
+    if (watcher.IsRunning() && watcher.IsSupported())
+    {
+        ApplyChanges();
+        return;
+    }
+
     static double elapsedTime = 0;
     static int frameCount = 0;
-    // deltaTime is the time between two frames (e.g. deltaTime @ 60fps is ~16.667ms).
-    const static float deltaTime = ImGui::GetIO().DeltaTime;
+    // deltaTime is the time since the last frame, frames are only drawn when something changes.
+    const float deltaTime = ImGui::GetIO().DeltaTime;
 
     // If we're at a new frame:
     if (frameCount != ImGui::GetFrameCount())
@@ -93,20 +127,23 @@ void Refresh()
         // If it has been more than 10 seconds since the last refresh:
         if (elapsedTime >= 10.f)
         {
-            // Do the refresh. This is done by just re-initializing the module.
+            // Only get what changed since the last refresh, unless it has been too long to do so.
             elapsedTime = 0;
-            Init();
+            if (DB::SyncChanges(DATABASE, COLLECTION, syncState, ApplyUpsert, ApplyDelete) == false)
+            {
+                Init();
+            }
         }
     }
 }
 
 /**
- * @brief   Adds a new Category to the database and the cache.
+ * @brief   Adds a new Category to the cache and queues its insertion into the database.
  * @param   category The Category to insert into the database.
- * @retval  True if insertion was successful, false otherwise.
+ * @retval  True if the insertion was queued, false otherwise.
  *
- * @note    Category will be added to the cache even if insertion into database
- *          fails. It will however be removed at the next Refresh event.
+ * @note    Category is added to the cache right away. If the insertion fails,
+ *          the cache is reloaded from the database.
  */
 bool DB::Category::AddCategory(const Category& category)
 {
@@ -118,11 +155,14 @@ bool DB::Category::AddCategory(const Category& category)
     // Add the category to the cache.
     categories.emplace_back(category);
 
-    // Create a mongodb document from the Category object.
-    bsoncxx::document::value catDoc = CreateDocument(category);
-
-    // Insert the newly created document in the database.
-    return DB::InsertDocument(catDoc, DATABASE, "Categories");
+    // Queue the insertion of the newly created document in the database.
+    // It is an upsert so that the time of the write gets stamped by the server.
+    // It doesn't touch a Category created by someone else in the meantime, nor a deleted one.
+    std::string prefix = category.GetPrefix();
+    DB::WriteQueue::Create(DB::ExcludeDeleted(CreateDocument("prefix", prefix)), CreateDocumentForInsert(category),
+                           DATABASE, COLLECTION,
+                           [prefix](bool r, const std::string& oid) { OnCreateAcknowledged(r, oid, prefix); });
+    return true;
 }
 
 /**
@@ -147,7 +187,7 @@ Category DB::Category::GetCategoryByName(const std::string& name)
     if (FindInCache(c, name) == false)
     {
         // If no matching category was found in the cache, query the database.
-        c = CreateObject(DB::GetDocument(DATABASE, "Categories", CreateDocument("name", name)));
+        c = CreateObject(DB::GetDocument(DATABASE, COLLECTION, DB::ExcludeDeleted(CreateDocument("name", name))));
         // If a match was found:
         if (c.IsValid() == true)
         {
@@ -181,7 +221,7 @@ Category DB::Category::GetCategoryByPrefix(const std::string& prefix)
     if (FindInCache(c, prefix) == false)
     {
         // If there was no match, query the database.
-        c = CreateObject(DB::GetDocument(DATABASE, "Categories", CreateDocument("prefix", prefix)));
+        c = CreateObject(DB::GetDocument(DATABASE, COLLECTION, DB::ExcludeDeleted(CreateDocument("prefix", prefix))));
         // If the query succeeded and a Category was returned by the database:
         if (c.IsValid() == true)
         {
@@ -197,10 +237,10 @@ Category DB::Category::GetCategoryByPrefix(const std::string& prefix)
  * @brief   Update a currently existing Category in the cache and the database.
  * @param   oldBom: The Category to edit.
  * @param   newBom: The new value of the Category.
- * @retval  True if successfully edited in the database, false otherwise.
+ * @retval  True if the update was queued, false otherwise.
  *
- * @note    Even if the modification in the database fails, the Category will be modified in the cache.
- *          It will remain like that until the next refresh event.
+ * @note    The Category is modified in the cache right away. If the update fails,
+ *          the cache is reloaded from the database.
  * @note    The oldBom in the cache isn't technically modified, but rather deleted. The newBom is then
  *          added to the cache.
  */
@@ -213,22 +253,25 @@ bool EditCategory(const Category& oldCat, const Category& newCat)
 
     // Remove the old category from the cache.
     RemoveFromCache(oldCat);
-    // Add the "new" category in the cache.
+    // Add the "new" category in the cache. It is still the same document in the database.
     categories.emplace_back(newCat);
+    categories.back().SetOid(oldCat.GetOid());
 
-    // Update the document in the database:
+    // Queue the update of the document in the database:
     //  - CreateDocument -> Create a mongodb document containing only the id of the old category to use as a filter.
-    //  - CreateDocumentForUpdate -> Create a mongodb document with the new category.
-    return (DB::UpdateDocument(CreateDocument("prefix", oldCat.GetPrefix()),
-                               CreateDocumentForUpdate(newCat), DATABASE, "Categories"));
+    //  - CreateDocumentForEdit -> Create a mongodb document with only the fields that changed.
+    //  - DB::ExcludeDeleted -> So that the tombstone of a deleted category with the same prefix isn't the one updated.
+    DB::WriteQueue::Update(DB::ExcludeDeleted(CreateDocument("prefix", oldCat.GetPrefix())),
+                           CreateDocumentForEdit(oldCat, newCat), DATABASE, COLLECTION, OnWriteAcknowledged);
+    return true;
 }
 
 /**
- * @brief   Delete a Category from the cache and the database.
+ * @brief   Delete a Category from the cache and queue its deletion from the database.
  * @param   The Category to delete. Only the `m_id` field of the Category object is used to query the database.
- * @retval  True if successfully deleted from the database, false otherwise.
- * @note    Even if the Category isn't deleted from the database, it will still be removed from the cache.
- *          This will remain until the next refresh event.
+ * @retval  True if the deletion was queued, false otherwise.
+ * @note    The Category is removed from the cache right away. If the deletion fails,
+ *          the cache is reloaded from the database.
  */
 bool DeleteCategory(const Category& category)
 {
@@ -240,8 +283,12 @@ bool DeleteCategory(const Category& category)
     // Remove the category from the cache.
     RemoveFromCache(category);
 
-    // Delete the category from the database.
-    return (DB::DeleteDocument(CreateDocument(category), DATABASE, "Categories"));
+    // Queue the deletion of the category from the database.
+    // The document is only marked as deleted, so that the other clients can find out about it.
+    // A tombstone left by an earlier deletion of the same category mustn't be the one matched.
+    DB::WriteQueue::Update(DB::ExcludeDeleted(CreateDocument(category)), DB::MakeTombstone(), DATABASE, COLLECTION,
+                           OnWriteAcknowledged);
+    return true;
 }
 
 /**
@@ -254,6 +301,109 @@ const std::vector<Category>& GetAll()
     return categories;
 }
 
+/**
+ * @brief   Called once the database acknowledged a write queued by this module.
+ *          If the write failed, the optimistic change done to the cache is undone by reloading it.
+ * @param   r: True if the write succeeded.
+ * @retval  None
+ */
+void OnWriteAcknowledged(bool r)
+{
+    if (r == false)
+    {
+        Logging::System.Error("Unable to save the changes made to the categories, reloading them.");
+        Init();
+    }
+}
+
+/**
+ * @brief   Called once the database acknowledged the creation of a Category.
+ *          If someone else created a Category with the same prefix first, ours wasn't written
+ *          and the cache is reloaded to get theirs.
+ * @param   r: True if the write succeeded.
+ * @param   oid: The ObjectId of the created document, empty if another Category already had that prefix.
+ * @param   prefix: The prefix of the Category that was created.
+ * @retval  None
+ */
+void OnCreateAcknowledged(bool r, const std::string& oid, const std::string& prefix)
+{
+    if (r == true && oid.empty())
+    {
+        Logging::System.Error("Unable to create Category \"" + prefix,
+                              "\", another Category already has that prefix. Reloading the categories.");
+        Init();
+        return;
+    }
+
+    OnWriteAcknowledged(r);
+}
+
+/**
+ * @brief   Apply the changes streamed by the database to the cache.
+ * @param   None
+ * @retval  None
+ */
+void ApplyChanges()
+{
+    for (DB::ChangeStream::Event& e : watcher.TakeEvents())
+    {
+        switch (e.type)
+        {
+            case DB::ChangeStream::EventType::Upsert:
+                ApplyUpsert(e.doc.value().view(), e.oid);
+                break;
+            case DB::ChangeStream::EventType::Delete:
+                ApplyDelete(e.oid);
+                break;
+            case DB::ChangeStream::EventType::Reload:
+            default:
+                Init();
+                break;
+        }
+    }
+}
+
+/**
+ * @brief   Add or update a Category of the cache with a document read from the database.
+ *          The document is matched to a cached Category by ObjectId or, for a Category
+ *          that was added locally and isn't acknowledged yet, by prefix.
+ * @param   doc: The document read from the database.
+ * @param   oid: The ObjectId of the document.
+ * @retval  None
+ */
+void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid)
+{
+    Category obj = CreateObject(doc);
+    auto match = std::find_if(categories.begin(), categories.end(), [&](const Category& o)
+                              {
+                                  return o.GetOid() == oid || (o.GetOid().empty() && o.GetPrefix() == obj.GetPrefix());
+                              });
+    // If the Category is already in the cache, update it. Otherwise, add it.
+    if (match != categories.end())
+    {
+        *match = obj;
+    }
+    else
+    {
+        categories.emplace_back(obj);
+    }
+}
+
+/**
+ * @brief   Remove a Category from the cache.
+ * @param   oid: The ObjectId of the Category that was deleted.
+ * @retval  None
+ */
+void ApplyDelete(const std::string& oid)
+{
+    auto match = std::find_if(categories.begin(), categories.end(),
+                              [&](const Category& o) { return o.GetOid() == oid; });
+    if (match != categories.end())
+    {
+        categories.erase(match);
+    }
+}
+
 /**
  * @brief   Create a mongodb document from a Category object.
  *          The created document is pretty much just a JSON dump of the object.
@@ -295,20 +445,27 @@ bsoncxx::document::value CreateDocument(const std::string& field, const std::str
 }
 
 /**
- * @brief   Create a mongoDB document to use in an update query from a Category object.
+ * @brief   Create a mongoDB document to use in the upsert creating a Category.
  * @param   cat The Category instance to use to create the document.
  * @retval  The created document.
  */
-bsoncxx::document::value CreateDocumentForUpdate(Category cat)
+bsoncxx::document::value CreateDocumentForInsert(Category cat)
 {
     using bsoncxx::builder::basic::kvp;
-    // Create the builder object.
-    auto builder = bsoncxx::builder::basic::document{};
-    // Create a mongodb document from the Category object and add it to the document.
-    builder.append(kvp("$set", CreateDocument(cat)));
+    // Set every field of the new Category and have the server stamp the time of the write.
+    return DB::MakeStampedInsert(CreateDocument(cat));
+}
 
-    // Make a `bsoncxx::document::value` from the builder.
-    return builder.extract();
+/**
+ * @brief   Create a mongoDB document to use in an update query that only changes
+ *          the fields that differ between two versions of a Category.
+ * @param   oldCat: The Category as it was read.
+ * @param   newCat: The Category as it should be.
+ * @retval  The created document.
+ */
+bsoncxx::document::value CreateDocumentForEdit(const Category& oldCat, const Category& newCat)
+{
+    return DB::MakeDiffUpdate(CreateDocument(oldCat), CreateDocument(newCat));
 }
 
 /**
@@ -361,8 +518,21 @@ Category CreateObject(const bsoncxx::document::view& doc)
         }
     }
 
+    // Get the ObjectId of the document.
+    std::string oid = "";
+    el = doc["_id"];
+    if (el.raw() != nullptr)
+    {
+        if (el.type() == bsoncxx::type::k_oid)
+        {
+            oid = el.get_oid().value.to_string();
+        }
+    }
+
     // Instantiate Category with the values we extracted from the document.
-    return Category(name, prefix, suffix);
+    Category cat = Category(name, prefix, suffix);
+    cat.SetOid(oid);
+    return cat;
 }
 
 /**
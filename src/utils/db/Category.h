@@ -25,6 +25,22 @@ public:
     }
     ~Category() = default;
 
+    /**
+     * Get the mongodb ObjectId of the category, empty if it hasn't been assigned by the database yet.
+     */
+    inline const std::string& GetOid() const
+    {
+        return m_oid;
+    }
+
+    /**
+     * Set the mongodb ObjectId of the category.
+     */
+    inline void SetOid(const std::string& oid)
+    {
+        m_oid = oid;
+    }
+
     /**
      * Get the name of the category
      */
@@ -70,6 +86,7 @@ public:
     }
 
 private:
+    std::string m_oid = "";                     /**< The mongodb ObjectId of the category, handled by the database */
     std::string m_name = "";                    /**< The name of the category */
     std::string m_idPrefix = "";                /**< The prefix that is added to an item's id */
     char m_suffix = '\0';                       /**< The suffix that is added to an item's id */
@@ -0,0 +1,328 @@
+﻿#include "ChangeStream.h"
+#include "utils/db/MongoCore.h"
+#include "utils/Redraw.h"
+#include <algorithm>
+#include <chrono>
+
+/**
+ * @def     MAX_AWAIT_TIME_MS
+ * @brief   How long the server waits for a change before answering with nothing.
+ *          This is also the longest a call to Watcher::Stop can take.
+ */
+#define MAX_AWAIT_TIME_MS   500
+
+/**
+ * @def     RETRY_DELAY_MS
+ * @brief   How long to wait before reopening a stream after an error.
+ */
+#define RETRY_DELAY_MS      2000
+
+// Error codes returned by the server when it can't do change streams (standalone server or too old).
+#define ERROR_CODE_CHANGE_STREAM_REPLICA_SET_ONLY   40573
+#define ERROR_CODE_UNRECOGNIZED_PIPELINE_STAGE      40324
+// Error codes returned by the server when the resume token is too old to resume from.
+#define ERROR_CODE_CAPPED_POSITION_LOST             136
+#define ERROR_CODE_CHANGE_STREAM_FATAL_ERROR        280
+#define ERROR_CODE_CHANGE_STREAM_HISTORY_LOST       286
+
+namespace DB
+{
+namespace ChangeStream
+{
+static std::vector<Watcher*>& GetWatchers();
+static bool ParseEvent(const bsoncxx::document::view& doc, Event& event, bool& isInvalidated);
+}
+}
+
+using namespace DB::ChangeStream;
+
+DB::ChangeStream::Watcher::~Watcher()
+{
+    Stop();
+
+    std::vector<Watcher*>& watchers = GetWatchers();
+    watchers.erase(std::remove(watchers.begin(), watchers.end(), this), watchers.end());
+}
+
+/**
+ * @brief   Start following the changes made to the collection, if it isn't already done.
+ * @param   None
+ * @retval  None
+ */
+void DB::ChangeStream::Watcher::Start()
+{
+    if (IsRunning() || !IsSupported())
+    {
+        return;
+    }
+
+    // Keep track of the watcher so that it can be stopped when the connection pool is replaced.
+    std::vector<Watcher*>& watchers = GetWatchers();
+    if (std::find(watchers.begin(), watchers.end(), this) == watchers.end())
+    {
+        watchers.push_back(this);
+    }
+
+    m_stopRequested = false;
+    m_thread = std::thread(&Watcher::Run, this);
+}
+
+/**
+ * @brief   Stop following the changes made to the collection.
+ *          The resume token is kept, the next call to Watcher::Start will resume from it.
+ * @param   None
+ * @retval  None
+ */
+void DB::ChangeStream::Watcher::Stop()
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+
+    m_stopRequested = true;
+    m_thread.join();
+}
+
+/**
+ * @brief   Take the events received since the last call.
+ * @param   None
+ * @retval  The events, in the order they happened.
+ */
+std::vector<Event> DB::ChangeStream::Watcher::TakeEvents()
+{
+    std::vector<Event> events;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    events.swap(m_events);
+    return events;
+}
+
+/**
+ * @brief   Main loop of the thread of the watcher.
+ *          Open the stream and push every change it gives until asked to stop.
+ *          If the stream breaks, it is reopened from the last resume token.
+ * @param   None
+ * @retval  None
+ */
+void DB::ChangeStream::Watcher::Run()
+{
+    while (m_stopRequested == false)
+    {
+        bool hasFailed = false;
+        {
+            // Keep the client for as long as the stream is open.
+            ScopedClient client;
+            if (client.IsValid())
+            {
+                try
+                {
+                    mongocxx::options::change_stream options;
+                    // Get the whole document on updates, not only the changed fields.
+                    options.full_document("updateLookup");
+                    options.max_await_time(std::chrono::milliseconds(MAX_AWAIT_TIME_MS));
+
+                    bool isResuming = m_resumeToken ? true : false;
+                    if (isResuming)
+                    {
+                        options.resume_after(m_resumeToken.value().view());
+                    }
+
+                    mongocxx::change_stream stream = (*client)[m_db][m_col].watch(options);
+
+                    // If we're not resuming, we can't know what happened before the stream was opened.
+                    // The owner of the cache must reload it to be sure not to miss anything.
+                    if (!isResuming)
+                    {
+                        Push({ EventType::Reload, "", {} });
+                    }
+
+                    bool isInvalidated = false;
+                    while (m_stopRequested == false && isInvalidated == false)
+                    {
+                        // Each call to `begin` waits at most MAX_AWAIT_TIME_MS for new changes.
+                        for (const bsoncxx::document::view& doc : stream)
+                        {
+                            // Remember where we are in the stream.
+                            bsoncxx::document::element token = doc["_id"];
+                            if (token.raw() != nullptr && token.type() == bsoncxx::type::k_document)
+                            {
+                                m_resumeToken = bsoncxx::document::value(token.get_document().value);
+                            }
+
+                            Event event;
+                            if (ParseEvent(doc, event, isInvalidated))
+                            {
+                                Push(std::move(event));
+                            }
+                            if (isInvalidated)
+                            {
+                                // The collection was dropped or renamed, there's nothing to resume from.
+                                m_resumeToken = bsoncxx::stdx::nullopt;
+                                break;
+                            }
+                        }
+                    }
+                }
+                catch (const mongocxx::exception & e)
+                {
+                    int code = e.code().value();
+                    if (code == ERROR_CODE_CHANGE_STREAM_REPLICA_SET_ONLY ||
+                        code == ERROR_CODE_UNRECOGNIZED_PIPELINE_STAGE)
+                    {
+                        // The server will never be able to do it, let the owner fall back on something else.
+                        m_isSupported = false;
+                        return;
+                    }
+                    else if (code == ERROR_CODE_CAPPED_POSITION_LOST ||
+                             code == ERROR_CODE_CHANGE_STREAM_FATAL_ERROR ||
+                             code == ERROR_CODE_CHANGE_STREAM_HISTORY_LOST)
+                    {
+                        // The server doesn't remember where we were anymore, start over.
+                        // A reload will be requested when the stream is reopened.
+                        m_resumeToken = bsoncxx::stdx::nullopt;
+                    }
+                    hasFailed = true;
+                }
+            }
+            else
+            {
+                hasFailed = true;
+            }
+        }
+
+        // If something went wrong, give the server some time before trying again.
+        if (hasFailed)
+        {
+            for (int i = 0; i < RETRY_DELAY_MS / 100 && m_stopRequested == false; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Queue an event for the owner of the watcher.
+ * @param   event: The event to queue.
+ * @retval  None
+ */
+void DB::ChangeStream::Watcher::Push(Event&& event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // If a reload is requested, the events before it don't matter anymore.
+        if (event.type == EventType::Reload)
+        {
+            m_events.clear();
+        }
+        m_events.emplace_back(std::move(event));
+    }
+    // Wake up the UI thread so it applies the change.
+    Redraw::Request();
+}
+
+/**
+ * @brief   Stop all the watchers that were started.
+ *          To be called before replacing the connection pool.
+ * @param   None
+ * @retval  None
+ */
+void DB::ChangeStream::StopAll()
+{
+    for (Watcher* watcher : GetWatchers())
+    {
+        watcher->Stop();
+    }
+}
+
+/**
+ * @brief   Restart all the watchers that were started once, from where they left off.
+ *          To be called once the connection pool has been replaced.
+ * @param   None
+ * @retval  None
+ */
+void DB::ChangeStream::StartAll()
+{
+    for (Watcher* watcher : GetWatchers())
+    {
+        watcher->Start();
+    }
+}
+
+/**
+ * @brief   Get the list of the watchers that were started.
+ *          The list is never destroyed: watchers declared as static in other translation units
+ *          can be destroyed after it would be, and they remove themselves from it when they are.
+ * @param   None
+ * @retval  The list of watchers.
+ */
+std::vector<Watcher*>& DB::ChangeStream::GetWatchers()
+{
+    static std::vector<Watcher*>* watchers = new std::vector<Watcher*>;
+    return *watchers;
+}
+
+/**
+ * @brief   Convert a change event sent by the server into an Event.
+ * @param   doc: The change event sent by the server.
+ * @param   event: The event to fill.
+ * @param   isInvalidated: Set to true if the stream can't go on.
+ * @retval  True if the event is relevant for the cache, false otherwise.
+ */
+bool DB::ChangeStream::ParseEvent(const bsoncxx::document::view& doc, Event& event, bool& isInvalidated)
+{
+    bsoncxx::document::element el = doc["operationType"];
+    if (el.raw() == nullptr || el.type() != bsoncxx::type::k_utf8)
+    {
+        return false;
+    }
+    std::string operation = el.get_utf8().value.data();
+
+    // The collection or the database was dropped or renamed.
+    if (operation == "invalidate" || operation == "drop" ||
+        operation == "rename" || operation == "dropDatabase")
+    {
+        isInvalidated = (operation == "invalidate");
+        event.type = EventType::Reload;
+        return true;
+    }
+
+    // Get the ObjectId of the document that changed.
+    el = doc["documentKey"];
+    if (el.raw() == nullptr || el.type() != bsoncxx::type::k_document)
+    {
+        return false;
+    }
+    el = el.get_document().value["_id"];
+    if (el.raw() == nullptr || el.type() != bsoncxx::type::k_oid)
+    {
+        return false;
+    }
+    event.oid = el.get_oid().value.to_string();
+
+    if (operation == "delete")
+    {
+        event.type = EventType::Delete;
+        return true;
+    }
+    else if (operation == "insert" || operation == "update" || operation == "replace")
+    {
+        el = doc["fullDocument"];
+        // If the document was deleted before the lookup, the delete event will follow.
+        if (el.raw() == nullptr || el.type() != bsoncxx::type::k_document)
+        {
+            return false;
+        }
+        // Deleted documents are kept as tombstones, see DB::MakeTombstone.
+        if (DB::IsDeleted(el.get_document().value))
+        {
+            event.type = EventType::Delete;
+            return true;
+        }
+        event.type = EventType::Upsert;
+        event.doc = bsoncxx::document::value(el.get_document().value);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,140 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup ChangeStream
+ * @{
+ * @file    ChangeStream
+ * @author  Samuel Martel
+ * @brief   Header for the ChangeStream module.
+ *
+ * @date 10/17/2026 1:47:05 PM
+ *
+ * @attention   Change streams are only available when the server is part of a replica set.
+ *              When it isn't, Watcher::IsSupported returns false and the modules keep
+ *              refreshing their cache periodically instead.
+ *
+ ******************************************************************************
+ */
+#ifndef _ChangeStream
+#define _ChangeStream
+
+/*****************************************************************************/
+/* Includes */
+#include "utils/db/Mongo.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace DB
+{
+/**
+ * @namespace DB::ChangeStream ChangeStream.h ChangeStream
+ * @brief   The namespace for the change streams keeping the caches in sync with the database.
+ */
+namespace ChangeStream
+{
+/*****************************************************************************/
+/* Exported defines */
+
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+/**
+ * @enum    EventType
+ * @brief   What a cache must do with an event.
+ */
+enum class EventType
+{
+    Upsert = 0, /*!< A document was inserted, updated or replaced. Event::doc holds its new value. */
+    Delete,     /*!< A document was deleted. */
+    Reload,     /*!< Changes might have been missed, the whole collection must be reloaded. */
+};
+
+/**
+ * @struct  Event
+ * @brief   A change made to a collection.
+ */
+struct Event
+{
+    EventType type;
+    //! The ObjectId of the document that changed.
+    std::string oid;
+    //! The new value of the document, only for EventType::Upsert.
+    bsoncxx::stdx::optional<bsoncxx::document::value> doc;
+};
+
+/**
+ * @class   Watcher
+ * @brief   Follows the changes made to a collection from a background thread.
+ *          The events are kept until the owner of the cache takes them from the UI thread.
+ *
+ *          The resume token of the last event is kept so that the stream can pick up where it
+ *          left off after a connection loss. If the server doesn't have the history
+ *          needed to do so anymore, a EventType::Reload event is queued.
+ */
+class Watcher
+{
+public:
+    Watcher(const std::string& db, const std::string& col) : m_db(db), m_col(col)
+    {
+    }
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+    ~Watcher();
+
+    void Start();
+    void Stop();
+    std::vector<Event> TakeEvents();
+
+    /**
+     * Check if the server is able to stream the changes made to the collection.
+     */
+    inline bool IsSupported() const
+    {
+        return m_isSupported;
+    }
+
+    /**
+     * Check if the stream is being followed.
+     */
+    inline bool IsRunning() const
+    {
+        return m_thread.joinable();
+    }
+
+private:
+    void Run();
+    void Push(Event&& event);
+
+private:
+    std::string m_db;
+    std::string m_col;
+    std::thread m_thread;
+    std::atomic<bool> m_stopRequested{ false };
+    std::atomic<bool> m_isSupported{ true };
+    //! Token of the last event received, used to resume the stream.
+    //! Only accessed by the thread of the watcher.
+    bsoncxx::stdx::optional<bsoncxx::document::value> m_resumeToken;
+    //! Protects `m_events`.
+    std::mutex m_mutex;
+    std::vector<Event> m_events;
+};
+
+/*****************************************************************************/
+/* Exported functions */
+void StopAll();
+void StartAll();
+}
+}
+/* Have a wonderful day :) */
+#endif /* _ChangeStream */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
@@ -1,30 +1,158 @@
 ﻿#include "Item.h"
 #include "boost/algorithm/string.hpp"
+#include "utils/FilterUtils.h"
 #include "utils/StringUtils.h"
+#include "utils/db/ChangeStream.h"
+#include "utils/db/WriteQueue.h"
 #include "vendor/imgui/imgui.h"
 #include "widgets/Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <stdexcept>
 
 #define IS_INIT     (isInit==true)
+#define COLLECTION  "Items"
+//! Time without a new adjustment after which the adjustments of an Item are sent to the database.
+#define ADJUSTMENT_WINDOW_S 1.5
 
 namespace DB
 {
 namespace Item
 {
 
+/**
+ * @struct  SortEntry
+ * @brief   The place of an Item in the order of one of its fields.
+ *          Items are ordered by the value of the field, then by id.
+ */
+struct SortEntry
+{
+    double number = 0;      /**< The value of a numeric field */
+    std::string text = "";  /**< The value of a text field, in all caps */
+    std::string id = "";    /**< The id of the Item, in all caps */
+    size_t pos = 0;         /**< The position of the Item in the cache, orders Items with the same id */
+
+    bool operator<(const SortEntry& other) const
+    {
+        if (number != other.number)
+        {
+            return number < other.number;
+        }
+        int cmp = text.compare(other.text);
+        if (cmp != 0)
+        {
+            return cmp < 0;
+        }
+        cmp = id.compare(other.id);
+        if (cmp != 0)
+        {
+            return cmp < 0;
+        }
+        return pos < other.pos;
+    }
+};
+
 static bsoncxx::document::value CreateDocument(Item it);
 static bsoncxx::document::value CreateDocument(const std::string& field, const std::string& val);
-static bsoncxx::document::value CreateDocumentForUpdate(Item it);
+static bsoncxx::document::value CreateDocumentForInsert(Item it);
+static bsoncxx::document::value CreateDocumentForEdit(const Item& oldItem, const Item& newItem);
+static bool IsQuantityOnlyChange(const Item& oldItem, const Item& newItem);
 static Item CreateObject(const bsoncxx::document::view& doc);
-static bool FindInCache(Item& it);
-static bool FindInCache(Item& it, const std::string& filter);
+static size_t FindInCache(const std::string& id);
+static size_t FindInCacheByOid(const std::string& oid);
+static void AddToCache(const Item& it);
+static void ReplaceInCache(size_t pos, const Item& it);
+static void RemoveFromCache(size_t pos);
 static bool RemoveFromCache(const Item& it);
+static void ClearCache();
+static void IndexItem(size_t pos);
+static void UnindexItem(size_t pos);
+static std::string GetSequenceName(const DB::Category::Category& cat);
+static std::vector<const std::string*> GetTextFields(const Item& it);
+static bool IsNumericKey(SearchKey key);
+static double GetNumericKey(const Item& it, SearchKey key);
+static SortEntry GetSortEntry(const Item& it, SearchKey key, size_t pos);
+static void AddToOrders(size_t pos);
+static void RemoveFromOrders(size_t pos);
 static std::string FindDiffs(const Item& from, const Item& to);
+static bsoncxx::document::value CreateRevisionFilter(const Item& it, bool matchRevision = true);
+static void OnWriteAcknowledged(bool r, const std::string& action, const Item& it);
+static void OnCreateAcknowledged(bool r, const std::string& oid, const Item& it);
+static void ReloadItem(const Item& it);
+static bool ReloadItems(const std::vector<Item>& its);
+static void ApplyChanges();
+static void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid, bool force = false);
+static void ApplyDelete(const std::string& oid);
+static std::unique_lock<std::shared_mutex> LockForWriting();
+
+/**
+ * @struct  PendingAdjustment
+ * @brief   Quantity adjustments made to an Item that haven't been sent to the database yet.
+ */
+struct PendingAdjustment
+{
+    Item before;            /**< The Item as it was before the first adjustment */
+    float delta = 0.0f;     /**< The sum of the adjustments */
+    double lastChange = 0;  /**< Time of the last adjustment, in seconds (ImGui::GetTime) */
+};
+
+//! Position returned by the cache lookups when the Item isn't in the cache.
+static const size_t NOT_CACHED = static_cast<size_t>(-1);
 
 static std::vector<Item> items; /**< Cache */
+static std::unordered_map<std::string, size_t> byId;    /**< Position in the cache, by id */
+static std::unordered_map<std::string, size_t> byOid;   /**< Position in the cache, by ObjectId */
+static std::unordered_map<std::string, std::unordered_set<size_t>> byCategory;  /**< Positions, by category prefix */
+static std::map<int, std::unordered_set<size_t>> byStatus;  /**< Positions, by status */
+static std::unordered_map<std::string, int> maxIds;  /**< Highest id number known, by sequence name */
+static FilterUtils::TrigramIndex textIndex;         /**< Positions, by trigram of the text fields */
+static std::set<SortEntry> orders[size_t(SearchKey::count)];   /**< The cache in the order of each field */
+static unsigned int generation = 0; /**< Incremented every time the cache is modified */
+static std::shared_mutex cacheMutex; /**< Held while the cache is modified, shared by the readers of other threads */
+static std::atomic<int> waitingWriters(0);  /**< Number of modifications waiting for the readers to release the cache */
+static std::map<std::string, PendingAdjustment> adjustments;  /**< Pending adjustments, by Item id */
 static bool isInit = false;
 static bool hasError = false;
+static int pendingWrites = 0;   /**< Number of writes queued and not yet acknowledged */
+//! Where the cache stands in the synchronization with the collection.
+static DB::SyncState syncState;
+static DB::ChangeStream::Watcher watcher(DATABASE, COLLECTION);
+
+/**
+ * @brief   Form the searchable version of every field of the Item, so that the filters
+ *          don't have to format them and change their case every time they look at the Item.
+ * @param   None
+ * @retval  None
+ */
+void Item::UpdateSearchKeys()
+{
+    char buff[32] = { 0 };
+
+    m_searchKeys[size_t(SearchKey::id)] = m_id;
+    m_searchKeys[size_t(SearchKey::description)] = m_description;
+    m_searchKeys[size_t(SearchKey::category)] = m_category.GetName();
+    m_searchKeys[size_t(SearchKey::referenceLink)] = m_referenceLink;
+    m_searchKeys[size_t(SearchKey::location)] = m_location;
+    // Same format as StringUtils::NumToString.
+    snprintf(buff, sizeof(buff), "%g", m_price);
+    m_searchKeys[size_t(SearchKey::price)] = buff;
+    snprintf(buff, sizeof(buff), "%g", m_quantity);
+    m_searchKeys[size_t(SearchKey::quantity)] = buff;
+    m_searchKeys[size_t(SearchKey::unit)] = m_unit;
+    m_searchKeys[size_t(SearchKey::status)] = GetStatusString(m_status);
+
+    for (std::string& key : m_searchKeys)
+    {
+        boost::to_upper(key);
+    }
+}
 
 /**
  * @brief   Initialize the Item module:
@@ -42,10 +170,25 @@ bool DB::Item::Init()
         return false;
     }
 
+    // Don't lose the adjustments made to the cache that's about to be cleared.
+    if (IS_INIT)
+    {
+        FlushAdjustments(true);
+    }
+
+    // Index the write times and purge the old tombstones, once.
+    static bool isSyncPrepared = false;
+    if (isSyncPrepared == false)
+    {
+        isSyncPrepared = true;
+        DB::PrepareSync(DATABASE, COLLECTION);
+    }
+
     // Clear the cache.
-    items.clear();
+    ClearCache();
+    syncState = DB::SyncState();
     // Get all the items from the database.
-    bsoncxx::stdx::optional<mongocxx::cursor> its = DB::GetAllDocuments(DATABASE, "Items");
+    bsoncxx::stdx::optional<DB::Cursor> its = DB::GetAllDocuments(DATABASE, COLLECTION, DB::ExcludeDeleted());
     // `its` will be `{}` if the query failed.
     if (!its)
     {
@@ -60,11 +203,14 @@ bool DB::Item::Init()
         // For each document returned by the database:
         for (auto it : its.value())
         {
+            DB::UpdateHighWaterMark(it, syncState.mark);
             // Extract an Item object from that document and add it in the cache.
-            items.emplace_back(CreateObject(it));
+            AddToCache(CreateObject(it));
         }
 
         isInit = true;
+        // Follow the changes made to the collection from now on.
+        watcher.Start();
         return true;
     }
     catch (const mongocxx::query_exception & e)
@@ -76,16 +222,28 @@ bool DB::Item::Init()
 }
 
 /**
- * @brief   Refreshes the cache once every 10 seconds
+ * @brief   Keeps the cache in sync with the database.
+ *          If the database streams the changes made to the Items, they are applied to the cache.
+ *          Otherwise, what changed since the last refresh is fetched once every 10 seconds.
  * @param   None
  * @retval  None
  */
 void DB::Item::Refresh()
 {
+    // Send the quantity adjustments that are done being made.
+    FlushAdjustments();
+
+    // If the changes are streamed, there's no need to reload everything.
+    if (watcher.IsRunning() && watcher.IsSupported())
+    {
+        ApplyChanges();
+        return;
+    }
+
     static double elapsedTime = 0;
     static int frameCount = 0;
-    // deltaTime is the time between two frames (e.g. deltaTime @ 60fps is ~16.667ms).
-    const static float deltaTime = ImGui::GetIO().DeltaTime;
+    // deltaTime is the time since the last frame, frames are only drawn when something changes.
+    const float deltaTime = ImGui::GetIO().DeltaTime;
 
     // If we're at a new frame:
     if (frameCount != ImGui::GetFrameCount())
@@ -93,23 +251,30 @@ void DB::Item::Refresh()
         // Add the deltaTime to elapsed time.
         frameCount = ImGui::GetFrameCount();
         elapsedTime += deltaTime;
-        // If it has been more than 10 seconds since the last refresh:
-        if (elapsedTime >= 10.f)
+        // If it has been more than 10 seconds since the last refresh
+        // and no write is on its way, which would be undone by the reload:
+        if (elapsedTime >= 10.f && pendingWrites == 0)
         {
-            // Do the refresh. This is done by just re-initializing the module.
+            // Only get what changed since the last refresh, unless it has been too long to do so.
             elapsedTime = 0;
-            Init();
+            if (DB::SyncChanges(DATABASE, COLLECTION, syncState, [](const bsoncxx::document::view& doc, const std::string& oid)
+                                {
+                                    ApplyUpsert(doc, oid);
+                                }, ApplyDelete) == false)
+            {
+                Init();
+            }
         }
     }
 }
 
 /**
- * @brief   Adds a new Item to the database and the cache.
+ * @brief   Adds a new Item to the cache and queues its insertion into the database.
  * @param   it The Item to insert into the database.
- * @retval  True if insertion was successful, false otherwise.
+ * @retval  True if the insertion was queued, false otherwise.
  *
- * @note    Item will be added to the cache even if insertion into database
- *          fails. It will however be removed at the next Refresh event.
+ * @note    Item is added to the cache right away, at revision 1. Once the insertion is acknowledged,
+ *          it gets the ObjectId assigned by the database.
  */
 bool DB::Item::AddItem(const Item& it)
 {
@@ -118,190 +283,1051 @@ bool DB::Item::AddItem(const Item& it)
         return false;
     }
 
-    // Add the new Item to the cache.
-    items.emplace_back(it);
-
-    // Create a mongodb document from the Item.
-    bsoncxx::document::value itDoc = CreateDocument(it);
-    // Insert the new Item in the database.
-    bool r = DB::InsertDocument(itDoc, DATABASE, "Items");
-    // Log the event.
-    Logging::Audit.Info("Created Item \"" + it.GetId(), "\"", true);
-    // Refresh Cache.
-    Init();
+    // Add the new Item to the cache. A new document starts at revision 1.
+    Item added = it;
+    added.SetRevision(1);
+    AddToCache(added);
+
+    // Queue the insertion of the new Item in the database.
+    pendingWrites++;
+    // It is an upsert so that the time of the write gets stamped by the server.
+    // It doesn't touch an Item created by someone else in the meantime, nor a deleted one.
+    DB::WriteQueue::Create(DB::ExcludeDeleted(CreateDocument("id", it.GetId())), CreateDocumentForInsert(it),
+                           DATABASE, COLLECTION,
+                           [added](bool r, const std::string& oid) { OnCreateAcknowledged(r, oid, added); });
+    // Log the event.
+    Logging::Audit.Info("Created Item \"" + it.GetId(), "\"", true);
+
+    return true;
+}
+
+/**
+ * @brief   Created if needed but not implemented.
+ *          Intended to be identical in principle to DB::Category::GetCategoryByName.
+ *
+ * @throws  std::logic_error
+ */
+Item DB::Item::GetItemByName(const std::string& name)
+{
+    if (!IS_INIT)
+    {
+        return DB::Item::Item();
+    }
+    throw std::logic_error("Not Implemented");
+}
+
+/**
+ * @brief   Get an item from the database that matches the id.
+ * @param   id: The id to query for.
+ * @retval  The Item that was found or an empty object if none were found.
+ */
+Item DB::Item::GetItemByID(const std::string& id)
+{
+    // Create a default, non-valid Item to store the output.
+    Item c = Item("", "");
+    if (!IS_INIT)
+    {
+        return c;
+    }
+
+    // Search in the cache for a Item with a matching id.
+    const Item* cached = FindItemByID(id);
+    if (cached != nullptr)
+    {
+        return *cached;
+    }
+
+    // If no matching Item was found in the cache, query the database.
+    c = CreateObject(DB::GetDocument(DATABASE, COLLECTION, DB::ExcludeDeleted(CreateDocument("id", id))));
+    // If a match was found:
+    if (c.IsValid() == true)
+    {
+        // Add it to the cache.
+        AddToCache(c);
+    }
+
+    return c;
+}
+
+/**
+ * @brief   Generates a new Item id for the appropriate category.
+ *          Optionally, force the id to be a certain value by using the id parameter.
+ *          Example: `cat.GetPrefix()` is "MFOM" and id is -1
+ *              Cache contains:
+ *                  - MFOM0001
+ *                  - MBOX0003
+ *                  - AFOM0002
+ *                  - MFOM0002
+ *              DB::Item::GetNewId will return "MFOM0003"
+ * @param   cat: The category to create the id for.
+ * @param   id (optional): If specified, used as the id's number.
+ *                         If not specified, automatically increment the id.
+ * @retval  The generated id.
+ *
+ * @note    Without `id`, this is only a preview: another terminal might take the same id in the meantime.
+ *          Use DB::Item::ReserveIds to get id numbers that are guaranteed to be free.
+ */
+std::string DB::Item::GetNewId(const DB::Category::Category& cat, int id)
+{
+    if (!IS_INIT)
+    {
+        return "";
+    }
+
+    // Get the biggest id of the category we know of.
+    auto known = maxIds.find(GetSequenceName(cat));
+    int max = known != maxIds.end() ? known->second : 0;
+
+    // First ID will be 0001, not 0, this is desired.
+    // If `id` is -1, use the maximal id we observed.
+    // Otherwise, use the specified `id`
+    max = id == -1 ? max + 1 : id;
+    // Form the id using the category's prefix and the value of `max`
+    std::string ret = cat.GetPrefix() + StringUtils::NumToString(max);
+    // Does the Category have a suffix?
+    if (cat.GetSuffix() != '\0')
+    {
+        // If yes, add it to the id.
+        ret += cat.GetSuffix();
+    }
+    // Force the generated id to be all capitalized.
+    boost::to_upper(ret);
+    return  ret;
+}
+
+/**
+ * @brief   Reserve consecutive id numbers of a category from the server, in a single request.
+ *          Once reserved, an id number is never handed out again, not even to another terminal.
+ * @param   cat: The category to reserve the id numbers in.
+ * @param   count: How many id numbers to reserve.
+ * @retval  The first reserved id number, to format with DB::Item::GetNewId.
+ *          -1 if the server can't be reached: only it knows which ids the other terminals took.
+ *          Example: Reserving 1000 ids for an import returns 42 -> 42 to 1041 are for the import to use.
+ */
+int DB::Item::ReserveIds(const DB::Category::Category& cat, int count)
+{
+    if (!IS_INIT)
+    {
+        return -1;
+    }
+
+    std::string name = GetSequenceName(cat);
+    int& max = maxIds[name];
+    // The counter never goes below the ids already in use, in case some were created without it.
+    int id = DB::ReserveSequence(name, count, max);
+    if (id == -1)
+    {
+        Logging::System.Error("Unable to reserve " + std::to_string(count) + " id(s) from the server for ", name);
+        return -1;
+    }
+
+    // Don't preview ids that were already handed out.
+    max = std::max(max, id + count - 1);
+    return id;
+}
+
+/**
+ * @brief   Update a currently existing Item in the cache and queue its update in the database.
+ * @param   oldItem: The Item to edit.
+ * @param   newItem: The new value of the Item.
+ * @retval  True if the update was queued, false otherwise.
+ *
+ * @note    The Item is modified in the cache right away. The update only applies if the document
+ *          is still at the revision `oldItem` was read at. If it isn't, someone else modified it:
+ *          the change is dropped, the user is warned and the Item is read back from the database.
+ * @note    The oldBom in the cache isn't technically modified, but rather deleted. The newBom is then
+ *          added to the cache.
+ */
+bool DB::Item::EditItem(const Item& oldItem, const Item& newItem)
+{
+    if (!IS_INIT)
+    {
+        return false;
+    }
+
+    // The new value of the Item is still the same document in the database,
+    // at the revision the update will bring it to.
+    Item edited = newItem;
+    if (!edited.HasOid())
+    {
+        edited.SetOid(oldItem.GetOid());
+    }
+    edited.SetRevision(oldItem.GetRevision() + 1);
+
+    // Remove the old Item from the cache.
+    RemoveFromCache(oldItem);
+    // Add the "new" Item to the cache.
+    AddToCache(edited);
+    // Queue the update of the Item in the database.
+    // A change of quantity alone is sent as an increment, which adds up with concurrent changes
+    // instead of conflicting with them, so it doesn't need to match the revision.
+    pendingWrites++;
+    DB::WriteQueue::Update(CreateRevisionFilter(oldItem, !IsQuantityOnlyChange(oldItem, newItem)),
+                           CreateDocumentForEdit(oldItem, edited), DATABASE, COLLECTION,
+                           [edited](bool r) { OnWriteAcknowledged(r, "edit", edited); });
+    // Log the event.
+    Logging::Audit.Info("Edited Item ", oldItem.GetId() + FindDiffs(oldItem, newItem), true);
+
+    return true;
+}
+
+/**
+ * @brief   Update several Items of the cache at once and queue their updates in the database
+ *          as bulk writes, a single round trip for up to `DEFAULT_BULK_BATCH_SIZE` Items.
+ * @param   oldItems: The Items to edit.
+ * @param   newItems: The new values of the Items, in the same order.
+ * @retval  True if the updates were queued, false otherwise.
+ *
+ * @note    As for DB::Item::EditItem, each update only applies if the document is still at the revision
+ *          it was read at. The Items whose update didn't apply are read back from the database.
+ */
+bool DB::Item::EditItems(const std::vector<Item>& oldItems, const std::vector<Item>& newItems)
+{
+    if (!IS_INIT || oldItems.empty() || oldItems.size() != newItems.size())
+    {
+        return false;
+    }
+
+    // The Items don't depend on each other, let the server update them in any order.
+    std::shared_ptr<DB::BulkWriter> writer =
+        std::make_shared<DB::BulkWriter>(DATABASE, COLLECTION, false, DEFAULT_BULK_BATCH_SIZE, false);
+    std::vector<Item> edited;
+    edited.reserve(newItems.size());
+    std::string diffs;
+    for (size_t i = 0; i < oldItems.size(); i++)
+    {
+        const Item& oldItem = oldItems[i];
+        // The new value of the Item is still the same document in the database,
+        // at the revision the update will bring it to.
+        Item it = newItems[i];
+        if (!it.HasOid())
+        {
+            it.SetOid(oldItem.GetOid());
+        }
+        it.SetRevision(oldItem.GetRevision() + 1);
+
+        RemoveFromCache(oldItem);
+        AddToCache(it);
+        // The index of the write is the index of the Item.
+        writer->Update(CreateRevisionFilter(oldItem, !IsQuantityOnlyChange(oldItem, newItems[i])),
+                       CreateDocumentForEdit(oldItem, it));
+        diffs += "\n\r" + oldItem.GetId() + FindDiffs(oldItem, newItems[i]);
+        edited.push_back(it);
+    }
+
+    // Queue all the updates as a single write.
+    pendingWrites++;
+    DB::WriteQueue::Bulk(writer, [writer, edited](bool r)
+                         {
+                             pendingWrites--;
+                             if (r == true)
+                             {
+                                 return;
+                             }
+
+                             // Only read back the Items that might not have been updated.
+                             // In unordered mode, a single miss leaves its whole batch unconfirmed.
+                             std::vector<Item> candidates;
+                             for (size_t i = 0; i < edited.size(); i++)
+                             {
+                                 if (writer->GetStatus(i) != DB::BulkStatus::Done)
+                                 {
+                                     candidates.push_back(edited[i]);
+                                 }
+                             }
+                             bool isReloaded = ReloadItems(candidates);
+
+                             // If an update was made, the Item is now at the revision it brought it to.
+                             unsigned int missed = 0;
+                             for (const Item& it : candidates)
+                             {
+                                 const Item* reloaded = FindItemByID(it.GetId());
+                                 if (isReloaded == false || reloaded == nullptr ||
+                                     reloaded->GetRevision() != it.GetRevision())
+                                 {
+                                     missed++;
+                                 }
+                             }
+                             if (missed != 0)
+                             {
+                                 Logging::System.Warning("Unable to edit " + StringUtils::NumToString(missed, false) +
+                                                         " Items", ", they might have been modified by someone else. "
+                                                         "Their latest version was reloaded.");
+                             }
+                         });
+    // Log the event.
+    Logging::Audit.Info("Edited " + StringUtils::NumToString(unsigned(oldItems.size()), false) + " Items", diffs, true);
+
+    return true;
+}
+
+/**
+ * @brief   Adjust the quantity of an Item.
+ *          The cache is modified right away, but the adjustments made to an Item in quick succession
+ *          are accumulated and sent to the database as a single increment once no new adjustment
+ *          has been made for `ADJUSTMENT_WINDOW_S` seconds.
+ * @param   item: The Item to adjust. Only its id is used.
+ * @param   delta: The quantity to add to the Item. Negative to remove.
+ * @retval  True if the adjustment was made, false otherwise.
+ */
+bool DB::Item::AdjustQuantity(const Item& item, float delta)
+{
+    if (!IS_INIT)
+    {
+        return false;
+    }
+
+    size_t pos = FindInCache(item.GetId());
+    if (pos == NOT_CACHED)
+    {
+        return false;
+    }
+
+    // If it is the first adjustment made to the Item since the last flush, remember where it started from.
+    auto adj = adjustments.find(item.GetId());
+    if (adj == adjustments.end())
+    {
+        adj = adjustments.emplace(item.GetId(), PendingAdjustment{ items[pos] }).first;
+    }
+
+    adj->second.delta += delta;
+    adj->second.lastChange = ImGui::GetTime();
+    std::unique_lock<std::shared_mutex> lock = LockForWriting();
+    RemoveFromOrders(pos);
+    items[pos].IncQuantity(delta);
+    AddToOrders(pos);
+    generation++;
+
+    return true;
+}
+
+/**
+ * @brief   Get the sum of the quantity adjustments made to an Item that haven't been sent to the database yet.
+ * @param   id: The id of the Item.
+ * @retval  The pending adjustment, 0 if there is none.
+ */
+float DB::Item::GetPendingAdjustment(const std::string& id)
+{
+    auto adj = adjustments.find(id);
+    return adj != adjustments.end() ? adj->second.delta : 0.0f;
+}
+
+/**
+ * @brief   Queue the pending quantity adjustments into the database, one increment and audit entry per Item.
+ * @param   force: If true, every pending adjustment is sent.
+ *                 Otherwise, only those that haven't changed for `ADJUSTMENT_WINDOW_S` seconds.
+ * @retval  None
+ */
+void DB::Item::FlushAdjustments(bool force)
+{
+    double now = ImGui::GetTime();
+    for (auto adj = adjustments.begin(); adj != adjustments.end();)
+    {
+        if (force == false && now - adj->second.lastChange < ADJUSTMENT_WINDOW_S)
+        {
+            ++adj;
+            continue;
+        }
+
+        const Item& before = adj->second.before;
+        Item after = before;
+        after.IncQuantity(adj->second.delta);
+
+        // If the adjustments cancel each other out, there's nothing to send.
+        if (adj->second.delta != 0.0f)
+        {
+            size_t pos = FindInCache(before.GetId());
+            if (pos != NOT_CACHED)
+            {
+                std::unique_lock<std::shared_mutex> lock = LockForWriting();
+                items[pos].SetRevision(items[pos].GetRevision() + 1);
+                after.SetRevision(items[pos].GetRevision());
+            }
+
+            // An increment adds up with the changes made by others, no need to match the revision.
+            pendingWrites++;
+            DB::WriteQueue::Update(CreateRevisionFilter(before, false),
+                                   CreateDocumentForEdit(before, after), DATABASE, COLLECTION,
+                                   [after](bool r) { OnWriteAcknowledged(r, "adjust", after); });
+            Logging::Audit.Info("Edited Item ", before.GetId() + FindDiffs(before, after), true);
+        }
+
+        adj = adjustments.erase(adj);
+        // The Item isn't shown as having pending adjustments anymore.
+        generation++;
+    }
+}
+
+/**
+ * @brief   Change the quantity of several Items at once, either all of them or none.
+ *          The database only takes Items out if it still has enough of them,
+ *          no matter what the other clients did since the cache was read.
+ *          A server without transactions makes the changes it can, the others are reported.
+ * @param   changes: The changes to make. An Item can appear more than once.
+ * @param   reason: What the changes are for, for the audit log and the messages.
+ * @retval  True if the changes were queued, false if an Item isn't known.
+ * @note    The cache is modified right away. If the database refuses the changes,
+ *          the Items are read back from it.
+ */
+bool DB::Item::CommitQuantities(const std::vector<QuantityChange>& changes, const std::string& reason)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    if (!IS_INIT || changes.empty())
+    {
+        return false;
+    }
+
+    // If any of the Items isn't known, don't change anything.
+    for (const QuantityChange& change : changes)
+    {
+        if (FindInCache(change.id) == NOT_CACHED)
+        {
+            return false;
+        }
+    }
+
+    // The stock checks are made against the database, so it must know about every adjustment first.
+    FlushAdjustments(true);
+
+    std::vector<DB::WriteQueue::Change> writes;
+    std::vector<Item> written;
+    std::string diffs;
+    for (const QuantityChange& change : changes)
+    {
+        size_t pos = FindInCache(change.id);
+        Item before = items[pos];
+        Item after = before;
+        after.IncQuantity(change.delta);
+        after.SetRevision(before.GetRevision() + 1);
+
+        // An increment adds up with the changes made by others, no need to match the revision.
+        bsoncxx::builder::basic::document filter = bsoncxx::builder::basic::document{};
+        filter.append(bsoncxx::builder::concatenate(CreateRevisionFilter(before, false).view()));
+        // If Items are taken out, the database must still have enough of them.
+        if (change.delta < 0.0f)
+        {
+            filter.append(kvp("quantity", make_document(kvp("$gte", double(-change.delta)))));
+        }
+        writes.push_back({ filter.extract(), CreateDocumentForEdit(before, after) });
+        written.push_back(after);
+        diffs += "\n\r" + before.GetId() + FindDiffs(before, after);
+
+        std::unique_lock<std::shared_mutex> lock = LockForWriting();
+        RemoveFromOrders(pos);
+        items[pos].IncQuantity(change.delta);
+        items[pos].SetRevision(after.GetRevision());
+        AddToOrders(pos);
+        generation++;
+    }
+
+    // Queue every change as a single write.
+    pendingWrites++;
+    DB::WriteQueue::UpdateAll(writes, DATABASE, COLLECTION, [reason, written](bool r)
+                              {
+                                  pendingWrites--;
+                                  if (r == true)
+                                  {
+                                      return;
+                                  }
+                                  if (ReloadItems(written) == false)
+                                  {
+                                      Logging::System.Warning("Unable to " + reason,
+                                                              ", some changes might not have been made.");
+                                      return;
+                                  }
+
+                                  // Without transactions, some of the changes might have been made anyway.
+                                  // Each change made brought its Item one revision further.
+                                  std::map<std::string, std::pair<int, int>> lines;  // Made and total, by id.
+                                  std::map<std::string, int> firstRevisions;
+                                  for (const Item& it : written)
+                                  {
+                                      lines[it.GetId()].second++;
+                                      firstRevisions.emplace(it.GetId(), it.GetRevision() - 1);
+                                  }
+                                  std::string missed;
+                                  bool isAnyMade = false;
+                                  for (auto& line : lines)
+                                  {
+                                      const Item* reloaded = FindItemByID(line.first);
+                                      int made = reloaded != nullptr ?
+                                          reloaded->GetRevision() - firstRevisions[line.first] : 0;
+                                      line.second.first = std::min(std::max(made, 0), line.second.second);
+                                      isAnyMade = isAnyMade || line.second.first != 0;
+                                      if (line.second.first != line.second.second)
+                                      {
+                                          missed += "\n\r\t" + line.first + ": " +
+                                              StringUtils::NumToString(unsigned(line.second.first), false) + " of " +
+                                              StringUtils::NumToString(unsigned(line.second.second), false) + " changes made";
+                                      }
+                                  }
+
+                                  if (isAnyMade == false)
+                                  {
+                                      Logging::System.Warning("Unable to " + reason,
+                                                              ", nothing was changed. There might not be enough "
+                                                              "of an Item left anymore, the latest version of the "
+                                                              "Items was reloaded.");
+                                  }
+                                  else
+                                  {
+                                      std::string message = ", there isn't enough of some Items left. "
+                                          "The latest version of the Items was reloaded." + missed;
+                                      Logging::System.Warning("Unable to fully " + reason, message);
+                                      Logging::Audit.Warning("Only part of the changes were made: " + reason, missed, true);
+                                  }
+                              });
+    // Log the event.
+    Logging::Audit.Info(reason, diffs, true);
+
+    return true;
+}
+
+/**
+ * @brief   Delete an Item from the cache and queue its deletion from the database.
+ * @param   The Item to delete. Its ObjectId is used to find its document, or its id if it isn't known yet.
+ * @retval  True if the deletion was queued, false otherwise.
+ * @note    The Item is removed from the cache right away. If the deletion fails,
+ *          the Item is read back from the database.
+ */
+bool DB::Item::DeleteItem(Item& item)
+{
+    if (!IS_INIT)
+    {
+        return false;
+    }
+
+    // Remove the Item from the cache.
+    RemoveFromCache(item);
+    // Queue the deletion of the Item from the database.
+    pendingWrites++;
+    // The document is only marked as deleted, so that the other clients can find out about it.
+    // A tombstone left by an earlier deletion of the same id mustn't be the one matched.
+    DB::WriteQueue::Update(CreateRevisionFilter(item, false), DB::MakeTombstone(), DATABASE, COLLECTION,
+                           [item](bool r) { OnWriteAcknowledged(r, "delete", item); });
+    // Log the event.
+    Logging::Audit.Info("Deleted Item \"" + item.GetId(), "\"", true);
+
+    return true;
+}
+
+/**
+ * @brief   Get all items contained in the Cache.
+ * @param   None
+ * @retval  A list of all the Items.
+ */
+const std::vector<Item>& DB::Item::GetAll()
+{
+    return items;
+}
+
+/**
+ * @brief   Find an Item of the cache by id.
+ * @param   id: The id of the Item.
+ * @retval  A pointer to the cached Item, nullptr if it isn't in the cache.
+ * @note    The pointer is only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+const Item* DB::Item::FindItemByID(const std::string& id)
+{
+    size_t pos = FindInCache(id);
+    return pos != NOT_CACHED ? &items[pos] : nullptr;
+}
+
+/**
+ * @brief   Find an Item of the cache by id, only searching for it again if the cache
+ *          was modified since the last time the handle was resolved.
+ * @param   id: The id of the Item.
+ * @param   handle: Where the Item was last found. Updated if it had to be searched for again.
+ * @retval  A pointer to the cached Item, nullptr if it isn't in the cache.
+ * @note    The pointer is only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+const Item* DB::Item::Resolve(const std::string& id, Handle& handle)
+{
+    if (handle.isResolved == false || handle.generation != generation)
+    {
+        size_t pos = FindInCache(id);
+        handle.pos = pos;
+        handle.isCached = pos != NOT_CACHED;
+        handle.generation = generation;
+        handle.isResolved = true;
+    }
+    return handle.isCached == true ? &items[handle.pos] : nullptr;
+}
+
+/**
+ * @brief   Find an Item of the cache by ObjectId.
+ * @param   oid: The ObjectId of the Item.
+ * @retval  A pointer to the cached Item, nullptr if it isn't in the cache.
+ * @note    The pointer is only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+const Item* DB::Item::FindItemByOid(const std::string& oid)
+{
+    size_t pos = FindInCacheByOid(oid);
+    return pos != NOT_CACHED ? &items[pos] : nullptr;
+}
+
+/**
+ * @brief   Get all the cached Items of a category.
+ * @param   prefix: The prefix of the category.
+ * @retval  The Items of the category, in no particular order.
+ * @note    The pointers are only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+std::vector<const Item*> DB::Item::GetItemsInCategory(const std::string& prefix)
+{
+    std::vector<const Item*> ret;
+    auto match = byCategory.find(prefix);
+    if (match != byCategory.end())
+    {
+        ret.reserve(match->second.size());
+        for (size_t pos : match->second)
+        {
+            ret.push_back(&items[pos]);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief   Get all the cached Items that have a status.
+ * @param   status: The status to look for.
+ * @retval  The Items that have that status, in no particular order.
+ * @note    The pointers are only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+std::vector<const Item*> DB::Item::GetItemsWithStatus(ItemStatus status)
+{
+    std::vector<const Item*> ret;
+    auto match = byStatus.find(int(status));
+    if (match != byStatus.end())
+    {
+        ret.reserve(match->second.size());
+        for (size_t pos : match->second)
+        {
+            ret.push_back(&items[pos]);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief   Find the cached Items that might contain a text, without looking at every Item.
+ *          The candidates still have to be checked, they only contain every trigram of the text.
+ * @param   text: The text to look for, in all caps.
+ * @param   key: The field to look in. SearchKey::count to look in all the text fields.
+ * @param   candidates: Where to store the Items found.
+ * @retval  True if the candidates were found.
+ *          False if the index can't help (the text is too short or the field isn't indexed):
+ *          every Item is a candidate.
+ * @note    The pointers are only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+bool DB::Item::FindCandidates(const std::string& text, SearchKey key, std::vector<const Item*>& candidates)
+{
+    candidates.clear();
+    if (key != SearchKey::count &&
+        std::find(std::begin(TEXT_SEARCH_KEYS), std::end(TEXT_SEARCH_KEYS), key) == std::end(TEXT_SEARCH_KEYS))
+    {
+        return false;
+    }
+
+    std::vector<size_t> positions;
+    if (textIndex.FindCandidates(text, positions) == false)
+    {
+        return false;
+    }
+
+    candidates.reserve(positions.size());
+    for (size_t pos : positions)
+    {
+        candidates.push_back(&items[pos]);
+    }
+    return true;
+}
+
+/**
+ * @brief   Get the Items of the cache in the order of one of their fields.
+ *          The orders are kept up to date as the cache changes, nothing is sorted here.
+ * @param   key: The field to order the Items by. Items with the same value are ordered by id.
+ * @param   descending: If true, the order is reversed.
+ * @param   sorted: Where to store the Items.
+ * @retval  None
+ * @note    The pointers are only valid until the cache is modified, see DB::Item::GetGeneration.
+ */
+void DB::Item::GetSorted(SearchKey key, bool descending, std::vector<const Item*>& sorted)
+{
+    sorted.clear();
+    if (key >= SearchKey::count)
+    {
+        return;
+    }
+
+    const std::set<SortEntry>& order = orders[size_t(key)];
+    sorted.reserve(order.size());
+    if (descending == false)
+    {
+        for (auto it = order.begin(); it != order.end(); ++it)
+        {
+            sorted.push_back(&items[it->pos]);
+        }
+    }
+    else
+    {
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            sorted.push_back(&items[it->pos]);
+        }
+    }
+}
+
+/**
+ * @brief   Compare one of the fields of two Items, the same way DB::Item::GetSorted orders them.
+ * @param   a: The first Item.
+ * @param   b: The second Item.
+ * @param   key: The field to compare.
+ * @retval  A negative number if `a` comes before `b`, a positive one if it comes after, 0 if the fields are equal.
+ */
+int DB::Item::CompareItems(const Item& a, const Item& b, SearchKey key)
+{
+    if (key >= SearchKey::count)
+    {
+        return 0;
+    }
+
+    if (IsNumericKey(key) == true)
+    {
+        double na = GetNumericKey(a, key);
+        double nb = GetNumericKey(b, key);
+        return na < nb ? -1 : (nb < na ? 1 : 0);
+    }
+
+    return a.GetSearchKey(key).compare(b.GetSearchKey(key));
+}
+
+/**
+ * @brief   Lock the cache so that it can be read from another thread than the UI thread.
+ *          The cache is only ever modified from the UI thread, which doesn't need the lock to read it.
+ * @param   None
+ * @retval  The lock, held until it is destroyed. Modifying the cache blocks in the meantime.
+ */
+std::shared_lock<std::shared_mutex> DB::Item::LockForReading()
+{
+    return std::shared_lock<std::shared_mutex>(cacheMutex);
+}
+
+/**
+ * @brief   Check if the UI thread is waiting for the readers to release the cache so that it can modify it.
+ *          Long reads should stop as soon as possible when it is, their result would be stale anyway.
+ * @param   None
+ * @retval  True if a modification is waiting, false otherwise.
+ */
+bool DB::Item::IsWriterWaiting()
+{
+    return waitingWriters > 0;
+}
+
+/**
+ * @brief   Get the generation of the cache, which changes every time the cache is modified.
+ *          Anything derived from the cache (pointers, filtered lists, etc.) is stale once it changes.
+ * @param   None
+ * @retval  The generation of the cache.
+ */
+unsigned int DB::Item::GetGeneration()
+{
+    return generation;
+}
+
+/**
+ * @brief   Called once the database acknowledged a write queued by this module.
+ *          The cache already holds the result of the write, so nothing is reloaded,
+ *          except for the Item that was written when it needs to be confirmed.
+ * @param   r: True if the write succeeded.
+ * @param   action: What the write was doing, for the messages.
+ * @param   it: The Item as it was put in the cache.
+ * @retval  None
+ */
+void OnWriteAcknowledged(bool r, const std::string& action, const Item& it)
+{
+    pendingWrites--;
+    if (r == false)
+    {
+        // Most likely, the Item was modified or deleted by someone else since we read it.
+        Logging::System.Warning("Unable to " + action + " Item \"" + it.GetId(),
+                                "\", it might have been modified by someone else. "
+                                "Its latest version was reloaded.");
+        ReloadItem(it);
+    }
+}
+
+/**
+ * @brief   Called once the database acknowledged the creation of an Item.
+ * @param   r: True if the write succeeded.
+ * @param   oid: The ObjectId of the created document, empty if another Item already had that id.
+ * @param   it: The Item that was created.
+ * @retval  None
+ */
+void OnCreateAcknowledged(bool r, const std::string& oid, const Item& it)
+{
+    // If someone else created an Item with that id first, ours wasn't written.
+    if (r == true && oid.empty())
+    {
+        pendingWrites--;
+        Logging::System.Error("Unable to create Item \"" + it.GetId(),
+                              "\", another Item already has that id. It was loaded instead.");
+        ReloadItem(it);
+        return;
+    }
+    // If the write failed:
+    if (r == false)
+    {
+        OnWriteAcknowledged(r, "create", it);
+        return;
+    }
+
+    pendingWrites--;
+    // Keep the ObjectId assigned by the database, unless the change stream already brought it.
+    size_t pos = FindInCache(it.GetId());
+    if (pos != NOT_CACHED && items[pos].HasOid() == false)
+    {
+        std::unique_lock<std::shared_mutex> lock = LockForWriting();
+        items[pos].SetOid(oid);
+        byOid[oid] = pos;
+        generation++;
+    }
+}
+
+/**
+ * @brief   Replace an Item of the cache by what the database currently holds.
+ *          If the database doesn't have it anymore, it is removed from the cache.
+ * @param   it: The Item to reload. Found by ObjectId if it has one, by id otherwise.
+ * @retval  None
+ */
+void ReloadItem(const Item& it)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::document::value filter = it.HasOid() ?
+        make_document(kvp("_id", bsoncxx::oid(it.GetOid()))) : CreateDocument("id", it.GetId());
+    bsoncxx::document::value doc = DB::GetDocument(DATABASE, COLLECTION, DB::ExcludeDeleted(filter));
+
+    bsoncxx::document::element el = doc.view()["_id"];
+    // If the database doesn't have the Item:
+    if (el.raw() == nullptr || el.type() != bsoncxx::type::k_oid)
+    {
+        RemoveFromCache(it);
+        return;
+    }
+
+    // The database is right, even if the cache thinks it has a more recent revision.
+    ApplyUpsert(doc.view(), el.get_oid().value.to_string(), true);
+}
+
+/**
+ * @brief   Replace Items of the cache by what the database currently holds, in a single query.
+ *          The Items the database doesn't have anymore are removed from the cache.
+ * @param   its: The Items to reload, found by id.
+ * @retval  True if the Items were reloaded, false if the database couldn't be queried.
+ */
+bool ReloadItems(const std::vector<Item>& its)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    if (its.empty())
+    {
+        return true;
+    }
+
+    bsoncxx::builder::basic::array ids = bsoncxx::builder::basic::array{};
+    for (const Item& it : its)
+    {
+        ids.append(it.GetId());
+    }
+    bsoncxx::document::value filter = make_document(kvp("id", make_document(kvp("$in", ids.extract()))));
+    bsoncxx::stdx::optional<DB::Cursor> docs = DB::GetAllDocuments(DATABASE, COLLECTION, DB::ExcludeDeleted(filter));
+    if (!docs)
+    {
+        return false;
+    }
+
+    std::unordered_set<std::string> found;
+    try
+    {
+        for (const bsoncxx::document::view& doc : docs.value())
+        {
+            bsoncxx::document::element el = doc["_id"];
+            if (el.raw() == nullptr || el.type() != bsoncxx::type::k_oid)
+            {
+                continue;
+            }
+            // The database is right, even if the cache thinks it has a more recent revision.
+            ApplyUpsert(doc, el.get_oid().value.to_string(), true);
+
+            bsoncxx::document::element id = doc["id"];
+            if (id.raw() != nullptr && id.type() == bsoncxx::type::k_utf8)
+            {
+                found.insert(std::string(id.get_utf8().value));
+            }
+        }
+    }
+    catch (const mongocxx::query_exception & e)
+    {
+        Logging::System.Error("An error occurred when reloading items: ", e.what());
+        return false;
+    }
+
+    // If the database doesn't have an Item anymore:
+    for (const Item& it : its)
+    {
+        if (found.count(it.GetId()) == 0)
+        {
+            RemoveFromCache(it);
+        }
+    }
 
-    return r;
+    return true;
 }
 
 /**
- * @brief   Created if needed but not implemented.
- *          Intended to be identical in principle to DB::Category::GetCategoryByName.
- *
- * @throws  std::logic_error
+ * @brief   Create the filter matching an Item only if it is still at the revision it was read at.
+ *          The tombstones are never matched.
+ * @param   it: The Item to match.
+ * @param   matchRevision: If false, the filter matches the Item at any revision.
+ * @retval  The filter.
  */
-Item DB::Item::GetItemByName(const std::string& name)
+bsoncxx::document::value CreateRevisionFilter(const Item& it, bool matchRevision)
 {
-    if (!IS_INIT)
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_array;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::builder::basic::document builder = bsoncxx::builder::basic::document{};
+    if (it.HasOid())
     {
-        return DB::Item::Item();
+        builder.append(kvp("_id", bsoncxx::oid(it.GetOid())));
     }
-    throw std::logic_error("Not Implemented");
-}
-
-/**
- * @brief   Get an item from the database that matches the id.
- * @param   id: The id to query for.
- * @retval  The Item that was found or an empty object if none were found.
- */
-Item DB::Item::GetItemByID(const std::string& id)
-{
-    // Create a default, non-valid Item to store the output.
-    Item c = Item("", "");
-    if (!IS_INIT)
+    else
     {
-        return c;
+        builder.append(kvp("id", it.GetId()));
     }
 
-    // Search in the cache for a Item with a matching name.
-    if (FindInCache(c, id) == false)
+    if (matchRevision)
     {
-        // If no matching category was found in the cache, query the database.
-        c = CreateObject(DB::GetDocument(DATABASE, "Items", CreateDocument("id", id)));
-        // If a match was found:
-        if (c.IsValid() == true)
+        // Documents written before revisions existed don't have the field at all.
+        if (it.GetRevision() == 0)
+        {
+            builder.append(kvp(FIELD_REVISION, make_document(kvp("$in", make_array(bsoncxx::types::b_null{}, 0)))));
+        }
+        else
         {
-            // Add it to the cache.
-            items.emplace_back(c);
+            builder.append(kvp(FIELD_REVISION, it.GetRevision()));
         }
     }
 
-    return c;
+    // A deleted Item can't be modified, nor brought back to life by an update.
+    return DB::ExcludeDeleted(builder.extract());
 }
 
 /**
- * @brief   Generates a new Item id for the appropriate category.
- *          Optionally, force the id to be a certain value by using the id parameter.
- *          Example: `cat.GetPrefix()` is "MFOM" and id is -1
- *              Cache contains:
- *                  - MFOM0001
- *                  - MBOX0003
- *                  - AFOM0002
- *                  - MFOM0002
- *              DB::Item::GetNewId will return "MFOM0003"
- * @param   cat: The category to create the id for.
- * @param   id (optional): If specified, used as the id's number.
- *                         If not specified, automatically increment the id.
- * @retval  The generated id.
+ * @brief   Apply the changes streamed by the database to the cache.
+ * @param   None
+ * @retval  None
  */
-std::string DB::Item::GetNewId(const DB::Category::Category& cat, int id)
+void ApplyChanges()
 {
-    if (!IS_INIT)
-    {
-        return "";
-    }
-
-    int max = 0;
-    // For each items in the cache:
-    for (auto& item : items)
+    for (DB::ChangeStream::Event& e : watcher.TakeEvents())
     {
-        // If the item's category is the same we want:
-        if (item.GetCategory() == cat)
+        switch (e.type)
         {
-            // If this item's id is the biggest we've seen so far:
-            if (StringUtils::StringToNum<int>(item.GetId()) >= max)
-            {
-                // Save it.
-                max = StringUtils::StringToNum<int>(item.GetId());
-            }
+            case DB::ChangeStream::EventType::Upsert:
+                ApplyUpsert(e.doc.value().view(), e.oid);
+                break;
+            case DB::ChangeStream::EventType::Delete:
+                ApplyDelete(e.oid);
+                break;
+            case DB::ChangeStream::EventType::Reload:
+            default:
+                Init();
+                break;
         }
     }
-
-    // First ID will be 0001, not 0, this is desired.
-    // If `id` is -1, use the maximal id we observed.
-    // Otherwise, use the specified `id`
-    max = id == -1 ? max + 1 : id;
-    // Form the id using the category's prefix and the value of `max`
-    std::string ret = cat.GetPrefix() + StringUtils::NumToString(max);
-    // Does the Category have a suffix?
-    if (cat.GetSuffix() != '\0')
-    {
-        // If yes, add it to the id.
-        ret += cat.GetSuffix();
-    }
-    // Force the generated id to be all capitalized.
-    boost::to_upper(ret);
-    return  ret;
 }
 
 /**
- * @brief   Update a currently existing Item in the cache and the database.
- * @param   oldItem: The Item to edit.
- * @param   newItem: The new value of the Item.
- * @retval  True if successfully edited in the database, false otherwise.
- *
- * @note    Even if the modification in the database fails, the Item will be modified in the cache.
- *          It will remain like that until the next refresh event.
- * @note    The oldBom in the cache isn't technically modified, but rather deleted. The newBom is then
- *          added to the cache.
+ * @brief   Add or update a Item of the cache with a document read from the database.
+ *          The document is matched to a cached Item by ObjectId or, for a Item
+ *          that was added locally and isn't acknowledged yet, by id.
+ * @param   doc: The document read from the database.
+ * @param   oid: The ObjectId of the document.
+ * @param   force: If false, the document is ignored if the cache holds a more recent revision,
+ *                 which happens when our own writes are echoed back while more are in flight.
+ * @retval  None
  */
-bool DB::Item::EditItem(const Item& oldItem, const Item& newItem)
+void ApplyUpsert(const bsoncxx::document::view& doc, const std::string& oid, bool force)
 {
-    if (!IS_INIT)
+    Item obj = CreateObject(doc);
+    size_t pos = FindInCacheByOid(oid);
+    if (pos == NOT_CACHED)
     {
-        return false;
+        pos = FindInCache(obj.GetId());
+        if (pos != NOT_CACHED && items[pos].HasOid())
+        {
+            // Another document that has the same id.
+            pos = NOT_CACHED;
+        }
     }
 
-    // Remove the old Item from the cache.
-    RemoveFromCache(oldItem);
-    // Add the "new" Item to the cache.
-    items.emplace_back(newItem);
-    // Update the Item in the database.
-    bool r = (DB::UpdateDocument(CreateDocument("id", oldItem.GetId()),
-                                 CreateDocumentForUpdate(newItem), DATABASE, "Items"));
-    // Log the event.
-    Logging::Audit.Info("Edited Item ", oldItem.GetId() + FindDiffs(oldItem, newItem), true);
-
-    // Refresh Cache.
-    Init();
-
-    return r;
+    // If the Item is already in the cache, update it. Otherwise, add it.
+    if (pos != NOT_CACHED)
+    {
+        if (force == true || obj.GetRevision() >= items[pos].GetRevision())
+        {
+            // Keep showing the adjustments that are still on their way.
+            auto adj = adjustments.find(obj.GetId());
+            if (adj != adjustments.end())
+            {
+                adj->second.before = obj;
+                Item adjusted = obj;
+                adjusted.IncQuantity(adj->second.delta);
+                ReplaceInCache(pos, adjusted);
+            }
+            else
+            {
+                ReplaceInCache(pos, obj);
+            }
+        }
+    }
+    else
+    {
+        AddToCache(obj);
+    }
 }
 
 /**
- * @brief   Delete an Item from the cache and the database.
- * @param   The Item to delete. Only the `m_id` field of the Item object is used to query the database.
- * @retval  True if successfully deleted from the database, false otherwise.
- * @note    Even if the Item isn't deleted from the database, it will still be removed from the cache.
- *          This will remain until the next refresh event.
+ * @brief   Remove a Item from the cache.
+ * @param   oid: The ObjectId of the Item that was deleted.
+ * @retval  None
  */
-bool DB::Item::DeleteItem(Item& item)
+void ApplyDelete(const std::string& oid)
 {
-    if (!IS_INIT)
+    size_t pos = FindInCacheByOid(oid);
+    if (pos != NOT_CACHED)
     {
-        return false;
+        RemoveFromCache(pos);
     }
-
-    // Remove the Item from the cache.
-    RemoveFromCache(item);
-    // Delete the Item from the database.
-    bool r = (DB::DeleteDocument(CreateDocument("id", item.GetId()), DATABASE, "Items"));
-    // Log the event.
-    Logging::Audit.Info("Deleted Item \"" + item.GetId(), "\"", true);
-
-    // Refresh Cache.
-    Init();
-
-    return r;
 }
 
 /**
- * @brief   Get all items contained in the Cache.
+ * @brief   Lock the cache so that it can be modified, letting the readers of other threads know they should stop.
  * @param   None
- * @retval  A list of all the Items.
+ * @retval  The lock, held until it is destroyed.
  */
-const std::vector<Item>& DB::Item::GetAll()
+std::unique_lock<std::shared_mutex> LockForWriting()
 {
-    return items;
+    waitingWriters++;
+    std::unique_lock<std::shared_mutex> lock(cacheMutex);
+    waitingWriters--;
+    return lock;
 }
 
 /**
@@ -340,7 +1366,7 @@ bsoncxx::document::value CreateDocument(Item it)
     builder.append(kvp("status", it.GetStatus()));
 
     // If the Item has a valid ObjectId:
-    if (!it.GetOid().empty() && it.GetOid() != "N/A")
+    if (it.HasOid())
     {
         // Add the ObjectId kvp.
         builder.append(kvp("_id", bsoncxx::oid(it.GetOid())));
@@ -370,20 +1396,41 @@ bsoncxx::document::value CreateDocument(const std::string& field, const std::str
 }
 
 /**
- * @brief   Create a mongoDB document to use in an update query from a Category object.
- * @param   cat The Category instance to use to create the document.
+ * @brief   Create a mongoDB document to use in the upsert creating an Item.
+ * @param   it The Item instance to use to create the document.
  * @retval  The created document.
  */
-bsoncxx::document::value CreateDocumentForUpdate(Item it)
+bsoncxx::document::value CreateDocumentForInsert(Item it)
 {
     using bsoncxx::builder::basic::kvp;
-    // Create the builder object.
-    auto builder = bsoncxx::builder::basic::document{};
-    // Create a mongodb document from the Item object and add it to the document.
-    builder.append(kvp("$set", CreateDocument(it)));
+    // Set every field of the new Item and have the server stamp the time of the write.
+    return DB::MakeStampedInsert(CreateDocument(it));
+}
 
-    // Make a `bsoncxx::document::value` from the builder.
-    return builder.extract();
+/**
+ * @brief   Create a mongoDB document to use in an update query that only changes
+ *          the fields that differ between two versions of an Item.
+ * @param   oldItem: The Item as it was read.
+ * @param   newItem: The Item as it should be.
+ * @retval  The created document. The quantity is incremented by its difference rather than set.
+ */
+bsoncxx::document::value CreateDocumentForEdit(const Item& oldItem, const Item& newItem)
+{
+    return DB::MakeDiffUpdate(CreateDocument(oldItem), CreateDocument(newItem), { "quantity" });
+}
+
+/**
+ * @brief   Check if the quantity is the only thing that differs between two versions of an Item.
+ * @param   oldItem: The Item as it was read.
+ * @param   newItem: The Item as it should be.
+ * @retval  True if only the quantity changed.
+ * @retval  False if anything else changed.
+ */
+bool IsQuantityOnlyChange(const Item& oldItem, const Item& newItem)
+{
+    Item tmp = oldItem;
+    tmp.SetQuantity(newItem.GetQuantity());
+    return tmp == newItem;
 }
 
 /**
@@ -531,75 +1578,317 @@ Item CreateObject(const bsoncxx::document::view& doc)
     }
 
     // Instantiate an Item with the values extracted from the document.
-    return Item(oid, id, description, { catName, catPref, catSuffix }, refLink, location, price, quantity, unit, status);
+    int revision = 0;
+    el = doc[FIELD_REVISION];
+    if (el.raw() != nullptr)
+    {
+        if (el.type() == bsoncxx::type::k_int32)
+        {
+            revision = el.get_int32().value;
+        }
+        else if (el.type() == bsoncxx::type::k_int64)
+        {
+            revision = int(el.get_int64().value);
+        }
+    }
+
+    Item it = Item(oid, id, description, { catName, catPref, catSuffix }, refLink, location, price, quantity, unit, status);
+    it.SetRevision(revision);
+    return it;
+}
+
+/**
+ * @brief   Find the position of an Item in the cache.
+ * @param   id: The id of the Item to look for.
+ * @retval  The position of the Item in the cache, NOT_CACHED if it isn't in it.
+ */
+size_t FindInCache(const std::string& id)
+{
+    auto match = byId.find(id);
+    return match != byId.end() ? match->second : NOT_CACHED;
+}
+
+/**
+ * @brief   Find the position of an Item in the cache.
+ * @param   oid: The ObjectId of the Item to look for.
+ * @retval  The position of the Item in the cache, NOT_CACHED if it isn't in it.
+ */
+size_t FindInCacheByOid(const std::string& oid)
+{
+    auto match = byOid.find(oid);
+    return match != byOid.end() ? match->second : NOT_CACHED;
 }
 
 /**
- * @brief   Search the cache to check if the Item is present in it.
- * @param   it: The Item to look for
- * @retval  True if the Item is found, false otherwise.
+ * @brief   Add an Item to the cache. If an Item with the same id is already in it, it is replaced.
+ * @param   it: The Item to add.
+ * @retval  None
  */
-bool FindInCache(Item& it)
+void AddToCache(const Item& it)
 {
-    // For each Item in the cache:
-    for (Item i : items)
+    size_t pos = FindInCache(it.GetId());
+    if (pos != NOT_CACHED)
     {
-        // If the Item matches `it`:
-        if (i == it)
-        {
-            // We found it!
-            it = i;
-            return true;
-        }
+        ReplaceInCache(pos, it);
+        return;
     }
-    // No matching Item was found in the cache.
-    return false;
+
+    std::unique_lock<std::shared_mutex> lock = LockForWriting();
+    items.emplace_back(it);
+    IndexItem(items.size() - 1);
+    generation++;
+}
+
+/**
+ * @brief   Replace an Item of the cache.
+ * @param   pos: The position of the Item to replace.
+ * @param   it: The new value of the Item.
+ * @retval  None
+ */
+void ReplaceInCache(size_t pos, const Item& it)
+{
+    std::unique_lock<std::shared_mutex> lock = LockForWriting();
+    UnindexItem(pos);
+    items[pos] = it;
+    IndexItem(pos);
+    generation++;
 }
 
 /**
- * @brief   Search the cache to check if an Item that has a member
- *          that matches the requested value.
- * @param   it: A reference where the found Item will be stored.
- * @param   val: The value to look for.
- * @retval  True if the Item is found, false otherwise.
+ * @brief   Remove an Item from the cache.
+ *          The last Item of the cache takes its place, so nothing else has to move.
+ * @param   pos: The position of the Item to remove.
+ * @retval  None
  */
-bool FindInCache(Item& it, const std::string& val)
+void RemoveFromCache(size_t pos)
 {
-    // For each Item in the cache:
-    for (Item i : items)
+    std::unique_lock<std::shared_mutex> lock = LockForWriting();
+    size_t last = items.size() - 1;
+    UnindexItem(pos);
+    if (pos != last)
     {
-        // If the Item has a member identical to val:
-        if (i == val)
-        {
-            // We found it!
-            it = i;
-            return true;
-        }
+        UnindexItem(last);
+        items[pos] = std::move(items[last]);
+        IndexItem(pos);
     }
-    // No matching Item was found in the cache.
-    return false;
+    items.pop_back();
+    generation++;
 }
 
 /**
  * @brief   Remove an Item from the cache.
- * @param   it: The Item to remove.
+ * @param   it: The Item to remove. Found by ObjectId if it has one, by id otherwise.
  * @retval  True if an Item was removed from the cache, false otherwise.
  */
 bool RemoveFromCache(const Item& it)
 {
-    // For each Item in the cache:
-    for (auto i = items.begin(); i != items.end(); i++)
+    size_t pos = it.HasOid() ? FindInCacheByOid(it.GetOid()) : FindInCache(it.GetId());
+    if (pos == NOT_CACHED)
+    {
+        // No matching Item was found.
+        return false;
+    }
+
+    RemoveFromCache(pos);
+    return true;
+}
+
+/**
+ * @brief   Remove every Item from the cache.
+ * @param   None
+ * @retval  None
+ */
+void ClearCache()
+{
+    std::unique_lock<std::shared_mutex> lock = LockForWriting();
+    items.clear();
+    byId.clear();
+    byOid.clear();
+    byCategory.clear();
+    byStatus.clear();
+    maxIds.clear();
+    textIndex.Clear();
+    for (std::set<SortEntry>& order : orders)
+    {
+        order.clear();
+    }
+    generation++;
+}
+
+/**
+ * @brief   Add the Item at a position of the cache to the indexes.
+ * @param   pos: The position of the Item.
+ * @retval  None
+ */
+void IndexItem(size_t pos)
+{
+    const Item& it = items[pos];
+    byId[it.GetId()] = pos;
+    if (it.HasOid())
+    {
+        byOid[it.GetOid()] = pos;
+    }
+    byCategory[it.GetCategory().GetPrefix()].insert(pos);
+    byStatus[it.GetStatus()].insert(pos);
+
+    int& max = maxIds[GetSequenceName(it.GetCategory())];
+    max = std::max(max, StringUtils::StringToNum<int>(it.GetId()));
+
+    textIndex.Add(pos, GetTextFields(it));
+    AddToOrders(pos);
+}
+
+/**
+ * @brief   Remove the Item at a position of the cache from the indexes.
+ * @param   pos: The position of the Item.
+ * @retval  None
+ */
+void UnindexItem(size_t pos)
+{
+    const Item& it = items[pos];
+    textIndex.Remove(pos, GetTextFields(it));
+    RemoveFromOrders(pos);
+    // The indexes might already point to another Item with the same id.
+    auto id = byId.find(it.GetId());
+    if (id != byId.end() && id->second == pos)
+    {
+        byId.erase(id);
+    }
+    auto oid = byOid.find(it.GetOid());
+    if (oid != byOid.end() && oid->second == pos)
+    {
+        byOid.erase(oid);
+    }
+
+    auto cat = byCategory.find(it.GetCategory().GetPrefix());
+    if (cat != byCategory.end())
     {
-        // If the Item matches `it`:
-        if (*i == it)
+        cat->second.erase(pos);
+        if (cat->second.empty())
         {
-            // Remove it from the cache.
-            items.erase(i);
-            return true;
+            byCategory.erase(cat);
         }
     }
-    // No matching Item was found.
-    return false;
+
+    auto status = byStatus.find(it.GetStatus());
+    if (status != byStatus.end())
+    {
+        status->second.erase(pos);
+    }
+}
+
+/**
+ * @brief   Check if a field is ordered as a number rather than as text.
+ * @param   key: The field.
+ * @retval  True if it is a number.
+ */
+bool IsNumericKey(SearchKey key)
+{
+    return key == SearchKey::price || key == SearchKey::quantity || key == SearchKey::status;
+}
+
+/**
+ * @brief   Get the value of a numeric field of an Item.
+ * @param   it: The Item.
+ * @param   key: The field, see IsNumericKey.
+ * @retval  The value of the field, 0 if it isn't numeric.
+ */
+double GetNumericKey(const Item& it, SearchKey key)
+{
+    switch (key)
+    {
+        case SearchKey::price:
+            return it.GetPrice();
+        case SearchKey::quantity:
+            return it.GetQuantity();
+        case SearchKey::status:
+            return it.GetStatus();
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief   Get the place of an Item in the order of one of its fields.
+ * @param   it: The Item.
+ * @param   key: The field.
+ * @param   pos: The position of the Item in the cache.
+ * @retval  The entry of the Item in the order of the field.
+ */
+SortEntry GetSortEntry(const Item& it, SearchKey key, size_t pos)
+{
+    SortEntry entry;
+    if (IsNumericKey(key) == true)
+    {
+        entry.number = GetNumericKey(it, key);
+    }
+    else
+    {
+        entry.text = it.GetSearchKey(key);
+    }
+    entry.id = it.GetSearchKey(SearchKey::id);
+    entry.pos = pos;
+    return entry;
+}
+
+/**
+ * @brief   Add the Item at a position of the cache to the order of each field.
+ * @param   pos: The position of the Item.
+ * @retval  None
+ */
+void AddToOrders(size_t pos)
+{
+    for (size_t key = 0; key < size_t(SearchKey::count); key++)
+    {
+        orders[key].insert(GetSortEntry(items[pos], SearchKey(key), pos));
+    }
+}
+
+/**
+ * @brief   Remove the Item at a position of the cache from the order of each field.
+ * @param   pos: The position of the Item.
+ * @retval  None
+ */
+void RemoveFromOrders(size_t pos)
+{
+    for (size_t key = 0; key < size_t(SearchKey::count); key++)
+    {
+        orders[key].erase(GetSortEntry(items[pos], SearchKey(key), pos));
+    }
+}
+
+/**
+ * @brief   Get the name of the sequence handing out the id numbers of a category.
+ *          Categories that share a prefix but not a suffix have their own numbering.
+ * @param   cat: The category.
+ * @retval  The name of the sequence.
+ */
+std::string GetSequenceName(const DB::Category::Category& cat)
+{
+    std::string name = cat.GetPrefix();
+    if (cat.GetSuffix() != '\0')
+    {
+        name += cat.GetSuffix();
+    }
+    // The ids are always capitalized.
+    boost::to_upper(name);
+    return std::string(COLLECTION) + "/" + name;
+}
+
+/**
+ * @brief   Get the text fields of an Item that are indexed, see DB::Item::TEXT_SEARCH_KEYS.
+ * @param   it: The Item.
+ * @retval  Its indexed search keys.
+ */
+std::vector<const std::string*> GetTextFields(const Item& it)
+{
+    std::vector<const std::string*> fields;
+    fields.reserve(std::size(TEXT_SEARCH_KEYS));
+    for (SearchKey key : TEXT_SEARCH_KEYS)
+    {
+        fields.push_back(&it.GetSearchKey(key));
+    }
+    return fields;
 }
 
 /**
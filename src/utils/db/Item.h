@@ -4,6 +4,7 @@
 #include "utils/db/Category.h"
 
 #include <iostream>
+#include <shared_mutex>
 
 namespace DB
 {
@@ -51,6 +52,51 @@ inline const std::string GetStatusString(ItemStatus i)
     }
 }
 
+/**
+ * @enum    SearchKey
+ * @brief   The fields of an Item that can be searched, in the order the filters list them.
+ */
+enum class SearchKey
+{
+    id = 0,
+    description,
+    category,
+    referenceLink,
+    location,
+    price,
+    quantity,
+    unit,
+    status,
+    count,  /*!< The number of search keys, not a key. When filtering, stands for all the text fields. */
+};
+
+//! The fields searched when filtering on all the fields. They are the ones indexed for text searches.
+const SearchKey TEXT_SEARCH_KEYS[] = { SearchKey::id, SearchKey::description, SearchKey::category,
+                                       SearchKey::referenceLink, SearchKey::location, SearchKey::unit };
+
+/**
+ * @struct  Handle
+ * @brief   Where an Item was found in the cache by DB::Item::Resolve.
+ *          It is only searched for again once the generation of the cache changes.
+ */
+struct Handle
+{
+    size_t pos = 0;                 /**< Position of the Item in the cache */
+    unsigned int generation = 0;    /**< Generation of the cache when the Item was found */
+    bool isResolved = false;        /**< False until the Item is searched for the first time */
+    bool isCached = false;          /**< False if the Item wasn't in the cache */
+};
+
+/**
+ * @struct  QuantityChange
+ * @brief   A change of quantity made by DB::Item::CommitQuantities.
+ */
+struct QuantityChange
+{
+    std::string id;     /**< The id of the Item */
+    float delta;        /**< The quantity to add to the Item. Negative to remove */
+};
+
 /**
  * @class   Item
  * @brief   A class representing an Item document in the database.
@@ -86,6 +132,7 @@ public:
         m_price(price), m_quantity(qty),
         m_unit(unit), m_status(status)
     {
+        UpdateSearchKeys();
     }
     ~Item() = default;
 
@@ -97,6 +144,38 @@ public:
         return m_oid;
     }
 
+    /**
+     * Set the ObjectId of the Item
+     */
+    inline void SetOid(const std::string& oid)
+    {
+        m_oid = oid;
+    }
+
+    /**
+     * Get the revision of the Item, incremented by the database on every write.
+     */
+    inline int GetRevision() const
+    {
+        return m_revision;
+    }
+
+    /**
+     * Set the revision of the Item.
+     */
+    inline void SetRevision(int revision)
+    {
+        m_revision = revision;
+    }
+
+    /**
+     * Check if the Item has been assigned an ObjectId by the database.
+     */
+    inline bool HasOid() const
+    {
+        return !m_oid.empty() && m_oid != "N/A";
+    }
+
     /**
      * Get the CEP id of the Item
      */
@@ -152,6 +231,7 @@ public:
     inline void SetQuantity(const float& val)
     {
         m_quantity = val;
+        UpdateSearchKeys();
     }
 
     /**
@@ -162,6 +242,7 @@ public:
     inline void IncQuantity(float count = 1)
     {
         m_quantity += count;
+        UpdateSearchKeys();
     }
 
     /**
@@ -172,6 +253,7 @@ public:
     inline void DecQuantity(float count = 1)
     {
         m_quantity -= count;
+        UpdateSearchKeys();
     }
 
     /**
@@ -205,6 +287,16 @@ public:
     inline void SetStatus(const ItemStatus& status)
     {
         m_status = status;
+        UpdateSearchKeys();
+    }
+
+    /**
+     * Get the value of a field of the Item, as searched by the filters: formatted and in all caps.
+     * @param   key: The field to get.
+     */
+    inline const std::string& GetSearchKey(SearchKey key) const
+    {
+        return m_searchKeys[size_t(key)];
     }
 
     /**
@@ -253,6 +345,8 @@ public:
     }
 
 private:
+    void UpdateSearchKeys();
+
     /* The mongodb ObjectId */
     std::string             m_oid = "";
     /* The CEP id */
@@ -273,6 +367,10 @@ private:
     std::string             m_unit = "";
     /* The current production status */
     ItemStatus              m_status = ItemStatus::active;
+    /* The revision of the document this was read from, 0 if it never had one */
+    int                     m_revision = 0;
+    /* The searchable fields, formatted and in all caps. Kept up to date by every setter */
+    std::string             m_searchKeys[size_t(SearchKey::count)];
     /* The validity of the object.
      * The Item is considered invalid if the default constructor was used
      * or if the id or ObjectId are empty. */
@@ -287,11 +385,29 @@ Item GetItemByName(const std::string& name);
 Item GetItemByID(const std::string& prefix);
 
 std::string GetNewId(const DB::Category::Category& cat, int id = -1);
+int ReserveIds(const DB::Category::Category& cat, int count = 1);
 
 bool EditItem(const Item& oldItem, const Item& newItem);
+bool EditItems(const std::vector<Item>& oldItems, const std::vector<Item>& newItems);
 bool DeleteItem(Item& item);
 
+bool AdjustQuantity(const Item& item, float delta);
+float GetPendingAdjustment(const std::string& id);
+void FlushAdjustments(bool force = false);
+bool CommitQuantities(const std::vector<QuantityChange>& changes, const std::string& reason);
+
 const std::vector<Item>& GetAll();
+const Item* FindItemByID(const std::string& id);
+const Item* FindItemByOid(const std::string& oid);
+const Item* Resolve(const std::string& id, Handle& handle);
+std::vector<const Item*> GetItemsInCategory(const std::string& prefix);
+std::vector<const Item*> GetItemsWithStatus(ItemStatus status);
+unsigned int GetGeneration();
+std::shared_lock<std::shared_mutex> LockForReading();
+bool IsWriterWaiting();
+bool FindCandidates(const std::string& text, SearchKey key, std::vector<const Item*>& candidates);
+void GetSorted(SearchKey key, bool descending, std::vector<const Item*>& sorted);
+int CompareItems(const Item& a, const Item& b, SearchKey key);
 
 
 }   // namespace Item.
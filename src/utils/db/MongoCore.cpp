@@ -3,74 +3,143 @@
 #include "widgets/Logger.h"
 #include <vector>
 
-#define CLIENT client->GetClient()
-#define CLIENT_IS_VALID ((client != nullptr) && hasError == false)
+#include "utils/Config.h"
+#include "utils/db/ChangeStream.h"
+#include "utils/db/WriteQueue.h"
+#include "utils/misc.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <thread>
+
+#define POOL_IS_VALID ((pool != nullptr) && hasError == false)
 static mongocxx::instance instance;
 
+// The pool from which every thread borrows its clients.
+// A pointer because mongodb is triggered if you create an empty pool.
+static std::unique_ptr<mongocxx::pool> pool;
+static bool isInit = false;
+static bool hasError = false;
+// How long a ScopedClient waits for a free client before giving up, in milliseconds.
+static int poolWaitTimeoutMs = DEFAULT_POOL_WAIT_TIMEOUT_MS;
+// The client currently borrowed by this thread, if any.
+static thread_local mongocxx::client* threadClient = nullptr;
+
+// Cached answer of DB::HasUserWritePrivileges, resolved once per login.
+static bool arePrivilegesResolved = false;
+static bool hasWritePrivileges = false;
+static std::string privilegesDb;
+
+static int GetPoolSetting(const std::string& key, int defaultValue);
+static bsoncxx::document::value MakeStamped(const bsoncxx::document::view& set, const bsoncxx::document::view& inc);
+static bool ResolveWritePrivileges(const std::string& db);
+static bool ProbeWritePrivileges(const std::string& db);
+static std::string AppendUriOption(const std::string& uri, const std::string& key, int val);
+static int ReadSequence(const bsoncxx::document::view& doc);
+
 /**
- * @class   Client
- * @brief   At first, this had more to it.
- *          But it is now only a pretty useless wrapper for mongocxx::client.
- *          But it works so I'm not changing it.
+ * @brief   Borrow a client from the pool, waiting at most `DbPoolWaitQueueTimeoutMS` for one to be free.
+ *          If the calling thread already holds a client, that client is shared instead.
+ *          Use ScopedClient::IsValid to know if a client was obtained.
  */
-class Client
+DB::ScopedClient::ScopedClient()
 {
-public:
-    /**
-     * Creates a mongodb client from the passed parameters.
-     * @param   host: The url to use for the connection.
-     * @param   options: Any options to use for the client.
-     */
-    Client(const std::string& host, const mongocxx::options::client& options) :
-        m_client(mongocxx::uri(host), options)
+    // If this thread already holds a client further up the stack:
+    if (threadClient != nullptr)
     {
+        // Share it, taking a second one could starve the pool.
+        m_client = threadClient;
+        return;
     }
-    ~Client()
+
+    if (!POOL_IS_VALID)
     {
-        m_client.~client();
+        return;
     }
 
-    /**
-     * Get the mongocxx::client.
-     */
-    inline mongocxx::client& GetClient()
+    // mongocxx::pool::acquire blocks forever when the pool is exhausted,
+    // so poll with try_acquire until the wait queue timeout expires instead.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(poolWaitTimeoutMs);
+    do
     {
-        return m_client;
-    }
+        bsoncxx::stdx::optional<mongocxx::pool::entry> entry = pool->try_acquire();
+        if (entry)
+        {
+            m_entry = std::move(entry);
+            m_client = &**m_entry;
+            threadClient = m_client;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    } while (std::chrono::steady_clock::now() < deadline);
+}
 
-private:
-    mongocxx::client m_client;
-};
+DB::ScopedClient::ScopedClient(ScopedClient&& other) noexcept :
+    m_entry(std::move(other.m_entry)), m_client(other.m_client)
+{
+    other.m_entry = bsoncxx::stdx::nullopt;
+    other.m_client = nullptr;
+}
 
-// A pointer to an instance of Client because mongodb is triggered if you create an empty client.
-static Client* client;
-static bool isInit = false;
-static bool hasError = false;
+/**
+ * @brief   Give the client back to the pool, if this handle is the one that borrowed it.
+ */
+DB::ScopedClient::~ScopedClient()
+{
+    if (m_entry)
+    {
+        threadClient = nullptr;
+        m_entry = bsoncxx::stdx::nullopt;
+    }
+}
 
 /**
- * @brief   Initialize the connection to the mongodb database.
+ * @brief   Initialize the connection pool to the mongodb database.
  * @param   host: The url to use for the connection.
- * @param   options: Any options to use for the client.
+ * @param   options: Any options to use for the clients of the pool.
  * @retval  True if the initialization was successful, false otherwise.
  *
  * @note    There's a lot of reasons why the initialization might fail.
  *          The most common one I've seen is an invalid `host` string.
  *          The function should, in theory, catch all of the failed connection,
  *          but I wouldn't 100% rely on it.
+ *
+ * @attention   Every client borrowed from the previous pool must have been given back
+ *              before calling this function. The change streams are stopped and resumed here.
  */
 bool DB::Init(const std::string& host, const mongocxx::options::client& options)
 {
+    // Get the sizing of the pool from the config file.
+    int maxSize = GetPoolSetting("DbPoolMaxSize", DEFAULT_POOL_MAX_SIZE);
+    int minSize = GetPoolSetting("DbPoolMinSize", DEFAULT_POOL_MIN_SIZE);
+    poolWaitTimeoutMs = GetPoolSetting("DbPoolWaitQueueTimeoutMS", DEFAULT_POOL_WAIT_TIMEOUT_MS);
+
+    std::string uri = host;
+    uri = AppendUriOption(uri, "maxPoolSize", maxSize);
+    uri = AppendUriOption(uri, "minPoolSize", MIN(minSize, maxSize));
+
+    // The privileges belong to the user of the previous pool.
+    InvalidatePrivileges();
+
+    // The change streams hold on to clients of the previous pool.
+    ChangeStream::StopAll();
+
     try
     {
-        // Instantiate a new Client.
-        client = new Client(host, options);
+        // Release the previous pool before creating the new one.
+        pool.reset();
+        pool = std::make_unique<mongocxx::pool>(mongocxx::uri(uri), mongocxx::options::pool(options));
     }
-    catch (const mongocxx::logic_error & e)
+    catch (const mongocxx::exception & e)
     {
         // Something happened, tell the user.
         Logging::System.Critical("An Error Occurred When Logging In: ", e.what());
         hasError = true;
     }
+
+    // Resume the change streams, using the new pool.
+    ChangeStream::StartAll();
     if (isInit == true)
     {
         return false;
@@ -88,11 +157,12 @@ bool DB::Init(const std::string& host, const mongocxx::options::client& options)
  * @param   filter: The filter to query against.
  * @retval  The document if one is found, else an empty document.
  */
-bsoncxx::document::view DB::GetDocument(const std::string& db,
-                                        const std::string& col,
-                                        const bsoncxx::document::value& filter)
+bsoncxx::document::value DB::GetDocument(const std::string& db,
+                                         const std::string& col,
+                                         const bsoncxx::document::value& filter)
 {
-    if (!CLIENT_IS_VALID)
+    ScopedClient client;
+    if (!client.IsValid())
     {
         return bsoncxx::document::value({});
     }
@@ -101,19 +171,20 @@ bsoncxx::document::view DB::GetDocument(const std::string& db,
     {
         // Query the database for a matching document.
         bsoncxx::stdx::optional<bsoncxx::document::value> result =
-            CLIENT.database(db).collection(col).find_one(filter.view());
+            client->database(db).collection(col).find_one(filter.view());
         // If a matching document is found: 
         // TLDR: result is actually never `{}`, even if nothing is found.
         // Instead, the database returns an empty document, so std::optional is useless here.
         if (result)
         {
-            // Return the document.
-            return result.value().view();
+            // Return the document. It is returned by value since the client it came from
+            // goes back to the pool as soon as we return.
+            return std::move(result.value());
         }
         else
         {
             // Return an empty document.
-            return bsoncxx::document::view({});
+            return bsoncxx::document::value({});
         }
     }
     catch (const mongocxx::query_exception & e)
@@ -121,7 +192,7 @@ bsoncxx::document::view DB::GetDocument(const std::string& db,
         Logging::System.Critical("An error occurred when getting document from collection \""
                                  + col + "\" of database \"" + db + "\"\n\t", e.what());
         hasError = true;
-        return {};
+        return bsoncxx::document::value({});
     }
 }
 
@@ -130,17 +201,20 @@ bsoncxx::document::view DB::GetDocument(const std::string& db,
  * @param   db: The database to get the collection from.
  * @param   col: The collection to query.
  * @param   filter: The optional filter to query against.
- * @retval  If the query returned something that isn't retarded, returns a mongocxx::cursor to iterate over.
+ * @retval  If the query returned something that isn't retarded, returns a DB::Cursor to iterate over.
  *          Otherwise, returns an empty std::optional.
+ *
+ * @note    The returned DB::Cursor keeps its client borrowed from the pool until it is destroyed.
  */
-bsoncxx::stdx::optional<mongocxx::cursor> DB::GetAllDocuments(std::string db,
-                                                              std::string col,
-                                                              const bsoncxx::document::value& filter)
+bsoncxx::stdx::optional<DB::Cursor> DB::GetAllDocuments(std::string db,
+                                                        std::string col,
+                                                        const bsoncxx::document::value& filter)
 {
-    if (CLIENT_IS_VALID)
+    ScopedClient client;
+    if (client.IsValid())
     {
         // Query the database.
-        mongocxx::cursor cursor = CLIENT.database(db).collection(col).find(filter.view());
+        mongocxx::cursor cursor = client->database(db).collection(col).find(filter.view());
         try
         {
             // For some fucked up reason, `mongocxx::client::database::collection::find` is one of the 
@@ -160,7 +234,7 @@ bsoncxx::stdx::optional<mongocxx::cursor> DB::GetAllDocuments(std::string db,
             hasError = true;
             return {};
         }
-        return cursor;
+        return Cursor(std::move(client), std::move(cursor));
     }
     else
     {
@@ -184,11 +258,12 @@ bsoncxx::stdx::optional<mongocxx::cursor> DB::GetAllDocuments(std::string db,
  */
 bool DB::InsertDocument(const bsoncxx::document::value& doc, const std::string& db, const std::string& col)
 {
-    if (!CLIENT_IS_VALID)
+    ScopedClient client;
+    if (!client.IsValid())
     {
         return false;
     }
-    auto collection = CLIENT[db][col];
+    auto collection = (*client)[db][col];
     bsoncxx::stdx::optional<mongocxx::result::insert_one> result =
         collection.insert_one(doc.view());
 
@@ -207,14 +282,15 @@ bool DB::InsertDocument(const bsoncxx::document::value& doc, const std::string&
 bool DB::UpdateDocument(const bsoncxx::document::value& filter, const bsoncxx::document::value& doc,
                         const std::string& db, const std::string& col)
 {
-    if (!CLIENT_IS_VALID)
+    ScopedClient client;
+    if (!client.IsValid())
     {
         return false;
     }
     try
     {
         bsoncxx::stdx::optional<mongocxx::result::update> result =
-            CLIENT.database(db).collection(col).update_one(filter.view(), doc.view());
+            client->database(db).collection(col).update_one(filter.view(), doc.view());
 
         // If the std::optional returned by the database is valid:
         if (result)
@@ -230,6 +306,11 @@ bool DB::UpdateDocument(const bsoncxx::document::value& filter, const bsoncxx::d
     catch (const mongocxx::bulk_write_exception & e)
     {
         Logging::System.Error("An error occurred when updating a document: ", e.what());
+        // If the server refused the update, the privileges we have cached are wrong.
+        if (e.code().value() == ERROR_CODE_UNAUTHORIZED)
+        {
+            InvalidatePrivileges();
+        }
         return false;
     }
 }
@@ -244,12 +325,13 @@ bool DB::UpdateDocument(const bsoncxx::document::value& filter, const bsoncxx::d
  */
 bool DB::DeleteDocument(const bsoncxx::document::value& filter, const std::string& db, const std::string& col)
 {
-    if (!CLIENT_IS_VALID)
+    ScopedClient client;
+    if (!client.IsValid())
     {
         return false;
     }
     bsoncxx::stdx::optional<mongocxx::result::delete_result> r =
-        CLIENT.database(db).collection(col).delete_one(filter.view());
+        client->database(db).collection(col).delete_one(filter.view());
 
     // If the std::optional returned by the database is valid:
     if (r)
@@ -264,40 +346,742 @@ bool DB::DeleteDocument(const bsoncxx::document::value& filter, const std::strin
 }
 
 /**
- * @brief   Check if the current client has write privileges in the database.
- *          This is accomplished by attempting to add a temporary document
- *          in the database then deleting it. If the client has the rights to do that,
- *          the operation will succeed, otherwise, an exception will be thrown.
- * @param   db: The database to verify the client's privileges in.
- * @return  True if the Client has write privileges, false otherwise.
+ * @brief   Create a BulkWriter for a collection.
+ * @param   db: The database to write in.
+ * @param   col: The collection to write in.
+ * @param   ordered: If true, the writes are made in order and the first refused stops the rest.
+ * @param   batchSize: The number of writes sent in a single round trip.
+ * @param   autoFlush: If true, a batch is sent as soon as it is full.
+ *                     Otherwise, nothing is sent until BulkWriter::Flush is called.
  */
-bool DB::HasUserWritePrivileges(const std::string& db)
+DB::BulkWriter::BulkWriter(const std::string& db, const std::string& col, bool ordered,
+                           size_t batchSize, bool autoFlush) :
+    m_db(db), m_col(col), m_ordered(ordered), m_batchSize(std::max(batchSize, size_t(1))), m_autoFlush(autoFlush)
+{
+}
+
+/**
+ * @brief   Queue the insertion of a document.
+ * @param   doc: The document to insert.
+ * @retval  The index of the write.
+ */
+size_t DB::BulkWriter::Insert(const bsoncxx::document::value& doc)
+{
+    return Append(Type::Insert, bsoncxx::document::value({}), doc);
+}
+
+/**
+ * @brief   Queue the update of the first document that matches the filter.
+ *          The write is only DB::BulkStatus::Done if a document matched.
+ * @param   filter: The filter to use to find the document to update.
+ * @param   doc: The update to apply on the document.
+ * @retval  The index of the write.
+ */
+size_t DB::BulkWriter::Update(const bsoncxx::document::value& filter, const bsoncxx::document::value& doc)
+{
+    return Append(Type::Update, filter, doc);
+}
+
+/**
+ * @brief   Queue the update of the first document that matches the filter, inserting it if none does.
+ * @param   filter: The filter to use to find the document to update.
+ * @param   doc: The update to apply on the document.
+ * @retval  The index of the write.
+ */
+size_t DB::BulkWriter::Upsert(const bsoncxx::document::value& filter, const bsoncxx::document::value& doc)
+{
+    return Append(Type::Upsert, filter, doc);
+}
+
+/**
+ * @brief   Queue the deletion of the first document that matches the filter.
+ *          The write is only DB::BulkStatus::Done if a document was deleted.
+ * @param   filter: The filter to use to find the document to delete.
+ * @retval  The index of the write.
+ */
+size_t DB::BulkWriter::Delete(const bsoncxx::document::value& filter)
+{
+    return Append(Type::Delete, filter, bsoncxx::document::value({}));
+}
+
+/**
+ * @brief   Send every write not sent yet, `batchSize` at a time.
+ * @param   None
+ * @retval  True if every write queued so far was made, including those sent automatically, false otherwise.
+ */
+bool DB::BulkWriter::Flush()
+{
+    bool r = true;
+    for (size_t first = 0; first < m_pending.size(); first += m_batchSize)
+    {
+        size_t last = std::min(first + m_batchSize, m_pending.size());
+        // If a write of an ordered batch was refused, the following batches aren't sent either.
+        if (m_stopped == true)
+        {
+            r = false;
+            std::fill(m_statuses.begin() + (m_firstPending + first), m_statuses.begin() + (m_firstPending + last),
+                      BulkStatus::Failed);
+            continue;
+        }
+        r = SendBatch(first, last) && r;
+    }
+
+    m_firstPending += m_pending.size();
+    m_pending.clear();
+    m_isAllDone = m_isAllDone && r;
+    return m_isAllDone;
+}
+
+/**
+ * @brief   Queue a write, sending the batch if it is full and the BulkWriter flushes automatically.
+ * @param   type: The kind of write.
+ * @param   filter: The filter of the write, empty for an insertion.
+ * @param   doc: The document of the write, empty for a deletion.
+ * @retval  The index of the write.
+ */
+size_t DB::BulkWriter::Append(Type type, const bsoncxx::document::value& filter, const bsoncxx::document::value& doc)
+{
+    size_t index = m_statuses.size();
+    // If an earlier write was refused in ordered mode, this one won't be attempted.
+    // Nothing is pending since, the write is simply skipped.
+    if (m_stopped == true)
+    {
+        m_statuses.push_back(BulkStatus::Failed);
+        m_firstPending = m_statuses.size();
+        m_isAllDone = false;
+        return index;
+    }
+    m_pending.push_back({ type, filter, doc });
+    m_statuses.push_back(BulkStatus::Pending);
+
+    if (m_autoFlush == true && m_pending.size() >= m_batchSize)
+    {
+        Flush();
+    }
+    return index;
+}
+
+/**
+ * @brief   Send some of the pending writes as a single mongocxx::bulk_write.
+ * @param   first: The position in `m_pending` of the first write to send.
+ * @param   last: The position in `m_pending` past the last write to send.
+ * @retval  True if every write was made, false otherwise.
+ */
+bool DB::BulkWriter::SendBatch(size_t first, size_t last)
 {
-    if (!CLIENT_IS_VALID)
+    ScopedClient client;
+    if (!client.IsValid())
     {
+        m_error = "No connection available";
+        std::fill(m_statuses.begin() + (m_firstPending + first), m_statuses.begin() + (m_firstPending + last),
+                  BulkStatus::Failed);
+        m_stopped = m_ordered;
         return false;
     }
 
-    using namespace bsoncxx::builder::stream;
     try
     {
-        // Make a dummy document.
-        auto builder = document{};
-        bsoncxx::document::value doc = builder
-            << "field1" << "Value1"
-            << finalize;
-        // Try to add it to the database then deleting it.
-        InsertDocument(doc, DATABASE, "privilegesVerification");
-        DeleteDocument(doc, DATABASE, "privilegesVerification");
+        mongocxx::options::bulk_write options;
+        options.ordered(m_ordered);
+        mongocxx::bulk_write bulk = (*client)[m_db][m_col].create_bulk_write(options);
+        for (size_t i = first; i < last; i++)
+        {
+            const Operation& op = m_pending[i];
+            switch (op.type)
+            {
+                case Type::Insert:
+                    bulk.append(mongocxx::model::insert_one(op.doc.view()));
+                    break;
+                case Type::Update:
+                    bulk.append(mongocxx::model::update_one(op.filter.view(), op.doc.view()));
+                    break;
+                case Type::Upsert:
+                    bulk.append(mongocxx::model::update_one(op.filter.view(), op.doc.view()).upsert(true));
+                    break;
+                case Type::Delete:
+                    bulk.append(mongocxx::model::delete_one(op.filter.view()));
+                    break;
+            }
+        }
+
+        bsoncxx::stdx::optional<mongocxx::result::bulk_write> r = bulk.execute();
+        // If the write concern doesn't ask for an acknowledgement, there's no telling what happened.
+        if (!r)
+        {
+            std::fill(m_statuses.begin() + (m_firstPending + first), m_statuses.begin() + (m_firstPending + last),
+                      BulkStatus::Unconfirmed);
+            return false;
+        }
+        MapResults(first, last, int64_t(r.value().matched_count()) + r.value().upserted_count(),
+                   r.value().deleted_count(), {});
+    }
+    catch (const mongocxx::bulk_write_exception & e)
+    {
+        m_error = e.what();
+        m_errorCode = e.code().value();
+
+        // The reply of the server says which writes were refused and how many of the others matched.
+        std::vector<size_t> refused;
+        int64_t matched = 0;
+        int64_t deleted = 0;
+        if (e.raw_server_error())
+        {
+            bsoncxx::document::view reply = e.raw_server_error().value().view();
+            auto getCount = [&reply](const char* key) -> int64_t
+            {
+                bsoncxx::document::element el = reply[key];
+                if (el.raw() == nullptr)
+                {
+                    return 0;
+                }
+                return el.type() == bsoncxx::type::k_int64 ? el.get_int64().value : el.get_int32().value;
+            };
+            matched = getCount("nMatched") + getCount("nUpserted");
+            deleted = getCount("nRemoved");
+
+            bsoncxx::document::element errors = reply["writeErrors"];
+            if (errors.raw() != nullptr && errors.type() == bsoncxx::type::k_array)
+            {
+                for (const bsoncxx::array::element& error : errors.get_array().value)
+                {
+                    refused.push_back(first + size_t(error["index"].get_int32().value));
+                }
+            }
+        }
+        // If the server didn't say, consider everything refused.
+        if (refused.empty())
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                refused.push_back(i);
+            }
+        }
+        MapResults(first, last, matched, deleted, refused);
+        // Only a write refused stops an ordered BulkWriter, not one that merely didn't match.
+        m_stopped = m_ordered;
+    }
+    catch (const mongocxx::exception & e)
+    {
+        m_error = e.what();
+        m_errorCode = e.code().value();
+        std::fill(m_statuses.begin() + (m_firstPending + first), m_statuses.begin() + (m_firstPending + last),
+                  BulkStatus::Failed);
+        m_stopped = m_ordered;
+        return false;
+    }
+
+    return std::all_of(m_statuses.begin() + (m_firstPending + first), m_statuses.begin() + (m_firstPending + last),
+                       [](BulkStatus status) { return status == BulkStatus::Done; });
+}
+
+/**
+ * @brief   Find out what became of each write of a batch from the counts returned by the server.
+ *          The server only counts the documents matched, so if fewer matched than there were updates,
+ *          every update of the batch is unconfirmed. Same goes for the deletions.
+ * @param   first: The position in `m_pending` of the first write of the batch.
+ * @param   last: The position in `m_pending` past the last write of the batch.
+ * @param   matched: The number of documents matched or upserted by the updates.
+ * @param   deleted: The number of documents deleted.
+ * @param   refused: The positions in `m_pending` of the writes refused by the server.
+ * @retval  None
+ */
+void DB::BulkWriter::MapResults(size_t first, size_t last, int64_t matched, int64_t deleted,
+                                const std::vector<size_t>& refused)
+{
+    // In ordered mode, nothing is attempted past the first write refused.
+    size_t end = last;
+    if (m_ordered == true && !refused.empty())
+    {
+        end = *std::min_element(refused.begin(), refused.end());
+    }
+
+    int64_t updates = 0;
+    int64_t deletes = 0;
+    for (size_t i = first; i < end; i++)
+    {
+        if (std::find(refused.begin(), refused.end(), i) != refused.end())
+        {
+            continue;
+        }
+        updates += (m_pending[i].type == Type::Update || m_pending[i].type == Type::Upsert) ? 1 : 0;
+        deletes += (m_pending[i].type == Type::Delete) ? 1 : 0;
+    }
+
+    for (size_t i = first; i < last; i++)
+    {
+        BulkStatus& status = m_statuses[m_firstPending + i];
+        if (i >= end || std::find(refused.begin(), refused.end(), i) != refused.end())
+        {
+            status = BulkStatus::Failed;
+        }
+        else if (m_pending[i].type == Type::Insert)
+        {
+            status = BulkStatus::Done;
+        }
+        else if (m_pending[i].type == Type::Delete)
+        {
+            status = deleted >= deletes ? BulkStatus::Done : BulkStatus::Unconfirmed;
+        }
+        else
+        {
+            status = matched >= updates ? BulkStatus::Done : BulkStatus::Unconfirmed;
+        }
+    }
+}
+
+/**
+ * @brief   Get the documents of a collection that were written since a given time, tombstones included.
+ *          To be sure not to miss any write, a few seconds before `since` are included too.
+ * @param   db: The database to get the collection from.
+ * @param   col: The collection to query.
+ * @param   since: The high-water mark of the last synchronization.
+ * @retval  A cursor on the documents, or an empty std::optional if the query failed.
+ */
+bsoncxx::stdx::optional<DB::Cursor> DB::GetDocumentsChangedSince(const std::string& db,
+                                                                 const std::string& col,
+                                                                 const bsoncxx::types::b_timestamp& since)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::types::b_timestamp from = since;
+    // Go back a little, without going before the epoch.
+    if (from.timestamp > DELTA_SYNC_OVERLAP_S)
+    {
+        from.timestamp -= DELTA_SYNC_OVERLAP_S;
+    }
+    else
+    {
+        from.timestamp = 0;
+    }
+    from.increment = 0;
+
+    return GetAllDocuments(db, col, make_document(kvp(FIELD_UPDATED_AT, make_document(kvp("$gte", from)))));
+}
+
+/**
+ * @brief   Fetch the documents written in a collection since the last synchronization of a cache
+ *          and hand them over to the cache. This is used instead of the change streams when the
+ *          server doesn't support them.
+ * @param   db: The database to search in.
+ * @param   col: The collection to search in.
+ * @param   state: Where the cache stands, updated with what was read.
+ * @param   onUpsert: Called with each document that was created or modified, and its ObjectId.
+ * @param   onDelete: Called with the ObjectId of each document that was deleted.
+ * @retval  False if the cache wasn't synchronized for so long that some deletions might have been purged,
+ *          in which case nothing was read and the cache must be reloaded. True otherwise.
+ */
+bool DB::SyncChanges(const std::string& db,
+                     const std::string& col,
+                     SyncState& state,
+                     const std::function<void(const bsoncxx::document::view&, const std::string&)>& onUpsert,
+                     const std::function<void(const std::string&)>& onDelete)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    // Half of the retention leaves plenty of room for the clocks of the clients and the server to disagree.
+    if (now - state.lastSync > std::chrono::seconds(TOMBSTONE_RETENTION_S / 2))
+    {
+        return false;
+    }
+
+    bsoncxx::stdx::optional<DB::Cursor> docs = GetDocumentsChangedSince(db, col, state.mark);
+    if (!docs)
+    {
         return true;
     }
-    catch (std::exception)
+
+    // The documents don't come in the order they were written. The mark only moves once they're all read,
+    // otherwise an error midway could leave older documents that weren't read yet behind it.
+    bsoncxx::types::b_timestamp mark = state.mark;
+    try
     {
-        // An exception is thrown if the user doesn't have the required permissions.
+        // For each document written since the last synchronization:
+        for (const bsoncxx::document::view& doc : docs.value())
+        {
+            UpdateHighWaterMark(doc, mark);
+
+            bsoncxx::document::element el = doc["_id"];
+            if (el.raw() == nullptr || el.type() != bsoncxx::type::k_oid)
+            {
+                continue;
+            }
+            std::string oid = el.get_oid().value.to_string();
+
+            // If it is a tombstone, the document has been deleted.
+            if (IsDeleted(doc))
+            {
+                onDelete(oid);
+            }
+            else
+            {
+                onUpsert(doc, oid);
+            }
+        }
+        state.mark = mark;
+        state.lastSync = now;
+    }
+    catch (const mongocxx::query_exception & e)
+    {
+        Logging::System.Error("An error occurred when synchronizing \"" + col + "\": ", e.what());
+    }
+    return true;
+}
+
+/**
+ * @brief   Get a collection ready to be synchronized with DB::SyncChanges: have the server index
+ *          the write times, making the synchronizations cheap, and purge the old tombstones.
+ *          This is done on a best-effort basis, a user without the privileges simply skips it.
+ * @param   db: The database of the collection.
+ * @param   col: The collection.
+ * @retval  None
+ */
+void DB::PrepareSync(const std::string& db, const std::string& col)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    CreateIndex(make_document(kvp(FIELD_UPDATED_AT, 1)), db, col);
+    PurgeTombstones(db, col);
+}
+
+/**
+ * @brief   Delete the tombstones older than TOMBSTONE_RETENTION_S.
+ *          Every cache synchronized since then has already learned about these deletions.
+ * @param   db: The database of the collection.
+ * @param   col: The collection to purge.
+ * @retval  True if the purge was done, false otherwise.
+ */
+bool DB::PurgeTombstones(const std::string& db, const std::string& col)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    ScopedClient client;
+    if (!client.IsValid())
+    {
+        return false;
+    }
+
+    bsoncxx::types::b_timestamp before;
+    before.timestamp = uint32_t(std::time(nullptr) - TOMBSTONE_RETENTION_S);
+    before.increment = 0;
+
+    try
+    {
+        bsoncxx::stdx::optional<mongocxx::result::delete_result> r =
+            (*client)[db][col].delete_many(make_document(kvp(FIELD_DELETED, true),
+                                                         kvp(FIELD_UPDATED_AT, make_document(kvp("$lt", before)))));
+        if (r && r.value().deleted_count() > 0)
+        {
+            Logging::System.Info("Purged " + std::to_string(r.value().deleted_count()) +
+                                 " deleted documents from \"" + col + "\"");
+        }
+        return true;
+    }
+    catch (const mongocxx::exception & e)
+    {
+        // Most likely a user without the privilege to do so.
+        Logging::System.Info("Unable to purge the deleted documents of \"" + col + "\": ", e.what());
+        return false;
+    }
+}
+
+/**
+ * @brief   Create an index on a collection, if it doesn't already exist.
+ *          Failing to do so is not an error, queries just get slower.
+ * @param   keys: The fields to index.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to create the index on.
+ * @retval  True if the index exists, false otherwise.
+ */
+bool DB::CreateIndex(const bsoncxx::document::value& keys, const std::string& db, const std::string& col)
+{
+    ScopedClient client;
+    if (!client.IsValid())
+    {
+        return false;
+    }
+
+    try
+    {
+        (*client)[db][col].create_index(keys.view());
+        return true;
+    }
+    catch (const mongocxx::exception & e)
+    {
+        // Most likely a user without the privilege to do so.
+        Logging::System.Info("Unable to create an index on \"" + col + "\": ", e.what());
         return false;
     }
 }
 
+/**
+ * @brief   Atomically reserve the next values of a sequence kept by the server.
+ *          Since the server hands out the values, no two clients ever get the same one.
+ * @param   name: The name of the sequence. It is created if it doesn't exist.
+ * @param   count: How many consecutive values to reserve.
+ * @param   floor: The sequence is first brought up to at least this value, so that it never hands out
+ *                 values that are already used (e.g. by documents created before the sequence existed).
+ * @param   db: The database to do the action in.
+ * @retval  The first reserved value, -1 if the reservation failed.
+ *          Example: Reserving 1000 values returns 42 -> 42 to 1041 are reserved.
+ */
+int DB::ReserveSequence(const std::string& name, int count, int floor, const std::string& db)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_array;
+    using bsoncxx::builder::basic::make_document;
+
+    ScopedClient client;
+    if (!client.IsValid() || count < 1)
+    {
+        return -1;
+    }
+
+    try
+    {
+        int last = -1;
+        try
+        {
+            // seq = max(seq, floor) + count, in a single update. $max and $inc can't touch the same field
+            // in a regular update, but they can in an aggregation pipeline (MongoDB 4.2+).
+            bsoncxx::document::value next =
+                make_document(kvp("$add", make_array(make_document(kvp("$max", make_array(
+                    make_document(kvp("$ifNull", make_array("$" FIELD_SEQUENCE, 0))), floor))), count)));
+            // This version of mongocxx can't send a pipeline to find_one_and_update, so the command is sent as is.
+            bsoncxx::document::value command =
+                make_document(kvp("findAndModify", COUNTERS_COLLECTION),
+                              kvp("query", make_document(kvp("_id", name))),
+                              kvp("update", make_array(make_document(kvp("$set",
+                                                                         make_document(kvp(FIELD_SEQUENCE, next)))))),
+                              kvp("upsert", true),
+                              kvp("new", true));
+            bsoncxx::document::value reply = (*client)[db].run_command(command.view());
+
+            bsoncxx::document::element doc = reply.view()["value"];
+            if (doc.raw() == nullptr || doc.type() != bsoncxx::type::k_document)
+            {
+                return -1;
+            }
+            last = ReadSequence(doc.get_document().view());
+        }
+        catch (const mongocxx::operation_exception & e)
+        {
+            // If the server is older than MongoDB 4.2, it doesn't take a pipeline as an update:
+            if (e.code().value() != ERROR_CODE_FAILED_TO_PARSE && e.code().value() != ERROR_CODE_TYPE_MISMATCH)
+            {
+                throw;
+            }
+
+            // Fall back to two updates. Bringing the sequence up to `floor` on its own is harmless,
+            // the increment that follows is still atomic.
+            mongocxx::collection collection = (*client)[db][COUNTERS_COLLECTION];
+            mongocxx::options::update upsert;
+            upsert.upsert(true);
+            collection.update_one(make_document(kvp("_id", name)),
+                                  make_document(kvp("$max", make_document(kvp(FIELD_SEQUENCE, floor)))),
+                                  upsert);
+
+            mongocxx::options::find_one_and_update options;
+            options.upsert(true);
+            options.return_document(mongocxx::options::return_document::k_after);
+            bsoncxx::stdx::optional<bsoncxx::document::value> doc =
+                collection.find_one_and_update(make_document(kvp("_id", name)),
+                                               make_document(kvp("$inc", make_document(kvp(FIELD_SEQUENCE, count)))),
+                                               options);
+            if (!doc)
+            {
+                return -1;
+            }
+            last = ReadSequence(doc->view());
+        }
+
+        // The sequence now holds the last reserved value.
+        return last == -1 ? -1 : last - count + 1;
+    }
+    catch (const mongocxx::exception & e)
+    {
+        Logging::System.Error("Unable to reserve a value of the sequence \"" + name + "\": ", e.what());
+        // If the server refused the update, the privileges we have cached are wrong.
+        if (e.code().value() == ERROR_CODE_UNAUTHORIZED)
+        {
+            InvalidatePrivileges();
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief   Add the condition excluding the tombstones to a filter.
+ * @param   filter: The filter to add the condition to.
+ * @retval  The new filter.
+ */
+bsoncxx::document::value DB::ExcludeDeleted(const bsoncxx::document::value& filter)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::builder::basic::document builder = bsoncxx::builder::basic::document{};
+    builder.append(bsoncxx::builder::concatenate(filter.view()));
+    builder.append(kvp(FIELD_DELETED, make_document(kvp("$ne", true))));
+    return builder.extract();
+}
+
+/**
+ * @brief   Make an upsert document creating a document with the fields of `fields`, at revision 1,
+ *          and having the server stamp the time of the write in FIELD_UPDATED_AT.
+ *          If the filter of the upsert matches a document, its fields are left alone:
+ *          only its write time is stamped again and the upsert reports no upserted id.
+ * @param   fields: The fields of the new document.
+ * @retval  The update document.
+ * @note    Build the filter with DB::ExcludeDeleted, so that a tombstone isn't matched:
+ *          the new document is created next to it and the tombstone stays deleted.
+ */
+bsoncxx::document::value DB::MakeStampedInsert(const bsoncxx::document::value& fields)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::builder::basic::document builder = bsoncxx::builder::basic::document{};
+    builder.append(bsoncxx::builder::concatenate(fields.view()));
+    builder.append(kvp(FIELD_DELETED, false));
+    builder.append(kvp(FIELD_REVISION, 1));
+
+    return make_document(kvp("$setOnInsert", builder.extract()),
+                         kvp("$currentDate", make_document(kvp(FIELD_UPDATED_AT,
+                                                               make_document(kvp("$type", "timestamp"))))));
+}
+
+/**
+ * @brief   Make an update document that only touches the fields that differ between two versions
+ *          of a document, and has the server stamp the time of the write in FIELD_UPDATED_AT
+ *          and increment FIELD_REVISION.
+ * @param   from: The document as it was read.
+ * @param   to: The document as it should be.
+ * @param   incFields: Numeric fields that are incremented by their difference instead of set,
+ *                     so that concurrent changes made by other clients add up instead of being lost.
+ * @retval  The update document.
+ */
+bsoncxx::document::value DB::MakeDiffUpdate(const bsoncxx::document::value& from,
+                                            const bsoncxx::document::value& to,
+                                            const std::vector<std::string>& incFields)
+{
+    using bsoncxx::builder::basic::kvp;
+
+    bsoncxx::builder::basic::document set = bsoncxx::builder::basic::document{};
+    bsoncxx::builder::basic::document inc = bsoncxx::builder::basic::document{};
+
+    // For each field of the new version:
+    for (const bsoncxx::document::element& el : to.view())
+    {
+        std::string key = std::string(el.key().data(), el.key().size());
+        bsoncxx::document::element old = from.view()[key];
+
+        // If the field didn't change, leave it alone.
+        if (old.raw() != nullptr && old.get_value() == el.get_value())
+        {
+            continue;
+        }
+
+        bool isInc = std::find(incFields.begin(), incFields.end(), key) != incFields.end();
+        if (isInc && old.raw() != nullptr &&
+            old.type() == bsoncxx::type::k_double && el.type() == bsoncxx::type::k_double)
+        {
+            inc.append(kvp(key, el.get_double().value - old.get_double().value));
+        }
+        else
+        {
+            set.append(kvp(key, el.get_value()));
+        }
+    }
+
+    return MakeStamped(set.view(), inc.view());
+}
+
+/**
+ * @brief   Make an update document turning a document into a tombstone.
+ *          The tombstone is excluded from the reads, but is still returned by
+ *          DB::GetDocumentsChangedSince so that other clients learn about the deletion.
+ * @param   None
+ * @retval  The update document.
+ */
+bsoncxx::document::value DB::MakeTombstone()
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    return make_document(kvp("$set", make_document(kvp(FIELD_DELETED, true))),
+                         kvp("$inc", make_document(kvp(FIELD_REVISION, 1))),
+                         kvp("$currentDate", make_document(kvp(FIELD_UPDATED_AT,
+                                                               make_document(kvp("$type", "timestamp"))))));
+}
+
+/**
+ * @brief   Check if a document is a tombstone.
+ * @param   doc: The document to check.
+ * @retval  True if the document has been deleted, false otherwise.
+ */
+bool DB::IsDeleted(const bsoncxx::document::view& doc)
+{
+    bsoncxx::document::element el = doc[FIELD_DELETED];
+    return el.raw() != nullptr && el.type() == bsoncxx::type::k_bool && el.get_bool().value == true;
+}
+
+/**
+ * @brief   Move the high-water mark forward if the document was written after it.
+ * @param   doc: The document that was read.
+ * @param   mark: The high-water mark to update.
+ * @retval  None
+ */
+void DB::UpdateHighWaterMark(const bsoncxx::document::view& doc, bsoncxx::types::b_timestamp& mark)
+{
+    bsoncxx::document::element el = doc[FIELD_UPDATED_AT];
+    if (el.raw() == nullptr || el.type() != bsoncxx::type::k_timestamp)
+    {
+        return;
+    }
+
+    bsoncxx::types::b_timestamp ts = el.get_timestamp();
+    if (ts.timestamp > mark.timestamp ||
+        (ts.timestamp == mark.timestamp && ts.increment > mark.increment))
+    {
+        mark = ts;
+    }
+}
+
+/**
+ * @brief   Check if the current user has write privileges in the database.
+ *          The privileges are resolved from the server the first time this is called
+ *          after a login, then the cached answer is returned until
+ *          DB::InvalidatePrivileges is called. It is thus cheap enough to be called every frame.
+ * @param   db: The database to verify the user's privileges in.
+ * @return  True if the user has write privileges, false otherwise.
+ */
+bool DB::HasUserWritePrivileges(const std::string& db)
+{
+    // If the privileges are not known for that database:
+    if (arePrivilegesResolved == false || privilegesDb != db)
+    {
+        hasWritePrivileges = ResolveWritePrivileges(db);
+        privilegesDb = db;
+        arePrivilegesResolved = true;
+    }
+
+    return hasWritePrivileges;
+}
+
+/**
+ * @brief   Forget the cached privileges of the user, they will be resolved again
+ *          the next time DB::HasUserWritePrivileges is called.
+ *          To be called when the user changes or when the server refuses an operation.
+ * @param   None
+ * @retval  None
+ */
+void DB::InvalidatePrivileges()
+{
+    arePrivilegesResolved = false;
+}
+
 /**
  * @brief   Authenticate into the database using credentials different than the default ones.
  * @param   username: The username of the new client.
@@ -309,11 +1093,21 @@ bool DB::Login(const std::string& username, const std::string& pwd, const std::s
 {
     isInit = false;
 
+    // The writes still in the queue were made by the previous user, let them complete
+    // and give back their clients before the pool is replaced.
+    WriteQueue::Flush();
+
     // Re-initialize the Client using the new credentials. We don't check the return value
     // because the connection is *always* successful (unless invalid parameters are passed),
     // EVEN IF the credentials are not valid.
     // We must thus use another way to verify the success of the operation.
     Init("mongodb://" + username + ":" + pwd + "@192.168.0.152");
+    ScopedClient client;
+    if (!client.IsValid())
+    {
+        Logging::System.Error("An error occurred on login: ", "No connection available");
+        return false;
+    }
     try
     {
         // To verify if the login was good or not, we send a command to list all the 
@@ -323,7 +1117,7 @@ bool DB::Login(const std::string& username, const std::string& pwd, const std::s
         // only requires read permissions.
         bsoncxx::builder::stream::document ping;
         ping << "listCollections" << 1;
-        auto db = CLIENT[DATABASE];
+        auto db = (*client)[DATABASE];
         auto result = db.run_command(ping.view());
 
         if (result.view()["ok"].get_double() != 1)
@@ -332,6 +1126,8 @@ bool DB::Login(const std::string& username, const std::string& pwd, const std::s
         }
         else
         {
+            // Resolve the privileges of the new user right away rather than during a frame.
+            HasUserWritePrivileges();
             return true;
         }
     }
@@ -341,3 +1137,247 @@ bool DB::Login(const std::string& username, const std::string& pwd, const std::s
         return false;
     }
 }
+
+/**
+ * @brief   Get a sizing parameter of the connection pool from the config file.
+ *          If the field is missing or invalid, it is set to its default value.
+ * @param   key: The key of the field in the config file.
+ * @param   defaultValue: The value to use if the field is missing or invalid.
+ * @retval  The value to use.
+ */
+static int GetPoolSetting(const std::string& key, int defaultValue)
+{
+    int val = Config::GetField<int>(key);
+    // If the field doesn't exist or makes no sense:
+    if (val <= 0)
+    {
+        // Use the default value and save it so that it can be tweaked from Config.json.
+        val = defaultValue;
+        Config::SetField(key, val);
+    }
+    return val;
+}
+
+/**
+ * @brief   Add an option to a mongodb connection string, unless it is already specified in it.
+ * @param   uri: The connection string.
+ * @param   key: The name of the option.
+ * @param   val: The value of the option.
+ * @retval  The connection string with the option.
+ */
+static std::string AppendUriOption(const std::string& uri, const std::string& key, int val)
+{
+    // If the option has already been set by the user, respect it.
+    if (uri.find(key + "=") != std::string::npos)
+    {
+        return uri;
+    }
+
+    std::string separator;
+    if (uri.find('?') != std::string::npos)
+    {
+        // There are already options in the string.
+        separator = "&";
+    }
+    else if (uri.find('/', uri.find("://") + 3) != std::string::npos)
+    {
+        // There is a path (/database) but no option.
+        separator = "?";
+    }
+    else
+    {
+        // There's only the host(s).
+        separator = "/?";
+    }
+
+    return uri + separator + key + "=" + std::to_string(val);
+}
+
+/**
+ * @brief   Ask the server what the current user is allowed to do in the database.
+ *          This uses the `connectionStatus` command, which lists the privileges
+ *          granted by all the roles of the authenticated users.
+ * @param   db: The database to verify the user's privileges in.
+ * @retval  True if the user can insert, update and remove documents in `db`, false otherwise.
+ */
+static bool ResolveWritePrivileges(const std::string& db)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    DB::ScopedClient client;
+    if (!client.IsValid())
+    {
+        return false;
+    }
+
+    try
+    {
+        bsoncxx::document::value status = (*client)["admin"].run_command(
+            make_document(kvp("connectionStatus", 1), kvp("showPrivileges", true)));
+        bsoncxx::document::element authInfo = status.view()["authInfo"];
+        if (authInfo.raw() == nullptr || authInfo.type() != bsoncxx::type::k_document)
+        {
+            return false;
+        }
+
+        // If nobody is authenticated, the server doesn't have access control enabled
+        // (otherwise, we wouldn't have been able to connect). It won't tell us anything,
+        // fall back on checking if we can actually write.
+        bsoncxx::document::element users = authInfo.get_document().value["authenticatedUsers"];
+        if (users.raw() == nullptr || users.type() != bsoncxx::type::k_array ||
+            users.get_array().value.begin() == users.get_array().value.end())
+        {
+            return ProbeWritePrivileges(db);
+        }
+
+        bsoncxx::document::element privileges = authInfo.get_document().value["authenticatedUserPrivileges"];
+        if (privileges.raw() == nullptr || privileges.type() != bsoncxx::type::k_array)
+        {
+            return false;
+        }
+
+        bool canInsert = false;
+        bool canUpdate = false;
+        bool canRemove = false;
+        // For each privilege granted to the user:
+        for (const bsoncxx::array::element& p : privileges.get_array().value)
+        {
+            if (p.type() != bsoncxx::type::k_document)
+            {
+                continue;
+            }
+            bsoncxx::document::element resource = p.get_document().value["resource"];
+            if (resource.raw() == nullptr || resource.type() != bsoncxx::type::k_document)
+            {
+                continue;
+            }
+
+            // The privilege applies to the database if it is for any resource (root), if it is
+            // for the database itself or for any database (an empty string).
+            bool appliesToDb = false;
+            bsoncxx::document::element anyResource = resource.get_document().value["anyResource"];
+            bsoncxx::document::element resourceDb = resource.get_document().value["db"];
+            if (anyResource.raw() != nullptr && anyResource.type() == bsoncxx::type::k_bool)
+            {
+                appliesToDb = anyResource.get_bool().value;
+            }
+            else if (resourceDb.raw() != nullptr && resourceDb.type() == bsoncxx::type::k_utf8)
+            {
+                std::string resDb = resourceDb.get_utf8().value.data();
+                appliesToDb = resDb.empty() || resDb == db;
+            }
+            if (appliesToDb == false)
+            {
+                continue;
+            }
+
+            bsoncxx::document::element actions = p.get_document().value["actions"];
+            if (actions.raw() == nullptr || actions.type() != bsoncxx::type::k_array)
+            {
+                continue;
+            }
+            for (const bsoncxx::array::element& a : actions.get_array().value)
+            {
+                if (a.type() != bsoncxx::type::k_utf8)
+                {
+                    continue;
+                }
+                std::string action = a.get_utf8().value.data();
+                canInsert |= (action == "insert");
+                canUpdate |= (action == "update");
+                canRemove |= (action == "remove");
+            }
+        }
+
+        return canInsert && canUpdate && canRemove;
+    }
+    catch (const mongocxx::exception & e)
+    {
+        Logging::System.Error("An error occurred when resolving the user's privileges: ", e.what());
+        return false;
+    }
+}
+
+/**
+ * @brief   Check if the current client can write in the database.
+ *          This is accomplished by attempting to add a temporary document
+ *          in the database then deleting it. If the client has the rights to do that,
+ *          the operation will succeed, otherwise, an exception will be thrown.
+ * @param   db: The database to verify the client's privileges in.
+ * @retval  True if the client has write privileges, false otherwise.
+ */
+static bool ProbeWritePrivileges(const std::string& db)
+{
+    using namespace bsoncxx::builder::stream;
+    try
+    {
+        // Make a dummy document.
+        auto builder = document{};
+        bsoncxx::document::value doc = builder
+            << "field1" << "Value1"
+            << finalize;
+        // Try to add it to the database then deleting it.
+        DB::InsertDocument(doc, db, "privilegesVerification");
+        DB::DeleteDocument(doc, db, "privilegesVerification");
+        return true;
+    }
+    catch (std::exception)
+    {
+        // An exception is thrown if the user doesn't have the required permissions.
+        return false;
+    }
+}
+
+/**
+ * @brief   Build an update document that sets and increments the given fields,
+ *          clears the tombstone, increments the revision and has the server stamp the time of the write.
+ * @param   set: The fields to set.
+ * @param   inc: The fields to increment.
+ * @retval  The update document.
+ */
+static bsoncxx::document::value MakeStamped(const bsoncxx::document::view& set, const bsoncxx::document::view& inc)
+{
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::builder::basic::document setBuilder = bsoncxx::builder::basic::document{};
+    setBuilder.append(bsoncxx::builder::concatenate(set));
+    setBuilder.append(kvp(FIELD_DELETED, false));
+
+    bsoncxx::builder::basic::document incBuilder = bsoncxx::builder::basic::document{};
+    incBuilder.append(bsoncxx::builder::concatenate(inc));
+    incBuilder.append(kvp(FIELD_REVISION, 1));
+
+    return make_document(kvp("$set", setBuilder.extract()),
+                         kvp("$inc", incBuilder.extract()),
+                         kvp("$currentDate", make_document(kvp(FIELD_UPDATED_AT,
+                                                               make_document(kvp("$type", "timestamp"))))));
+}
+
+/**
+ * @brief   Read the value held by a sequence's document.
+ * @param   doc: The document of the sequence.
+ * @retval  The value of the sequence, -1 if the document doesn't hold one.
+ */
+static int ReadSequence(const bsoncxx::document::view& doc)
+{
+    bsoncxx::document::element el = doc[FIELD_SEQUENCE];
+    if (el.raw() == nullptr)
+    {
+        return -1;
+    }
+    else if (el.type() == bsoncxx::type::k_int32)
+    {
+        return el.get_int32().value;
+    }
+    else if (el.type() == bsoncxx::type::k_int64)
+    {
+        return int(el.get_int64().value);
+    }
+    else if (el.type() == bsoncxx::type::k_double)
+    {
+        return int(el.get_double().value);
+    }
+    return -1;
+}
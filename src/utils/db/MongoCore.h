@@ -23,7 +23,11 @@
  /*****************************************************************************/
  /* Includes */
 
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "utils/db/Mongo.h"
 
 /**
@@ -40,6 +44,102 @@ namespace DB
 #define DATABASE "CEP"
 #endif
 
+/**
+ * @def     DEFAULT_POOL_MAX_SIZE
+ * @brief   Maximum number of connections kept by the pool when Config.json doesn't specify one.
+ */
+#define DEFAULT_POOL_MAX_SIZE           8
+
+/**
+ * @def     DEFAULT_POOL_MIN_SIZE
+ * @brief   Number of idle connections the pool keeps open when Config.json doesn't specify one.
+ */
+#define DEFAULT_POOL_MIN_SIZE           1
+
+/**
+ * @def     DEFAULT_POOL_WAIT_TIMEOUT_MS
+ * @brief   How long, in milliseconds, to wait for a free connection before giving up
+ *          when Config.json doesn't specify it.
+ */
+#define DEFAULT_POOL_WAIT_TIMEOUT_MS    2000
+
+/**
+ * @def     ERROR_CODE_UNAUTHORIZED
+ * @brief   Error code returned by the server when the user isn't allowed to do an operation.
+ */
+#define ERROR_CODE_UNAUTHORIZED         13
+
+/**
+ * @def     ERROR_CODE_ILLEGAL_OPERATION
+ * @brief   Error code returned by a standalone server when asked to start a transaction.
+ */
+#define ERROR_CODE_ILLEGAL_OPERATION    20
+
+/**
+ * @def     ERROR_CODE_FAILED_TO_PARSE
+ * @brief   Error code returned by a server older than MongoDB 4.2 when given a pipeline as an update.
+ */
+#define ERROR_CODE_FAILED_TO_PARSE      9
+
+/**
+ * @def     ERROR_CODE_TYPE_MISMATCH
+ * @brief   Error code returned by some servers older than MongoDB 4.2 when given a pipeline as an update.
+ */
+#define ERROR_CODE_TYPE_MISMATCH        14
+
+/**
+ * @def     FIELD_UPDATED_AT
+ * @brief   Timestamp stamped by the server on every document written through DB::MakeStampedInsert,
+ *          DB::MakeDiffUpdate or DB::MakeTombstone. Used to only fetch what changed since the last synchronization.
+ */
+#define FIELD_UPDATED_AT                "updatedAt"
+
+/**
+ * @def     FIELD_DELETED
+ * @brief   Set to true on deleted documents. They are kept as tombstones so that the deletion
+ *          can be picked up by DB::GetDocumentsChangedSince, until DB::PurgeTombstones removes them.
+ */
+#define FIELD_DELETED                   "deleted"
+
+/**
+ * @def     FIELD_REVISION
+ * @brief   Starts at 1 with DB::MakeStampedInsert and is incremented by the server on every write done through
+ *          DB::MakeDiffUpdate or DB::MakeTombstone. Used to detect that a document was modified by someone else.
+ */
+#define FIELD_REVISION                  "revision"
+
+/**
+ * @def     DELTA_SYNC_OVERLAP_S
+ * @brief   How far back, in seconds, before the high-water mark DB::GetDocumentsChangedSince looks.
+ *          This catches the writes stamped just before the mark but committed after it was read.
+ */
+#define DELTA_SYNC_OVERLAP_S            2
+
+/**
+ * @def     TOMBSTONE_RETENTION_S
+ * @brief   How long, in seconds, the tombstones are kept before DB::PurgeTombstones removes them.
+ *          A cache that wasn't synchronized for half of that time is reloaded instead, see DB::SyncChanges.
+ */
+#define TOMBSTONE_RETENTION_S           (7 * 24 * 60 * 60)
+
+/**
+ * @def     COUNTERS_COLLECTION
+ * @brief   Collection holding the sequences used by DB::ReserveSequence, one document per sequence.
+ */
+#define COUNTERS_COLLECTION             "Counters"
+
+/**
+ * @def     FIELD_SEQUENCE
+ * @brief   Last value handed out by a sequence of the counters collection.
+ */
+#define FIELD_SEQUENCE                  "seq"
+
+/**
+ * @def     DEFAULT_BULK_BATCH_SIZE
+ * @brief   Number of writes a DB::BulkWriter sends in a single round trip.
+ */
+#define DEFAULT_BULK_BATCH_SIZE         1000
+
 /*****************************************************************************/
 /* Exported macro */
 
@@ -47,6 +147,226 @@ namespace DB
 /*****************************************************************************/
 /* Exported types */
 
+/**
+ * @class   ScopedClient
+ * @brief   A handle on a mongocxx::client borrowed from the connection pool.
+ *          The client is given back to the pool when the handle is destroyed.
+ *
+ *          A mongocxx::client must never be used by two threads at the same time,
+ *          so each thread borrows its own. If a thread already holds a client further
+ *          up the stack, the new handle shares it instead of taking a second connection.
+ *
+ * @note    A ScopedClient must be destroyed by the thread that created it.
+ */
+class ScopedClient
+{
+public:
+    ScopedClient();
+    ScopedClient(ScopedClient&& other) noexcept;
+    ScopedClient(const ScopedClient&) = delete;
+    ScopedClient& operator=(const ScopedClient&) = delete;
+    ScopedClient& operator=(ScopedClient&&) = delete;
+    ~ScopedClient();
+
+    /**
+     * Check if a client could be acquired from the pool.
+     */
+    inline bool IsValid() const
+    {
+        return m_client != nullptr;
+    }
+
+    inline mongocxx::client& operator*() const
+    {
+        return *m_client;
+    }
+
+    inline mongocxx::client* operator->() const
+    {
+        return m_client;
+    }
+
+private:
+    //! The pool entry, only engaged if this handle is the one that acquired the client.
+    bsoncxx::stdx::optional<mongocxx::pool::entry> m_entry;
+    //! The client to use, owned or not.
+    mongocxx::client* m_client = nullptr;
+};
+
+/**
+ * @class   Cursor
+ * @brief   A mongocxx::cursor bundled with the pooled client it reads from,
+ *          so that the connection stays borrowed for as long as the cursor is iterated.
+ */
+class Cursor
+{
+public:
+    Cursor(ScopedClient&& client, mongocxx::cursor&& cursor) :
+        m_client(std::move(client)), m_cursor(std::move(cursor))
+    {
+    }
+
+    inline mongocxx::cursor::iterator begin()
+    {
+        return m_cursor.begin();
+    }
+
+    inline mongocxx::cursor::iterator end()
+    {
+        return m_cursor.end();
+    }
+
+private:
+    // Declaration order matters: the cursor must be destroyed before its client.
+    ScopedClient m_client;
+    mongocxx::cursor m_cursor;
+};
+
+/**
+ * @struct  SyncState
+ * @brief   Where a cache stands in the synchronization with its collection, see DB::SyncChanges.
+ *          Reset it when the cache is reloaded.
+ */
+struct SyncState
+{
+    //! The most recent write time seen in the collection.
+    bsoncxx::types::b_timestamp mark = { 0, 0 };
+    //! When the cache was last loaded or synchronized.
+    std::chrono::steady_clock::time_point lastSync = std::chrono::steady_clock::now();
+};
+
+/**
+ * @enum    BulkStatus
+ * @brief   What became of a write queued in a DB::BulkWriter.
+ */
+enum class BulkStatus
+{
+    Pending = 0,    /*!< Not sent to the database yet */
+    Done,           /*!< Made by the database */
+    Failed,         /*!< Refused by the database, or not attempted because an earlier write of an ordered batch was */
+    Unconfirmed,    /*!< Some writes of its batch didn't match a document, but the database doesn't say which */
+};
+
+/**
+ * @class   BulkWriter
+ * @brief   Accumulates the writes made to a collection and sends them as mongocxx::bulk_write batches,
+ *          a single round trip for up to `batchSize` writes.
+ *
+ *          Each write is given an index, used to get what became of it with BulkWriter::GetStatus.
+ *          In ordered mode, the writes are made one after the other and the first one refused
+ *          stops the rest, including those queued afterwards. A write that didn't match a document
+ *          isn't refused and doesn't stop anything. In unordered mode, the server makes all it can, in any order.
+ *
+ * @note    Nothing is logged, so that the writes can be sent from any thread.
+ *          A BulkWriter must not be used by two threads at the same time.
+ */
+class BulkWriter
+{
+public:
+    BulkWriter(const std::string& db, const std::string& col, bool ordered = true,
+               size_t batchSize = DEFAULT_BULK_BATCH_SIZE, bool autoFlush = true);
+
+    size_t Insert(const bsoncxx::document::value& doc);
+    size_t Update(const bsoncxx::document::value& filter, const bsoncxx::document::value& doc);
+    size_t Upsert(const bsoncxx::document::value& filter, const bsoncxx::document::value& doc);
+    size_t Delete(const bsoncxx::document::value& filter);
+    bool Flush();
+
+    /**
+     * Get the database the writes are made in.
+     */
+    inline const std::string& GetDb() const
+    {
+        return m_db;
+    }
+
+    /**
+     * Get the collection the writes are made in.
+     */
+    inline const std::string& GetCol() const
+    {
+        return m_col;
+    }
+
+    /**
+     * Get the number of writes queued since the creation of the BulkWriter, sent or not.
+     */
+    inline size_t GetCount() const
+    {
+        return m_statuses.size();
+    }
+
+    /**
+     * Get what became of a write, by the index returned when it was queued.
+     */
+    inline BulkStatus GetStatus(size_t index) const
+    {
+        return m_statuses.at(index);
+    }
+
+    /**
+     * Get the reason of the last failure, empty if there was none.
+     */
+    inline const std::string& GetError() const
+    {
+        return m_error;
+    }
+
+    /**
+     * Get the error code returned by the server with the last failure, 0 if there was none.
+     */
+    inline int GetErrorCode() const
+    {
+        return m_errorCode;
+    }
+
+private:
+    /**
+     * @enum    Type
+     * @brief   The kind of write.
+     */
+    enum class Type
+    {
+        Insert = 0,
+        Update,
+        Upsert,
+        Delete,
+    };
+
+    /**
+     * @struct  Operation
+     * @brief   A write waiting to be sent.
+     */
+    struct Operation
+    {
+        Type type;
+        bsoncxx::document::value filter;
+        bsoncxx::document::value doc;
+    };
+
+    size_t Append(Type type, const bsoncxx::document::value& filter, const bsoncxx::document::value& doc);
+    bool SendBatch(size_t first, size_t last);
+    void MapResults(size_t first, size_t last, int64_t matched, int64_t deleted,
+                    const std::vector<size_t>& refused);
+
+    std::string m_db;
+    std::string m_col;
+    bool m_ordered = true;
+    size_t m_batchSize = DEFAULT_BULK_BATCH_SIZE;
+    bool m_autoFlush = true;
+    //! In ordered mode, set once a write was refused. Nothing is sent from then on.
+    bool m_stopped = false;
+    //! Cleared once a write wasn't made, be it refused or unconfirmed.
+    bool m_isAllDone = true;
+
+    //! The writes not sent yet. The first one has the index `m_firstPending`.
+    std::vector<Operation> m_pending;
+    size_t m_firstPending = 0;
+    //! What became of every write, by index.
+    std::vector<BulkStatus> m_statuses;
+    std::string m_error = "";
+    int m_errorCode = 0;
+};
 
 /*****************************************************************************/
 /* Exported functions */
@@ -54,13 +374,13 @@ namespace DB
 bool Init(const std::string& host = "mongodb://localhost:27017",
           const mongocxx::options::client& options = mongocxx::options::client());
 
-bsoncxx::document::view GetDocument(const std::string& db = "",
-                                    const std::string& col = "",
-                                    const bsoncxx::document::value& filter = bsoncxx::document::value({}));
-bsoncxx::stdx::optional<mongocxx::cursor>  GetAllDocuments(std::string db = "",
-                                                           std::string col = "",
-                                                           const bsoncxx::document::value& filter =
-                                                           bsoncxx::document::value({}));
+bsoncxx::document::value GetDocument(const std::string& db = "",
+                                     const std::string& col = "",
+                                     const bsoncxx::document::value& filter = bsoncxx::document::value({}));
+bsoncxx::stdx::optional<Cursor> GetAllDocuments(std::string db = "",
+                                                std::string col = "",
+                                                const bsoncxx::document::value& filter =
+                                                bsoncxx::document::value({}));
 bool InsertDocument(const bsoncxx::document::value& doc,
                     const std::string& db = "",
                     const std::string& col = "");
@@ -72,7 +392,30 @@ bool DeleteDocument(const bsoncxx::document::value& filter = bsoncxx::document::
                     const std::string& db = "",
                     const std::string& col = "");
 
-bool HasUserWritePrivileges(const std::string& db = "admin");
+bsoncxx::stdx::optional<Cursor> GetDocumentsChangedSince(const std::string& db,
+                                                         const std::string& col,
+                                                         const bsoncxx::types::b_timestamp& since);
+bool SyncChanges(const std::string& db,
+                 const std::string& col,
+                 SyncState& state,
+                 const std::function<void(const bsoncxx::document::view&, const std::string&)>& onUpsert,
+                 const std::function<void(const std::string&)>& onDelete);
+void PrepareSync(const std::string& db, const std::string& col);
+bool PurgeTombstones(const std::string& db, const std::string& col);
+bool CreateIndex(const bsoncxx::document::value& keys, const std::string& db, const std::string& col);
+int ReserveSequence(const std::string& name, int count = 1, int floor = 0, const std::string& db = DATABASE);
+
+bsoncxx::document::value ExcludeDeleted(const bsoncxx::document::value& filter = bsoncxx::document::value({}));
+bsoncxx::document::value MakeStampedInsert(const bsoncxx::document::value& fields);
+bsoncxx::document::value MakeDiffUpdate(const bsoncxx::document::value& from,
+                                        const bsoncxx::document::value& to,
+                                        const std::vector<std::string>& incFields = {});
+bsoncxx::document::value MakeTombstone();
+bool IsDeleted(const bsoncxx::document::view& doc);
+void UpdateHighWaterMark(const bsoncxx::document::view& doc, bsoncxx::types::b_timestamp& mark);
+
+bool HasUserWritePrivileges(const std::string& db = DATABASE);
+void InvalidatePrivileges();
 bool Login(const std::string& username, const std::string& pwd, const std::string& authDb = "admin");
 }
 /* Have a wonderful day :) */
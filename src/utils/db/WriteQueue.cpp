@@ -0,0 +1,621 @@
+﻿#include "WriteQueue.h"
+#include "utils/db/MongoCore.h"
+#include "utils/Config.h"
+#include "utils/Redraw.h"
+#include "widgets/Logger.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DB
+{
+namespace WriteQueue
+{
+/**
+ * @enum    WriteType
+ * @brief   The kind of operation a queued write does.
+ */
+enum class WriteType
+{
+    Insert = 0,
+    Update,
+    UpdateAll,
+    Bulk,
+    Create,
+    Upsert,
+    Delete,
+};
+
+/**
+ * @struct  Write
+ * @brief   A write waiting to be executed by a worker.
+ */
+struct Write
+{
+    Write(WriteType t, const bsoncxx::document::value& f, const bsoncxx::document::value& d,
+          const std::string& database, const std::string& collection, Callback cb) :
+        type(t), filter(f), doc(d), db(database), col(collection), callback(cb)
+    {
+    }
+
+    WriteType type;
+    bsoncxx::document::value filter;
+    bsoncxx::document::value doc;
+    std::vector<Change> changes;
+    std::shared_ptr<BulkWriter> bulk;
+    std::string db;
+    std::string col;
+    Callback callback;
+    CreateCallback createCallback;
+    //! The ObjectId of the document created by a WriteType::Create, set once it is executed.
+    std::string oid;
+    std::promise<bool> promise;
+};
+
+/**
+ * @struct  Completion
+ * @brief   The outcome of a write, waiting to be reported on the UI thread.
+ */
+struct Completion
+{
+    Callback callback;
+    CreateCallback createCallback;
+    std::string oid;
+    bool result;
+    std::string col;
+    std::string error;
+    int errorCode;
+};
+
+static std::future<bool> Enqueue(std::unique_ptr<Write> write);
+static void WorkerLoop(size_t id);
+static bool Execute(Write& write, std::string& error, int& errorCode);
+static bool ExecuteAll(mongocxx::client& client, Write& write);
+static bool ExecuteInOrder(mongocxx::collection& collection, const Write& write);
+
+// One queue per worker. A collection is always handled by the same worker,
+// which keeps the writes done on a document in the order they were queued.
+static std::vector<std::deque<std::unique_ptr<Write>>> queues;
+static std::vector<std::thread> workers;
+// Protects `queues`, `pending` and `stopRequested`.
+static std::mutex queueMutex;
+static std::condition_variable workAvailable;
+static std::condition_variable spaceAvailable;
+static std::condition_variable allDone;
+// Number of writes queued or being executed.
+static size_t pending = 0;
+static size_t maxDepth = DEFAULT_WRITE_QUEUE_DEPTH;
+static bool stopRequested = false;
+
+// Protects `completions`.
+static std::mutex completionMutex;
+static std::vector<Completion> completions;
+}
+}
+
+using namespace DB::WriteQueue;
+
+/**
+ * @brief   Start the workers of the write queue.
+ *          The number of workers and the depth of the queue are taken from Config.json.
+ * @param   None
+ * @retval  None
+ */
+void DB::WriteQueue::Init()
+{
+    if (!workers.empty())
+    {
+        return;
+    }
+
+    int workerCount = Config::GetField<int>("DbWriteWorkers");
+    if (workerCount <= 0)
+    {
+        workerCount = DEFAULT_WRITE_WORKERS;
+        Config::SetField("DbWriteWorkers", workerCount);
+    }
+    int depth = Config::GetField<int>("DbWriteQueueDepth");
+    if (depth <= 0)
+    {
+        depth = DEFAULT_WRITE_QUEUE_DEPTH;
+        Config::SetField("DbWriteQueueDepth", depth);
+    }
+
+    maxDepth = size_t(depth);
+    stopRequested = false;
+    queues.resize(size_t(workerCount));
+    for (size_t i = 0; i < size_t(workerCount); i++)
+    {
+        workers.emplace_back(WorkerLoop, i);
+    }
+}
+
+/**
+ * @brief   Execute every pending write then stop the workers.
+ *          The callbacks of the writes that have not been reported yet are dropped.
+ * @param   None
+ * @retval  None
+ */
+void DB::WriteQueue::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        allDone.wait(lock, [] { return pending == 0; });
+        stopRequested = true;
+    }
+    workAvailable.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+    queues.clear();
+
+    std::lock_guard<std::mutex> lock(completionMutex);
+    completions.clear();
+}
+
+/**
+ * @brief   Block until every queued write has been executed, then report them.
+ * @param   None
+ * @retval  None
+ */
+void DB::WriteQueue::Flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        allDone.wait(lock, [] { return pending == 0; });
+    }
+    Poll();
+}
+
+/**
+ * @brief   Report the writes acknowledged since the last call: log the errors
+ *          and call the callbacks. Must be called from the UI thread.
+ * @param   None
+ * @retval  None
+ */
+void DB::WriteQueue::Poll()
+{
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        done.swap(completions);
+    }
+
+    for (Completion& c : done)
+    {
+        // If the write didn't just miss, but actually failed:
+        if (!c.error.empty())
+        {
+            Logging::System.Error("Unable to write to \"" + c.col + "\": ", c.error);
+        }
+        // If the server refused the write, the privileges we have cached are wrong.
+        if (c.errorCode == ERROR_CODE_UNAUTHORIZED)
+        {
+            DB::InvalidatePrivileges();
+        }
+        if (c.callback)
+        {
+            c.callback(c.result);
+        }
+        if (c.createCallback)
+        {
+            c.createCallback(c.result, c.oid);
+        }
+    }
+}
+
+/**
+ * @brief   Get the number of writes that have not been executed yet.
+ * @param   None
+ * @retval  The number of writes queued or being executed.
+ */
+size_t DB::WriteQueue::GetPendingCount()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return pending;
+}
+
+/**
+ * @brief   Queue the insertion of a document.
+ * @param   doc: The document to insert.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to insert the document into.
+ * @param   callback: Called from DB::WriteQueue::Poll once the insertion is done.
+ * @retval  A future holding true if the insertion succeeded.
+ */
+std::future<bool> DB::WriteQueue::Insert(const bsoncxx::document::value& doc,
+                                         const std::string& db,
+                                         const std::string& col,
+                                         Callback callback)
+{
+    return Enqueue(std::make_unique<Write>(WriteType::Insert, bsoncxx::document::value({}), doc,
+                                           db, col, callback));
+}
+
+/**
+ * @brief   Queue the update of the first document that matches the filter.
+ * @param   filter: The filter to use to find the document to update.
+ * @param   doc: The update to apply on the document.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to do the action in.
+ * @param   callback: Called from DB::WriteQueue::Poll once the update is done.
+ * @retval  A future holding true if a document matched the filter.
+ */
+std::future<bool> DB::WriteQueue::Update(const bsoncxx::document::value& filter,
+                                         const bsoncxx::document::value& doc,
+                                         const std::string& db,
+                                         const std::string& col,
+                                         Callback callback)
+{
+    return Enqueue(std::make_unique<Write>(WriteType::Update, filter, doc, db, col, callback));
+}
+
+/**
+ * @brief   Queue updates that are either all made or not at all, in a single round trip.
+ *          See the note for servers that don't support transactions. Each update is only made if its filter matches a document, which lets the server
+ *          check conditions such as the stock left (e.g. `{ quantity: { $gte: 5 } }`).
+ * @param   changes: The updates to make, in order.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to do the action in.
+ * @param   callback: Called from DB::WriteQueue::Poll once the updates are done.
+ * @retval  A future holding true if every filter matched a document.
+ *
+ * @note    The updates are made in a transaction, which requires a replica set.
+ *          A standalone server gets them as a single ordered bulk write instead: an update whose
+ *          filter doesn't match is skipped, but the others are still made. The caller finds out
+ *          which ones were by reading the documents back.
+ */
+std::future<bool> DB::WriteQueue::UpdateAll(const std::vector<Change>& changes,
+                                            const std::string& db,
+                                            const std::string& col,
+                                            Callback callback)
+{
+    std::unique_ptr<Write> write = std::make_unique<Write>(WriteType::UpdateAll, bsoncxx::document::value({}),
+                                                           bsoncxx::document::value({}), db, col, callback);
+    write->changes = changes;
+    return Enqueue(std::move(write));
+}
+
+/**
+ * @brief   Queue the sending of the writes accumulated by a BulkWriter.
+ *          They are sent after the writes already queued for the same collection.
+ * @param   writer: The writer to flush. It must not be touched until the callback is called,
+ *                  where it tells what became of each write.
+ * @param   callback: Called from DB::WriteQueue::Poll once the writes are done.
+ * @retval  A future holding true if every write was made.
+ */
+std::future<bool> DB::WriteQueue::Bulk(const std::shared_ptr<BulkWriter>& writer, Callback callback)
+{
+    std::unique_ptr<Write> write = std::make_unique<Write>(WriteType::Bulk, bsoncxx::document::value({}),
+                                                           bsoncxx::document::value({}),
+                                                           writer->GetDb(), writer->GetCol(), callback);
+    write->bulk = writer;
+    return Enqueue(std::move(write));
+}
+
+/**
+ * @brief   Queue the creation of a document, unless one already matches the filter.
+ * @param   filter: The filter matching the documents that would be duplicates of the new one.
+ * @param   doc: The upsert creating the document, see DB::MakeStampedInsert.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to do the action in.
+ * @param   callback: Called from DB::WriteQueue::Poll once the write is done,
+ *                    with the ObjectId of the created document.
+ * @retval  A future holding true if the write succeeded, whether a document was created or not.
+ */
+std::future<bool> DB::WriteQueue::Create(const bsoncxx::document::value& filter,
+                                         const bsoncxx::document::value& doc,
+                                         const std::string& db,
+                                         const std::string& col,
+                                         CreateCallback callback)
+{
+    std::unique_ptr<Write> write = std::make_unique<Write>(WriteType::Create, filter, doc, db, col, nullptr);
+    write->createCallback = callback;
+    return Enqueue(std::move(write));
+}
+
+/**
+ * @brief   Queue the update of the first document that matches the filter,
+ *          inserting it if none does.
+ * @param   filter: The filter to use to find the document to update.
+ * @param   doc: The update to apply on the document.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to do the action in.
+ * @param   callback: Called from DB::WriteQueue::Poll once the write is done.
+ * @retval  A future holding true if a document was updated or inserted.
+ */
+std::future<bool> DB::WriteQueue::Upsert(const bsoncxx::document::value& filter,
+                                         const bsoncxx::document::value& doc,
+                                         const std::string& db,
+                                         const std::string& col,
+                                         Callback callback)
+{
+    return Enqueue(std::make_unique<Write>(WriteType::Upsert, filter, doc, db, col, callback));
+}
+
+/**
+ * @brief   Queue the deletion of the first document that matches the filter.
+ * @param   filter: The filter to use to find the document to delete.
+ * @param   db: The database to do the action in.
+ * @param   col: The collection to do the action in.
+ * @param   callback: Called from DB::WriteQueue::Poll once the deletion is done.
+ * @retval  A future holding true if a document was deleted.
+ */
+std::future<bool> DB::WriteQueue::Delete(const bsoncxx::document::value& filter,
+                                         const std::string& db,
+                                         const std::string& col,
+                                         Callback callback)
+{
+    return Enqueue(std::make_unique<Write>(WriteType::Delete, filter, bsoncxx::document::value({}),
+                                           db, col, callback));
+}
+
+/**
+ * @brief   Hand a write over to the worker responsible for its collection.
+ *          Blocks while the queue is full.
+ * @param   write: The write to queue.
+ * @retval  The future of the write.
+ */
+std::future<bool> DB::WriteQueue::Enqueue(std::unique_ptr<Write> write)
+{
+    std::future<bool> future = write->promise.get_future();
+
+    // If the workers are not running, execute the write right away.
+    if (workers.empty())
+    {
+        std::string error;
+        int errorCode = 0;
+        bool r = Execute(*write, error, errorCode);
+        write->promise.set_value(r);
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            completions.push_back({ write->callback, write->createCallback, write->oid, r, write->col, error, errorCode });
+        }
+        Redraw::Request();
+        return future;
+    }
+
+    size_t shard = std::hash<std::string>()(write->db + "." + write->col) % queues.size();
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    // Backpressure: wait for a worker to free up some room.
+    spaceAvailable.wait(lock, [] { return pending < maxDepth; });
+    pending++;
+    queues[shard].push_back(std::move(write));
+    lock.unlock();
+    workAvailable.notify_all();
+
+    return future;
+}
+
+/**
+ * @brief   Main loop of a worker: execute the writes of its queue, in order, until asked to stop.
+ * @param   id: The index of the queue of the worker.
+ * @retval  None
+ */
+void DB::WriteQueue::WorkerLoop(size_t id)
+{
+    while (true)
+    {
+        std::unique_ptr<Write> write;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            workAvailable.wait(lock, [id] { return stopRequested || !queues[id].empty(); });
+            if (queues[id].empty())
+            {
+                // Stop was requested and there's nothing left to do.
+                return;
+            }
+            write = std::move(queues[id].front());
+            queues[id].pop_front();
+        }
+
+        std::string error;
+        int errorCode = 0;
+        bool r = Execute(*write, error, errorCode);
+        write->promise.set_value(r);
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            completions.push_back({ write->callback, write->createCallback, write->oid, r, write->col, error, errorCode });
+        }
+        // Wake up the UI thread so it reports the completion.
+        Redraw::Request();
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            pending--;
+        }
+        spaceAvailable.notify_all();
+        allDone.notify_all();
+    }
+}
+
+/**
+ * @brief   Execute a write using a client borrowed from the pool.
+ *          Nothing is logged here since this runs outside of the UI thread.
+ * @param   write: The write to execute.
+ * @param   error: Set to the reason of the failure, if any.
+ * @param   errorCode: Set to the error code returned by the server, if any.
+ * @retval  True if the write did something, false otherwise.
+ */
+bool DB::WriteQueue::Execute(Write& write, std::string& error, int& errorCode)
+{
+    ScopedClient client;
+    if (!client.IsValid())
+    {
+        error = "No connection available";
+        return false;
+    }
+
+    try
+    {
+        mongocxx::collection collection = (*client)[write.db][write.col];
+        switch (write.type)
+        {
+            case WriteType::Insert:
+            {
+                bsoncxx::stdx::optional<mongocxx::result::insert_one> r = collection.insert_one(write.doc.view());
+                return r ? true : false;
+            }
+            case WriteType::Update:
+            {
+                bsoncxx::stdx::optional<mongocxx::result::update> r =
+                    collection.update_one(write.filter.view(), write.doc.view());
+                return r ? (r.value().matched_count() > 0) : false;
+            }
+            case WriteType::UpdateAll:
+                return ExecuteAll(*client, write);
+            case WriteType::Bulk:
+            {
+                // The writer keeps the outcome of each write, only report the failure of the batches.
+                bool r = write.bulk->Flush();
+                error = write.bulk->GetError();
+                errorCode = write.bulk->GetErrorCode();
+                return r;
+            }
+            case WriteType::Create:
+            {
+                mongocxx::options::update options;
+                options.upsert(true);
+                bsoncxx::stdx::optional<mongocxx::result::update> r =
+                    collection.update_one(write.filter.view(), write.doc.view(), options);
+                // If a document matched the filter, nothing was created.
+                if (r && r.value().upserted_id() && r.value().upserted_id().value().type() == bsoncxx::type::k_oid)
+                {
+                    write.oid = r.value().upserted_id().value().get_oid().value.to_string();
+                }
+                return r ? true : false;
+            }
+            case WriteType::Upsert:
+            {
+                mongocxx::options::update options;
+                options.upsert(true);
+                bsoncxx::stdx::optional<mongocxx::result::update> r =
+                    collection.update_one(write.filter.view(), write.doc.view(), options);
+                return r ? (r.value().matched_count() > 0 || r.value().upserted_id()) : false;
+            }
+            case WriteType::Delete:
+            {
+                bsoncxx::stdx::optional<mongocxx::result::delete_result> r =
+                    collection.delete_one(write.filter.view());
+                return r ? (r.value().deleted_count() > 0) : false;
+            }
+            default:
+                return false;
+        }
+    }
+    catch (const mongocxx::exception & e)
+    {
+        error = e.what();
+        errorCode = e.code().value();
+        return false;
+    }
+    catch (const std::exception & e)
+    {
+        error = e.what();
+        return false;
+    }
+}
+
+/**
+ * @brief   Make the updates of a DB::WriteQueue::UpdateAll in a transaction, as a single bulk write.
+ *          A transaction that conflicts with another one is attempted again.
+ *          If the server doesn't support transactions, see DB::WriteQueue::ExecuteInOrder.
+ * @param   client: The client to use.
+ * @param   write: The write holding the updates.
+ * @retval  True if every filter matched a document and the updates were made, false otherwise.
+ * @note    Throws the other mongocxx::exception it gets, like the other writes.
+ */
+bool DB::WriteQueue::ExecuteAll(mongocxx::client& client, Write& write)
+{
+    mongocxx::collection collection = client[write.db][write.col];
+    mongocxx::client_session session = client.start_session();
+
+    for (int attempt = 1; ; attempt++)
+    {
+        try
+        {
+            session.start_transaction();
+            mongocxx::options::bulk_write options;
+            options.ordered(true);
+            mongocxx::bulk_write bulk = collection.create_bulk_write(session, options);
+            for (const Change& change : write.changes)
+            {
+                bulk.append(mongocxx::model::update_one(change.filter.view(), change.doc.view()));
+            }
+            bsoncxx::stdx::optional<mongocxx::result::bulk_write> r = bulk.execute();
+            // If a condition doesn't hold anymore, undo everything.
+            if (!r || size_t(r.value().matched_count()) != write.changes.size())
+            {
+                session.abort_transaction();
+                return false;
+            }
+
+            // If the outcome of the commit is unknown, committing again is safe.
+            for (int commit = 1; ; commit++)
+            {
+                try
+                {
+                    session.commit_transaction();
+                    return true;
+                }
+                catch (const mongocxx::operation_exception & e)
+                {
+                    if (e.has_error_label("UnknownTransactionCommitResult") == false ||
+                        commit >= TRANSACTION_MAX_ATTEMPTS)
+                    {
+                        throw;
+                    }
+                }
+            }
+        }
+        catch (const mongocxx::operation_exception & e)
+        {
+            // A standalone server can't make the updates all at once, make them in order instead.
+            if (e.code().value() == ERROR_CODE_ILLEGAL_OPERATION)
+            {
+                return ExecuteInOrder(collection, write);
+            }
+            // If the transaction conflicted with another one, it can simply be made again.
+            if (e.has_error_label("TransientTransactionError") == false || attempt >= TRANSACTION_MAX_ATTEMPTS)
+            {
+                throw;
+            }
+            try
+            {
+                session.abort_transaction();
+            }
+            catch (const mongocxx::exception&)
+            {
+                // The server already aborted it.
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Make the updates of a DB::WriteQueue::UpdateAll as a single ordered bulk write, without a transaction.
+ *          An update whose filter doesn't match is skipped, the others are still made.
+ * @param   collection: The collection to update.
+ * @param   write: The write holding the updates.
+ * @retval  True if every filter matched a document, false if some updates were skipped.
+ * @note    Throws the mongocxx::exception it gets, like the other writes.
+ */
+bool DB::WriteQueue::ExecuteInOrder(mongocxx::collection& collection, const Write& write)
+{
+    mongocxx::options::bulk_write options;
+    options.ordered(true);
+    mongocxx::bulk_write bulk = collection.create_bulk_write(options);
+    for (const Change& change : write.changes)
+    {
+        bulk.append(mongocxx::model::update_one(change.filter.view(), change.doc.view()));
+    }
+    bsoncxx::stdx::optional<mongocxx::result::bulk_write> r = bulk.execute();
+    return r ? (size_t(r.value().matched_count()) == write.changes.size()) : false;
+}
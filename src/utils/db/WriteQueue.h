@@ -0,0 +1,134 @@
+﻿/**
+ ******************************************************************************
+ * @addtogroup WriteQueue
+ * @{
+ * @file    WriteQueue
+ * @author  Samuel Martel
+ * @brief   Header for the WriteQueue module.
+ *
+ * @date 10/17/2026 9:12:31 AM
+ *
+ * @attention   Writes are executed by background workers, in order for a given collection.
+ *              The callbacks are only ever called from DB::WriteQueue::Poll,
+ *              which must be called from the UI thread.
+ *
+ ******************************************************************************
+ */
+#ifndef _WriteQueue
+#define _WriteQueue
+
+/*****************************************************************************/
+/* Includes */
+#include "utils/db/Mongo.h"
+#include "utils/db/MongoCore.h"
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace DB
+{
+/**
+ * @namespace DB::WriteQueue WriteQueue.h WriteQueue
+ * @brief   The namespace for the asynchronous write pipeline of the database.
+ */
+namespace WriteQueue
+{
+/*****************************************************************************/
+/* Exported defines */
+
+/**
+ * @def     DEFAULT_WRITE_WORKERS
+ * @brief   Number of background workers executing the writes when Config.json doesn't specify it.
+ */
+#define DEFAULT_WRITE_WORKERS       2
+
+/**
+ * @def     DEFAULT_WRITE_QUEUE_DEPTH
+ * @brief   Maximum number of pending writes when Config.json doesn't specify it.
+ *          Queuing a write past that number blocks until a worker is done with one.
+ */
+#define DEFAULT_WRITE_QUEUE_DEPTH   256
+
+/**
+ * @def     TRANSACTION_MAX_ATTEMPTS
+ * @brief   Number of times a transaction is attempted when it conflicts with another one,
+ *          and its commit when the outcome is unknown.
+ */
+#define TRANSACTION_MAX_ATTEMPTS    3
+
+/*****************************************************************************/
+/* Exported macro */
+
+
+/*****************************************************************************/
+/* Exported types */
+
+/**
+ * @brief   Function called from the UI thread once the database acknowledged a write.
+ *          Its parameter is true if the write succeeded.
+ */
+typedef std::function<void(bool)> Callback;
+
+/**
+ * @brief   Function called from the UI thread once the database acknowledged a DB::WriteQueue::Create.
+ *          Its first parameter is true if the write succeeded, the second one is the ObjectId
+ *          of the created document, empty if a document already matched the filter.
+ */
+typedef std::function<void(bool, const std::string&)> CreateCallback;
+
+/**
+ * @struct  Change
+ * @brief   One of the updates done by DB::WriteQueue::UpdateAll.
+ */
+struct Change
+{
+    bsoncxx::document::value filter;   /**< Must match a document for the change to be made */
+    bsoncxx::document::value doc;      /**< The update to apply on the document */
+};
+
+/*****************************************************************************/
+/* Exported functions */
+void Init();
+void Shutdown();
+void Flush();
+void Poll();
+size_t GetPendingCount();
+
+std::future<bool> Insert(const bsoncxx::document::value& doc,
+                         const std::string& db,
+                         const std::string& col,
+                         Callback callback = nullptr);
+std::future<bool> Update(const bsoncxx::document::value& filter,
+                         const bsoncxx::document::value& doc,
+                         const std::string& db,
+                         const std::string& col,
+                         Callback callback = nullptr);
+std::future<bool> UpdateAll(const std::vector<Change>& changes,
+                            const std::string& db,
+                            const std::string& col,
+                            Callback callback = nullptr);
+std::future<bool> Bulk(const std::shared_ptr<BulkWriter>& writer, Callback callback = nullptr);
+std::future<bool> Create(const bsoncxx::document::value& filter,
+                         const bsoncxx::document::value& doc,
+                         const std::string& db,
+                         const std::string& col,
+                         CreateCallback callback = nullptr);
+std::future<bool> Upsert(const bsoncxx::document::value& filter,
+                         const bsoncxx::document::value& doc,
+                         const std::string& db,
+                         const std::string& col,
+                         Callback callback = nullptr);
+std::future<bool> Delete(const bsoncxx::document::value& filter,
+                         const std::string& db,
+                         const std::string& col,
+                         Callback callback = nullptr);
+}
+}
+/* Have a wonderful day :) */
+#endif /* _WriteQueue */
+/**
+ * @}
+ */
+/****** END OF FILE ******/
@@ -1,5 +1,6 @@
 ﻿#include "BomViewer.h"
 #include "utils/db/Bom.h"
+#include "utils/db/BomGraph.h"
 #include "vendor/imgui/imgui.h"
 #include "boost/algorithm/string.hpp"
 #include "widgets/Popup.h"
@@ -9,6 +10,7 @@
 #include "utils/Fonts.h"
 #include "utils/StringUtils.h"
 #include <algorithm>
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 
@@ -76,10 +78,13 @@ public:
     float quantity = 0.0f;              /**< The quantity `reference` needed by the BOM to make it */
 };
 
+struct PickerModel;
+
 static void RenderAddWindow();
 static void RenderEditWindow();
-static void RenderItemPopup(std::string& p, DB::BOM::BOM& bom);
-static void SortItems(SortBy sort, std::vector<DB::BOM::BOM>& boms);
+static void RenderItemPopup(const std::string& p, const DB::BOM::BOM& bom);
+static void SortItems(SortBy sort, std::vector<const DB::BOM::BOM*>& boms);
+static void UpdateViewModel(SortBy sort);
 
 static void MakeNewPopup();
 static void MakeEditPopup(bool isRetry = false);
@@ -95,6 +100,8 @@ static void CancelAction();
 static void HandlePopupNameInput();
 static void HandlePopupItemPickerInput();
 static void HandlePopupOutputPickerInput();
+static void UpdatePickerModel(PickerModel& model, const std::vector<ItemRef>& list,
+                              FilterUtils::FilterHandler& picker, bool onlySelected);
 static void HandlePopupMake();
 static bool HandlePopupMakeButton(const std::string& label);
 
@@ -138,12 +145,75 @@ static std::wstring tmpOutputFilePath = L"";
 //! Object that handles all filtering functionalities for the items.
 static FilterUtils::FilterHandler itemFilter;
 
+//! Incremented every time `tmpItems` changes, be it its content, its order or what's selected.
+static unsigned int tmpItemsRevision = 0;
+
+/**
+ * @struct  PickerRow
+ * @brief   An Item of a picker, as displayed.
+ */
+struct PickerRow
+{
+    size_t index = 0;                       /**< Position of the ItemRef in the picker's list */
+    const DB::Item::Item* stock = nullptr;  /**< The Item in the cache, nullptr if it isn't in it anymore */
+};
+
+/**
+ * @struct  PickerModel
+ * @brief   The filtered list of Items displayed by a picker, along with what it was computed from.
+ *          It is only computed again when one of those changes.
+ */
+struct PickerModel
+{
+    unsigned int generation = 0;        /**< Generation of the Item cache */
+    unsigned int filterRevision = 0;    /**< Revision of the filter */
+    unsigned int revision = 0;          /**< Revision of the list of ItemRef, see `tmpItemsRevision` */
+    bool onlySelected = false;
+    bool isValid = false;
+    std::unordered_map<std::string, size_t> byId;   /**< Position of each ItemRef in the list, by Item id */
+    std::vector<PickerRow> rows;
+};
+
+//! What's displayed by the picker of the Items used by the BOM.
+static PickerModel itemPicker;
+//! What's displayed by the picker of the Item created by the BOM.
+static PickerModel outputPicker;
+
 //! All the BOM categories that can be used to filter BOMs with.
-const static std::vector<std::string> cats = { "ID", "Description", "Output ID" };
+const static std::vector<std::string> cats = { "ID", "Description", "Output ID", "All Fields" };
 
 //! Object that handles all filtering functionalities for the BOMs.
 static FilterUtils::FilterHandler filter(cats);
 
+/**
+ * @struct  BomRow
+ * @brief   A BOM as displayed in the list, with its labels already formed.
+ */
+struct BomRow
+{
+    const DB::BOM::BOM* bom = nullptr;  /**< The BOM in the cache */
+    std::string idLabel = "";           /**< Label of the selectable ID */
+    std::string viewLabel = "";         /**< Label of the "Click to view" selectable */
+    std::string popupId = "";           /**< ID of the pop up listing the Items */
+};
+
+/**
+ * @struct  BomViewModel
+ * @brief   The filtered and sorted list of BOMs displayed, along with what it was computed from.
+ *          It is only computed again when one of those changes.
+ */
+struct BomViewModel
+{
+    unsigned int generation = 0;        /**< Generation of the BOM cache */
+    unsigned int filterRevision = 0;    /**< Revision of the filter */
+    SortBy sort = SortBy::id;
+    bool isValid = false;
+    std::vector<BomRow> rows;
+};
+
+//! What's displayed by the viewer.
+static BomViewModel viewModel;
+
 /**
  * @brief   Main rendering task of the module.
  *          It takes care of:
@@ -258,8 +328,8 @@ void BomViewer::Render()
  * This region handles the headers for the tab and the sorting of the BOMs as well.
  */
 #pragma region Header
-    // Create 4 columns, no ImGui ID, with borders.
-    ImGui::Columns(4);
+    // Create 5 columns, no ImGui ID, with borders.
+    ImGui::Columns(5);
 //! This region handles the ID header.
 #pragma region ID
     // Overwrite the frame background color to be 0x00000000 (transparent).
@@ -354,103 +424,141 @@ void BomViewer::Render()
     ImGui::Selectable("Items");
     // End the Items child frame.
     ImGui::EndChildFrame();
+    // Move to the next column.
+    ImGui::NextColumn();
+#pragma endregion Items
+
+//! This region handles the Cost header.
+#pragma region Cost
+    // Create a child frame that spans all the available width and is as high as the font is.
+    ImGui::BeginChildFrame(ImGui::GetID("##BomCostChildFrame"), ImVec2(0, ImGui::GetFrameHeight()));
+    // Display the label text.
+    // An `ImBui::Selectable` is used here in place of `ImGui::Text` 
+    // to be visually consistent with `ID` and `Name`.
+    ImGui::Selectable("Cost");
+    // End the Cost child frame.
+    ImGui::EndChildFrame();
     // Restore the frame background, header hovered and header active colors to their original ones.
     ImGui::PopStyleColor(3);
     // Move to the next column.
     ImGui::NextColumn();
-#pragma endregion Items
+#pragma endregion Cost
 
 #pragma endregion Header
 
-    // Fetches all the BOMs from the cache.
-    std::vector<DB::BOM::BOM> boms = DB::BOM::GetAll();
-    // Sort the BOMs with the appropriate sorting.
-    SortItems(sort, boms);
+    // Filter and sort the BOMs of the cache, if anything changed.
+    UpdateViewModel(sort);
 
 //! This region handles the rendering of the BOMs
 #pragma region Content
-    // For each BOM in the list:
-    for (auto& bom : boms)
+    // For each visible BOM in the list, the others aren't drawn:
+    ImGuiListClipper clipper(int(viewModel.rows.size()));
+    bool isStale = false;
+    while (isStale == false && clipper.Step())
     {
-        // Draw an horizontal line.
-        ImGui::Separator();
-        // If we're in edit mode:
-        if (isEditPending == true)
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
         {
-            // Add a small button next to the BOM's ID.
-            std::string l = "Edit##" + bom.GetId();
-            // If that small button has been clicked on by the user:
-            if (ImGui::SmallButton(l.c_str()))
+            // If the cache was modified by a previous row, the rows are stale. They'll be updated next frame.
+            if (viewModel.generation != DB::BOM::GetGeneration())
             {
-                // Render the edit menu on the next frame.
-                isEditOpen = true;
-                // Exit edit mode.
-                isEditPending = false;
-                // Set the temporary BOM to the current one.
-                tmpBom = bom;
-                // Set everything up for the next frame.
-                MakeEditPopup();
+                isStale = true;
+                break;
             }
-            ImGui::SameLine();
-        }
-        // If we're in delete mode:
-        else if (isDeleteOpen == true)
-        {
-            // Add a small button next to the BOM's ID.
-            std::string l = "Delete##" + bom.GetId();
-            // If that small button has been clicked on by the user:
-            if (ImGui::SmallButton(l.c_str()))
+            const BomRow& row = viewModel.rows[i];
+            const DB::BOM::BOM& bom = *row.bom;
+            // Every widget of the row is identified by the BOM's id.
+            ImGui::PushID(bom.GetId().c_str());
+            // Draw an horizontal line.
+            ImGui::Separator();
+            // If we're in edit mode:
+            if (isEditPending == true)
+            {
+                // Add a small button next to the BOM's ID.
+                // If that small button has been clicked on by the user:
+                if (ImGui::SmallButton("Edit"))
+                {
+                    // Render the edit menu on the next frame.
+                    isEditOpen = true;
+                    // Exit edit mode.
+                    isEditPending = false;
+                    // Set the temporary BOM to the current one.
+                    tmpBom = bom;
+                    // Set everything up for the next frame.
+                    MakeEditPopup();
+                }
+                ImGui::SameLine();
+            }
+            // If we're in delete mode:
+            else if (isDeleteOpen == true)
+            {
+                // Add a small button next to the BOM's ID.
+                // If that small button has been clicked on by the user:
+                if (ImGui::SmallButton("Delete"))
+                {
+                    // Exit delete mode.
+                    isDeleteOpen = false;
+                    // Set the temporary BOM to the current one.
+                    tmpBom = bom;
+                    // Set everything up for the next frame.
+                    MakeDeletePopup();
+                }
+                ImGui::SameLine();
+            }
+
+            // If the user has clicked on the BOM's ID:
+            // Clicking on a BOM's ID opens a cost preview window.
+            if (ImGui::Selectable(row.idLabel.c_str(), false))
             {
-                // Exit delete mode.
-                isDeleteOpen = false;
-                // Set the temporary BOM to the current one.
+                // Set the BOM to the current one.
                 tmpBom = bom;
                 // Set everything up for the next frame.
-                MakeDeletePopup();
+                MakeMakePopup();
             }
-            ImGui::SameLine();
-        }
 
-        // If the user has clicked on the BOM's ID:
-        // Clicking on a BOM's ID opens a cost preview window.
-        if (ImGui::Selectable(std::string(bom.GetId() + "##selectable").c_str(), false))
-        {
-            // Set the BOM to the current one.
-            tmpBom = bom;
-            // Set everything up for the next frame.
-            MakeMakePopup();
-        }
+            // Move to the next column.
+            ImGui::NextColumn();
 
-        // Move to the next column.
-        ImGui::NextColumn();
+            // Display the name of the BOM.
+            ImGui::Text(bom.GetName().c_str());
+            // Move to the next column.
+            ImGui::NextColumn();
 
-        // Display the name of the BOM.
-        ImGui::Text(bom.GetName().c_str());
-        // Move to the next column.
-        ImGui::NextColumn();
+            // Display the ID of the BOM's output Item.
+            ImGui::Text(bom.GetRawOutput().GetId().c_str());
+            // Move to the next column.
+            ImGui::NextColumn();
 
-        // Display the ID of the BOM's output Item.
-        ImGui::Text(bom.GetRawOutput().GetId().c_str());
-        // Move to the next column.
-        ImGui::NextColumn();
+            // If the user has clicked on the "Click to view" field:
+            if (ImGui::Selectable(row.viewLabel.c_str()))
+            {
+                // Open the pop up.
+                ImGui::OpenPopup(row.popupId.c_str());
+            }
 
-        // Create a unique label ID for this BOM.
-        std::string l = "Click to view##" + bom.GetId();
-        // Create a unique pop up ID from the above label.
-        std::string p = l + "pop up";
-        // If the user has clicked on the "Click to view" field:
-        if (ImGui::Selectable(l.c_str()))
-        {
-            // Open the pop up.
-            ImGui::OpenPopup(p.c_str());
-        }
+            // If needed, render the pop up.
+            RenderItemPopup(row.popupId, bom);
+            // Move to the next column.
+            ImGui::NextColumn();
 
-        // If needed, render the pop up.
-        RenderItemPopup(p, bom);
+            // Display the cost of making the BOM once. It is remembered by the graph of the BOMs,
+            // and only computed again when the BOM or the price of one of its raw materials changes.
+            double cost = 0.0;
+            if (DB::BomGraph::GetCost(bom, cost) == true)
+            {
+                ImGui::Text("%0.2f $", cost);
+            }
+            else
+            {
+                ImGui::Text("N/A");
+            }
 
-        // Move on to the next line.
-        ImGui::NextColumn();
+            // Move on to the next line.
+            ImGui::NextColumn();
+
+            ImGui::PopID();
+        }
     }
+    clipper.End();
 #pragma endregion Content
 
     ImGui::EndChildFrame();
@@ -538,7 +646,7 @@ void RenderEditWindow()
  * @param   bom: The BOM object to display the Items from.
  * @retval  None
  */
-void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
+void RenderItemPopup(const std::string& p, const DB::BOM::BOM& bom)
 {
     // If the pop up should be drawn:
     if (ImGui::BeginPopup(p.c_str(), ImGuiWindowFlags_AlwaysAutoResize))
@@ -546,7 +654,9 @@ void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
         // Forces the pop up to be 400 pixels wide with a dummy object.
         ImGui::Dummy(ImVec2(400.f, 0.1f));
         // Get a list of all the items in the BOM.
-        std::vector<DB::BOM::ItemReference> its = bom.GetRawItems();
+        const std::vector<DB::BOM::ItemReference>& its = bom.GetRawItems();
+        // Shown for the Items that aren't known.
+        static const std::string unknown = "N/A";
         // Create 3 columns, no ImGui ID, with borders.
         ImGui::Columns(3);
 
@@ -574,10 +684,12 @@ void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
             ImVec2 bottomRight = ImVec2(currentPos.x + 400.f, currentPos.y + ImGui::GetFrameHeight());
             bool isMouseHoveringItem = ImGui::IsMouseHoveringRect(currentPos, bottomRight, false);
             ImVec2 descSize = ImVec2(0, ImGui::GetFrameHeight());
+            const DB::Item::Item* item = it.Resolve();
+            const std::string& description = item != nullptr ? item->GetDescription() : unknown;
             if (isMouseHoveringItem == true)
             {
                 // Calculate the number of lines the full description of the Item takes.
-                descSize.y = ((it.GetItem().GetDescription().size() / 15) + 1) * ImGui::GetFrameHeight();
+                descSize.y = ((description.size() / 15) + 1) * ImGui::GetFrameHeight();
             }
             // Display the Item's ID.
             ImGui::Text(it.GetId().c_str());
@@ -588,8 +700,7 @@ void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
             ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4());
             ImGui::BeginChildFrame(ImGui::GetID(std::string("##BomItemDescChildFrame" + it.GetId()).c_str()),
                                    descSize);
-            std::string d = isMouseHoveringItem == true ? it.GetItem().GetDescription() :
-                it.GetItem().GetDescription().substr(0, 15) + "...";
+            std::string d = isMouseHoveringItem == true ? description : description.substr(0, 15) + "...";
 
             if (isMouseHoveringItem == true)
             {
@@ -614,13 +725,78 @@ void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
         ImGui::Separator();
 
         // Display how many items the BOM creates when made.
-        ImGui::Text("Makes %0.2f %s", bom.GetRawOutput().GetQuantity(), bom.GetOutput().GetUnit());
+        const DB::Item::Item* output = bom.GetRawOutput().Resolve();
+        ImGui::Text("Makes %0.2f %s", bom.GetRawOutput().GetQuantity(), output != nullptr ? output->GetUnit().c_str() : "");
 
         // End the pop up.
         ImGui::EndPopup();
     }
 }
 
+/**
+ * @brief   Filter and sort the BOMs of the cache, unless nothing changed since the last time.
+ * @param   sort: By what to sort the list.
+ * @retval  None
+ */
+static void UpdateViewModel(SortBy sort)
+{
+    if (viewModel.isValid == true &&
+        viewModel.generation == DB::BOM::GetGeneration() &&
+        viewModel.filterRevision == filter.GetRevision() &&
+        viewModel.sort == sort)
+    {
+        return;
+    }
+
+    viewModel.isValid = true;
+    viewModel.generation = DB::BOM::GetGeneration();
+    viewModel.filterRevision = filter.GetRevision();
+    viewModel.sort = sort;
+
+    // Only keep the BOMs that match the filter.
+    // If possible, only check those the text index says might match.
+    // Typos defeat the index, so a fuzzy filter always looks at everything.
+    std::vector<const DB::BOM::BOM*> boms;
+    std::vector<const DB::BOM::BOM*> candidates;
+    if (filter.IsFuzzy() == false && DB::BOM::FindCandidates(filter.GetText(), candidates))
+    {
+        for (const DB::BOM::BOM* bom : candidates)
+        {
+            if (filter.CheckMatch(*bom) == true)
+            {
+                boms.push_back(bom);
+            }
+        }
+    }
+    else
+    {
+        for (const DB::BOM::BOM& bom : DB::BOM::GetAll())
+        {
+            if (filter.CheckMatch(bom) == true)
+            {
+                boms.push_back(&bom);
+            }
+        }
+    }
+    // Sort the BOMs with the appropriate sorting.
+    SortItems(sort, boms);
+
+    // Form the labels of each row.
+    viewModel.rows.clear();
+    viewModel.rows.reserve(boms.size());
+    for (const DB::BOM::BOM* bom : boms)
+    {
+        BomRow row;
+        row.bom = bom;
+        row.idLabel = bom->GetId() + "##selectable";
+        // Create a unique label ID for this BOM.
+        row.viewLabel = "Click to view##" + bom->GetId();
+        // Create a unique pop up ID from the above label.
+        row.popupId = row.viewLabel + "pop up";
+        viewModel.rows.push_back(std::move(row));
+    }
+}
+
 /**
  * @brief   Sort a list of BOMs with a specific sorting term.
  * @param   sort: By what to sort the list.
@@ -629,58 +805,43 @@ void RenderItemPopup(std::string& p, DB::BOM::BOM& bom)
  *
  * @note    The list of BOMs is sorted in place, not in a copy.
  */
-static void SortItems(SortBy sort, std::vector<DB::BOM::BOM>& boms)
+static void SortItems(SortBy sort, std::vector<const DB::BOM::BOM*>& boms)
 {
+    // The field to sort by, and the direction.
+    DB::BOM::SearchKey key = DB::BOM::SearchKey::id;
+    bool isDescending = false;
     switch (sort)
     {
         // If they should be sorted by their IDs in ascending order:
         case SortBy::id:
-            std::sort(boms.begin(), boms.end(), [](DB::BOM::BOM& a, DB::BOM::BOM& b)
-                      {
-                          std::string sa = a.GetId();
-                          std::string sb = b.GetId();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
             break;
         // If they should be sorted by their IDs in descending order:
         case SortBy::rid:
-            std::sort(boms.begin(), boms.end(), [](DB::BOM::BOM& a, DB::BOM::BOM& b)
-                      {
-                          std::string sa = a.GetId();
-                          std::string sb = b.GetId();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
+            isDescending = true;
             break;
         // If they should be sorted by their names in ascending order:
         case SortBy::name:
-            std::sort(boms.begin(), boms.end(), [](DB::BOM::BOM& a, DB::BOM::BOM& b)
-                      {
-                          std::string sa = a.GetName();
-                          std::string sb = b.GetName();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
+            key = DB::BOM::SearchKey::name;
             break;
-        // If they should be sorted by their IDs in descending order:
+        // If they should be sorted by their names in descending order:
         case SortBy::rname:
-            std::sort(boms.begin(), boms.end(), [](DB::BOM::BOM& a, DB::BOM::BOM& b)
-                      {
-                          std::string sa = a.GetName();
-                          std::string sb = b.GetName();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
+            key = DB::BOM::SearchKey::name;
+            isDescending = true;
             break;
         default:
-            break;
-
+            return;
     }
+
+    // Compare the precomputed, all caps keys. Ties are settled by id.
+    std::sort(boms.begin(), boms.end(), [key, isDescending](const DB::BOM::BOM* a, const DB::BOM::BOM* b)
+              {
+                  int cmp = a->GetSearchKey(key).compare(b->GetSearchKey(key));
+                  if (cmp == 0)
+                  {
+                      cmp = a->GetSearchKey(DB::BOM::SearchKey::id).compare(b->GetSearchKey(DB::BOM::SearchKey::id));
+                  }
+                  return isDescending ? cmp > 0 : cmp < 0;
+              });
 }
 
 /**
@@ -709,6 +870,7 @@ static void MakeNewPopup()
     tmpQuantityMade = 0;
     // The user hasn't entered any text in the filter box.
     itemFilter.ClearText();
+    tmpItemsRevision++;
 }
 
 /**
@@ -779,6 +941,7 @@ static void MakeEditPopup(bool isRetry)
 
     // The user hasn't entered any text in the filter box.
     itemFilter.ClearText();
+    tmpItemsRevision++;
 }
 
 /**
@@ -814,6 +977,7 @@ static void CancelAction()
     // Clear the list of all the existing Items.
     tmpItems.clear();
     tmpItemsForOutput.clear();
+    tmpItemsRevision++;
     // Reset the temporary BOM's output object to the default ItemReference.
     tmpOutput = DB::BOM::ItemReference();
     // Reset the other values to their default states.
@@ -945,9 +1109,11 @@ void DeleteBom()
 }
 
 /**
- * @brief   Uses the BOM's recipe to make the designed Item.
+ * @brief   Uses the BOM's recipe to make the designed Item `tmpQuantityToMake` times.
  *          It automatically subtracts all the needed Items from the inventory
  *          as well as incrementing the Output Item's quantity by the number of Items made.
+ *          Everything is sent to the database as a single write, which is refused
+ *          if any of the needed Items ran out in the meantime.
  * @param   None
  * @retval  None
  *
@@ -971,24 +1137,26 @@ void CommitMake()
         return;
     }
 
-    // Get a reference to the output Item in the database.
-    DB::Item::Item newIt = tmpBom.GetOutput();
-    // #Todo Check if this does what it should (Increment the number of Items by the number of Items made).
-    // Increment the Output Item's quantity.
-    newIt.IncQuantity();
-    // Update the output Item in the database.
-    DB::Item::EditItem(tmpBom.GetOutput(), newIt);
-
+    std::vector<DB::Item::QuantityChange> changes;
     // For each Item in the BOM's list:
     for (auto& item : tmpBom.GetRawItems())
     {
-        // Get the Item object from that Item Reference.
-        newIt = item.GetItem();
-        // #Todo Check if this does what it should (Decrement the number of Items by the number of Items made).
-        // Decrement the Item's quantity by the quantity specified in the BOM.
-        newIt.DecQuantity(item.GetQuantity());
-        // Update the Item in the database.
-        DB::Item::EditItem(item.GetItem(), newIt);
+        // Take out the quantity specified in the BOM, for each time it is made.
+        changes.push_back({ item.GetId(), -item.GetQuantity() * tmpQuantityToMake });
+    }
+    // Put in the Items made.
+    changes.push_back({ tmpBom.GetRawOutput().GetId(), tmpBom.GetRawOutput().GetQuantity() * tmpQuantityToMake });
+
+    // If one of the Items doesn't exist anymore:
+    if (DB::Item::CommitQuantities(changes, "Made " + StringUtils::NumToString(tmpQuantityToMake, false) +
+                                   " times BOM \"" + tmpBom.GetName() + "\"") == false)
+    {
+        // Warn the user.
+        Popup::Init("Unable to make BOM");
+        Popup::AddCall(Popup::TextStylized,
+                       "Some of the Items of the BOM don't exist anymore",
+                       "Bold/4278190335",   // Display the text in bold and in red. (4278190335 -> 0xFF0000FF)
+                       true);
     }
 
     // Clear the temporary output variables.
@@ -1026,11 +1194,16 @@ void HandlePopupItemPickerInput()
     ImGui::BeginChildFrame(ImGui::GetID("ItemPickerChildFrame"), size);
     float availWidth = ImGui::GetWindowContentRegionWidth();
 
-    std::sort(tmpItems.begin(), tmpItems.end(),
-              [](ItemRef& a, ItemRef& b)
-              {
-                  return a.reference.GetPosition() < b.reference.GetPosition();
-              });
+    // Keep the Items in the order the user arranged them, only sorting them when it changed.
+    if (itemPicker.isValid == false || itemPicker.revision != tmpItemsRevision)
+    {
+        std::sort(tmpItems.begin(), tmpItems.end(),
+                  [](ItemRef& a, ItemRef& b)
+                  {
+                      return a.reference.GetPosition() < b.reference.GetPosition();
+                  });
+    }
+    UpdatePickerModel(itemPicker, tmpItems, itemFilter, shouldOnlyShowSelected);
 
     ImGui::Columns(3);
     ImGui::Text("Item ID");
@@ -1039,88 +1212,94 @@ void HandlePopupItemPickerInput()
     ImGui::NextColumn();
     ImGui::Text("Quantity");
     ImGui::NextColumn();
-    for (auto item = tmpItems.begin(); item != tmpItems.end(); item++)
+
+    // If the left mouse button has been released, drop the Item being dragged.
+    // It's done here since that Item's row might not be drawn, having been scrolled out of view or filtered out.
+    if (itemClicked.empty() == false && ImGui::IsMouseDown(ImGuiMouseButton_Left) == false)
     {
-        // Only display the item if it matches the filter or 
-        // if the "Only show selected items" checkbox is active (shouldOnlyShowSelected == true),
-        // only display the item if it is included in the BOM.
-        if ((itemFilter.CheckMatch(DB::Item::GetItemByID(item->reference.GetId())) == false &&
-             itemFilter.CheckMatch(item->reference.GetItem(), 1) == false) ||
-             (shouldOnlyShowSelected == true && item->isSelected == false))
-        {
-            continue;
-        }
-        ImGui::Separator();
-        ImVec2 checkboxPos1 = ImGui::GetCursorScreenPos();
-        ImVec2 checkboxPos2 = ImVec2(checkboxPos1.x + ImGui::GetFrameHeight(),
-                                     checkboxPos1.y + ImGui::GetFrameHeight());
+        itemClicked = "";
+        itemClickedTime = 0;
+        isMoving = false;
+    }
 
-        if (ImGui::Checkbox(item->reference.GetId().c_str(), &item->isSelected) == true)
+    // Only the visible rows are drawn.
+    ImGuiListClipper clipper(int(itemPicker.rows.size()));
+    bool isStale = false;
+    while (isStale == false && clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
         {
-            if (item->isSelected == true)
+            // If the Item cache was modified, the rows are stale. They'll be updated next frame.
+            if (itemPicker.generation != DB::Item::GetGeneration())
             {
-                if (item->reference.GetPosition() >= tmpItems.size())
-                {
-                    item->reference.SetPosition(item->reference.GetPosition() - tmpItems.size());
-                }
+                isStale = true;
+                break;
             }
-            else
+            const PickerRow& row = itemPicker.rows[i];
+            auto item = tmpItems.begin() + row.index;
+            ImGui::PushID(int(row.index));
+            ImGui::Separator();
+            ImVec2 checkboxPos1 = ImGui::GetCursorScreenPos();
+            ImVec2 checkboxPos2 = ImVec2(checkboxPos1.x + ImGui::GetFrameHeight(),
+                                         checkboxPos1.y + ImGui::GetFrameHeight());
+
+            if (ImGui::Checkbox(item->reference.GetId().c_str(), &item->isSelected) == true)
             {
-                if (item->reference.GetPosition() < tmpItems.size())
+                tmpItemsRevision++;
+                if (item->isSelected == true)
+                {
+                    if (item->reference.GetPosition() >= tmpItems.size())
+                    {
+                        item->reference.SetPosition(item->reference.GetPosition() - tmpItems.size());
+                    }
+                }
+                else
                 {
-                    item->reference.SetPosition(item->reference.GetPosition() + tmpItems.size());
+                    if (item->reference.GetPosition() < tmpItems.size())
+                    {
+                        item->reference.SetPosition(item->reference.GetPosition() + tmpItems.size());
+                    }
                 }
             }
-        }
-        if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenBlockedByPopup) &&
-            ImGui::IsMouseHoveringRect(checkboxPos1, checkboxPos2) == false)
-        {
-            ImGui::OpenPopup(std::string("##ItemDescriptionPopup" + item->reference.GetId()).c_str());
-        }
-
-        if (ImGui::BeginPopup(std::string("##ItemDescriptionPopup" + item->reference.GetId()).c_str()))
-        {
-            ImVec2 popupPos = ImGui::GetMousePosOnOpeningCurrentPopup();
-            ImVec2 cursorPos = ImGui::GetMousePos();
-            if (cursorPos.x > popupPos.x + 100 || cursorPos.x < popupPos.x - 100 ||
-                cursorPos.y > popupPos.y + 20 || cursorPos.y < popupPos.y - 20 ||
-                ImGui::IsMouseHoveringRect(checkboxPos1, checkboxPos2, false) == true)
+            if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenBlockedByPopup) &&
+                ImGui::IsMouseHoveringRect(checkboxPos1, checkboxPos2) == false)
             {
-                ImGui::CloseCurrentPopup();
+                ImGui::OpenPopup("##ItemDescriptionPopup");
             }
-            ImGui::Text(item->reference.GetItem().GetDescription().c_str());
 
-            ImGui::EndPopup();
-        }
+            if (ImGui::BeginPopup("##ItemDescriptionPopup"))
+            {
+                ImVec2 popupPos = ImGui::GetMousePosOnOpeningCurrentPopup();
+                ImVec2 cursorPos = ImGui::GetMousePos();
+                if (cursorPos.x > popupPos.x + 100 || cursorPos.x < popupPos.x - 100 ||
+                    cursorPos.y > popupPos.y + 20 || cursorPos.y < popupPos.y - 20 ||
+                    ImGui::IsMouseHoveringRect(checkboxPos1, checkboxPos2, false) == true)
+                {
+                    ImGui::CloseCurrentPopup();
+                }
+                ImGui::Text(row.stock != nullptr ? row.stock->GetDescription().c_str() : "");
 
-        // Check if current row is clicked and has been clicked for more than 300ms.
-        // Set highlighting box to start at top-left point of item frame.
-        checkboxPos1.x -= ImGui::GetStyle().ItemSpacing.x;
-        checkboxPos1.y -= ImGui::GetStyle().FramePadding.y;
-
-        // Set highlighting box to end at bottom-right of item frame.
-        ImVec2 endOfFrame = ImVec2(availWidth + checkboxPos1.x + ImGui::GetStyle().ItemSpacing.x,
-                                   checkboxPos1.y + ImGui::GetFrameHeightWithSpacing() +
-                                   ImGui::GetStyle().FramePadding.y + ImGui::GetStyle().ItemSpacing.y + 5);
-        if ((ImGui::IsMouseHoveringRect(checkboxPos1, endOfFrame, false) && itemClicked.empty()) &&
-            ImGui::IsMouseDown(ImGuiMouseButton_Left))
-        {
-            itemClicked = item->reference.GetId();
-            itemClickedTime = ImGui::GetTime();
-        }
+                ImGui::EndPopup();
+            }
 
-        // If this item is the one we clicked on:
-        if (item->reference.GetId() == itemClicked)
-        {
-            // If the left mouse button has been released:
-            if (ImGui::IsMouseDown(ImGuiMouseButton_Left) == false)
+            // Check if current row is clicked and has been clicked for more than 300ms.
+            // Set highlighting box to start at top-left point of item frame.
+            checkboxPos1.x -= ImGui::GetStyle().ItemSpacing.x;
+            checkboxPos1.y -= ImGui::GetStyle().FramePadding.y;
+
+            // Set highlighting box to end at bottom-right of item frame.
+            ImVec2 endOfFrame = ImVec2(availWidth + checkboxPos1.x + ImGui::GetStyle().ItemSpacing.x,
+                                       checkboxPos1.y + ImGui::GetFrameHeightWithSpacing() +
+                                       ImGui::GetStyle().FramePadding.y + ImGui::GetStyle().ItemSpacing.y + 5);
+            if ((ImGui::IsMouseHoveringRect(checkboxPos1, endOfFrame, false) && itemClicked.empty()) &&
+                ImGui::IsMouseDown(ImGuiMouseButton_Left))
             {
-                // Drop the item.
-                itemClicked = "";
-                itemClickedTime = 0;
-                isMoving = false;
+                itemClicked = item->reference.GetId();
+                itemClickedTime = ImGui::GetTime();
             }
-            else
+
+            // If this item is the one we clicked on, and is still held:
+            if (item->reference.GetId() == itemClicked)
             {
                 if ((ImGui::GetTime() >= itemClickedTime + 0.150) && isMoving == false)
                 {
@@ -1139,6 +1318,7 @@ void HandlePopupItemPickerInput()
                                  (item->isSelected == true))
                             {
                                 int position = item->reference.GetPosition();
+                                tmpItemsRevision++;
                                 item->reference.SetPosition((item - 1)->reference.GetPosition());
                                 (item - 1)->reference.SetPosition(position);
 
@@ -1165,6 +1345,7 @@ void HandlePopupItemPickerInput()
                                  (item->isSelected == false))
                             {
                                 int position = item->reference.GetPosition();
+                                tmpItemsRevision++;
                                 item->reference.SetPosition((item + 1)->reference.GetPosition());
                                 (item + 1)->reference.SetPosition(position);
 
@@ -1178,7 +1359,7 @@ void HandlePopupItemPickerInput()
                                 if (ImGui::IsItemVisible() == false)
                                 {
                                     // Scroll down till it is visible.
-                                    while (ImGui::IsItemVisible() == false);
+                                    ImGui::SetScrollHereY(1.0f);
                                 }
                                 Logging::System.Info("");
                                 Logging::System.Info("Item " + item->reference.GetId() + "position is now ",
@@ -1192,25 +1373,27 @@ void HandlePopupItemPickerInput()
                                                                   ImGui::GetColorU32(ImGuiCol_ButtonActive, 0.3f));
                 }
             }
-        }
 
-        ImGui::NextColumn();
-        float available = DB::Item::GetItemByID(item->reference.GetId()).GetQuantity();
-        ImGui::Text("%0.2f %s", available, DB::Item::GetItemByID(item->reference.GetId()).GetUnit());
-        ImGui::NextColumn();
-        ImGui::BeginChildFrame(ImGui::GetID(std::string("##QtyChildFrame" + item->reference.GetId()).c_str()),
-                               ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 5));
-        ImU32 col = ImGui::GetColorU32(ImGuiCol_Text);
-        if (available < item->quantity)
-        {
-            col = 0xFF0000FF;   // Red.
+            ImGui::NextColumn();
+            float available = row.stock != nullptr ? row.stock->GetQuantity() : 0.0f;
+            ImGui::Text("%0.2f %s", available, row.stock != nullptr ? row.stock->GetUnit().c_str() : "");
+            ImGui::NextColumn();
+            ImGui::BeginChildFrame(ImGui::GetID("##QtyChildFrame"),
+                                   ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 5));
+            ImU32 col = ImGui::GetColorU32(ImGuiCol_Text);
+            if (available < item->quantity)
+            {
+                col = 0xFF0000FF;   // Red.
+            }
+            ImGui::PushStyleColor(ImGuiCol_Text, col);
+            ImGui::InputFloat("##QtyInputFloat", &item->quantity, 1.0f, 10.0f);
+            ImGui::PopStyleColor();
+            ImGui::EndChildFrame();
+            ImGui::NextColumn();
+            ImGui::PopID();
         }
-        ImGui::PushStyleColor(ImGuiCol_Text, col);
-        ImGui::InputFloat(std::string("##QtyInputFloat" + item->reference.GetId()).c_str(), &item->quantity, 1.0f, 10.0f);
-        ImGui::PopStyleColor();
-        ImGui::EndChildFrame();
-        ImGui::NextColumn();
     }
+    clipper.End();
     ImGui::EndChildFrame();
 
 }
@@ -1222,25 +1405,37 @@ void HandlePopupOutputPickerInput()
     if (ImGui::BeginCombo("Created Item", tmpItemsForOutput.at(tmpSelectedOut).reference.GetId().c_str()))
     {
         itFilter.Render();
-        int currItem = -1;
-        for (auto& item : tmpItemsForOutput)
+        UpdatePickerModel(outputPicker, tmpItemsForOutput, itFilter, false);
+
+        // Only the visible rows are drawn.
+        ImGuiListClipper clipper(int(outputPicker.rows.size()));
+        bool isStale = false;
+        while (isStale == false && clipper.Step())
         {
-            currItem++;
-            if (itFilter.CheckMatch(item.reference.GetItem(), 0) == false &&
-                itFilter.CheckMatch(item.reference.GetItem(), 1) == false)
-            {
-                continue;
-            }
-            ImGui::Separator();
-            if (ImGui::Selectable(item.reference.GetId().c_str()))
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
             {
-                tmpSelectedOut = currItem;
-            }
-            if (ImGui::IsItemHovered())
-            {
-                ImGui::TextWrapped(std::string("\t" + item.reference.GetItem().GetDescription()).c_str());
+                // If the Item cache was modified, the rows are stale. They'll be updated next frame.
+                if (outputPicker.generation != DB::Item::GetGeneration())
+                {
+                    isStale = true;
+                    break;
+                }
+                const PickerRow& row = outputPicker.rows[i];
+                ImGui::PushID(int(row.index));
+                ImGui::Separator();
+                if (ImGui::Selectable(tmpItemsForOutput[row.index].reference.GetId().c_str()))
+                {
+                    tmpSelectedOut = int(row.index);
+                }
+                // Show the description in a tooltip, so that every row keeps the same height.
+                if (ImGui::IsItemHovered() && row.stock != nullptr)
+                {
+                    ImGui::SetTooltip("%s", row.stock->GetDescription().c_str());
+                }
+                ImGui::PopID();
             }
         }
+        clipper.End();
         ImGui::EndCombo();
     }
     else
@@ -1254,6 +1449,88 @@ void HandlePopupOutputPickerInput()
     }
 }
 
+/**
+ * @brief   Filter the Items of a picker, unless nothing changed since the last time.
+ *          The Items match if their id or their description matches the filter.
+ * @param   model: The model of the picker.
+ * @param   list: The Items the picker picks from.
+ * @param   picker: The filter of the picker.
+ * @param   onlySelected: If true, only the Items that are part of the BOM are kept.
+ * @retval  None
+ */
+void UpdatePickerModel(PickerModel& model, const std::vector<ItemRef>& list,
+                       FilterUtils::FilterHandler& picker, bool onlySelected)
+{
+    if (model.isValid == true &&
+        model.generation == DB::Item::GetGeneration() &&
+        model.filterRevision == picker.GetRevision() &&
+        model.revision == tmpItemsRevision &&
+        model.onlySelected == onlySelected)
+    {
+        return;
+    }
+
+    // If the list changed, find where each Item is in it again.
+    if (model.isValid == false || model.revision != tmpItemsRevision)
+    {
+        model.byId.clear();
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            model.byId[list[i].reference.GetId()] = i;
+        }
+    }
+
+    model.isValid = true;
+    model.generation = DB::Item::GetGeneration();
+    model.filterRevision = picker.GetRevision();
+    model.revision = tmpItemsRevision;
+    model.onlySelected = onlySelected;
+
+    // If possible, only check the Items the text index says might match, in the order of the list.
+    std::vector<size_t> indexes;
+    std::vector<const DB::Item::Item*> candidates;
+    if (picker.IsFuzzy() == false &&
+        DB::Item::FindCandidates(picker.GetText(), DB::Item::SearchKey::count, candidates) == true)
+    {
+        for (const DB::Item::Item* candidate : candidates)
+        {
+            auto it = model.byId.find(candidate->GetId());
+            if (it != model.byId.end())
+            {
+                indexes.push_back(it->second);
+            }
+        }
+        std::sort(indexes.begin(), indexes.end());
+    }
+    else
+    {
+        indexes.resize(list.size());
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            indexes[i] = i;
+        }
+    }
+
+    model.rows.clear();
+    for (size_t i : indexes)
+    {
+        if (onlySelected == true && list[i].isSelected == false)
+        {
+            continue;
+        }
+
+        const DB::Item::Item* stock = DB::Item::FindItemByID(list[i].reference.GetId());
+        // An Item that isn't in the cache anymore is only shown when nothing is filtered.
+        bool isMatch = stock == nullptr ? picker.GetText().empty() :
+            (picker.CheckMatch(*stock, int(DB::Item::SearchKey::id)) == true ||
+             picker.CheckMatch(*stock, int(DB::Item::SearchKey::description)) == true);
+        if (isMatch == true)
+        {
+            model.rows.push_back(PickerRow{ i, stock });
+        }
+    }
+}
+
 void HandlePopupMake()
 {
     std::string txt = "Make " + StringUtils::NumToString(tmpBom.GetRawOutput().GetQuantity()) + " " +
@@ -1274,7 +1551,10 @@ void HandlePopupMake()
     for (auto& i : tmpBom.GetRawItems())
     {
         ImGui::Separator();
-        float avail = DB::Item::GetItemByID(i.GetId()).GetQuantity();
+        // If the Item isn't known, none of it is available.
+        const DB::Item::Item* stock = i.Resolve();
+        float avail = stock != nullptr ? stock->GetQuantity() : 0.0f;
+        const char* unit = stock != nullptr ? stock->GetUnit().c_str() : "";
         float needed = i.GetQuantity() * tmpQuantityToMake;
         ImU32 col = avail < needed ? 0xFF0000FF : ImGui::GetColorU32(ImGuiCol_Text);
 
@@ -1283,18 +1563,70 @@ void HandlePopupMake()
 
         ImGui::Text(i.GetId().c_str());
         ImGui::NextColumn();
-        ImGui::Text("%0.2f %s", avail, DB::Item::GetItemByID(i.GetId()).GetUnit().c_str());
+        ImGui::Text("%0.2f %s", avail, unit);
         ImGui::NextColumn();
         ImGui::BeginChildFrame(ImGui::GetID(std::string("##NeededField" + i.GetId()).c_str()),
                                ImVec2(0, ImGui::GetFrameHeight()));
         ImGui::PushStyleColor(ImGuiCol_Text, col);
-        ImGui::Text("%0.2f %s", needed, DB::Item::GetItemByID(i.GetId()).GetUnit().c_str());
+        ImGui::Text("%0.2f %s", needed, unit);
         ImGui::PopStyleColor();
         ImGui::EndChildFrame();
         ImGui::NextColumn();
     }
     ImGui::Columns(1);
 
+    // Everything needed down to the raw materials, through every level of sub-assemblies.
+    if (ImGui::CollapsingHeader("Raw materials (all levels)"))
+    {
+        std::vector<DB::BomGraph::Requirement> materials;
+        if (DB::BomGraph::Explode(tmpBom, tmpQuantityToMake, materials) == false)
+        {
+            ImGui::PushStyleColor(ImGuiCol_Text, 0xFF0000FF);
+            ImGui::TextWrapped("Some sub-assemblies are made from themselves, or from an assembly that is. "
+                               "The raw materials can't be computed.");
+            ImGui::PopStyleColor();
+        }
+        else
+        {
+            ImGui::Columns(3, "RawMaterials");
+            ImGui::Text("Item ID");
+            ImGui::NextColumn();
+            ImGui::Text("Available");
+            ImGui::NextColumn();
+            ImGui::Text("Needed");
+            ImGui::NextColumn();
+            for (const DB::BomGraph::Requirement& material : materials)
+            {
+                ImGui::Separator();
+                const DB::Item::Item* stock = DB::Item::FindItemByID(material.id);
+                float avail = stock != nullptr ? stock->GetQuantity() : 0.0f;
+                const char* unit = stock != nullptr ? stock->GetUnit().c_str() : "";
+
+                ImGui::Text(material.id.c_str());
+                ImGui::NextColumn();
+                ImGui::Text("%0.2f %s", avail, unit);
+                ImGui::NextColumn();
+                ImGui::PushStyleColor(ImGuiCol_Text, avail < material.quantity ? 0xFF0000FF :
+                                      ImGui::GetColorU32(ImGuiCol_Text));
+                ImGui::Text("%0.2f %s", material.quantity, unit);
+                ImGui::PopStyleColor();
+                ImGui::NextColumn();
+            }
+            ImGui::Columns(1);
+        }
+    }
+
+    // Display what making the BOM costs, through every level of sub-assemblies.
+    double cost = 0.0;
+    if (DB::BomGraph::GetCost(tmpBom, cost) == true)
+    {
+        ImGui::Text("Cost: %0.2f $ per make, %0.2f $ in total", cost, cost * tmpQuantityToMake);
+    }
+    else
+    {
+        ImGui::Text("Cost: N/A");
+    }
+
     ImGui::InputInt("Quantity to make", &tmpQuantityToMake, 1, 10);
     tmpQuantityToMake = tmpQuantityToMake <= 0 ? 1 : tmpQuantityToMake;
 }
@@ -1375,7 +1707,7 @@ void ExportItems()
             << item.GetRawOutput().GetId() << R"(,")";
         for (auto& i : item.GetRawItems())
         {
-            outputFile << i.GetId() << ":\t" << i.GetQuantity() * tmpQuantityToMake << " " << DB::Item::GetItemByID(i.GetId()).GetUnit() << std::endl;
+            outputFile << i.GetId() << ":\t" << i.GetQuantity() * tmpQuantityToMake << " " << i.GetItem().GetUnit() << std::endl;
         }
 
         outputFile << R"(")" << std::endl;
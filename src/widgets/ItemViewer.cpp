@@ -7,6 +7,7 @@
 #include "utils/Config.h"
 #include "utils/FilterUtils.h"
 #include "utils/StringUtils.h"
+#include "utils/TaskPool.h"
 #include "vendor/imgui/imgui.h"
 #include "widgets/Popup.h"
 #include "widgets/Logger.h"
@@ -15,10 +16,18 @@
 #include <Windows.h>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
 
 #define SORT_ASCEND     "(A to Z)"
 #define SORT_DESCEND    "(Z to A)"
-#define SORT_TXT(x)     (sortby == SortBy::x ? SORT_ASCEND : (sortby == SortBy::r ## x ? SORT_DESCEND : " "))
+#define SORT_THEN_ASCEND    "(then A to Z)"
+#define SORT_THEN_DESCEND   "(then Z to A)"
+#define SORT_TXT(x)     GetSortText(sortby, SortBy::x)
 #define IS_SORT_ACTIVE(x) (( sortby == SortBy::x ) || ( sortby == SortBy::r ## x ))
 
 enum class SortBy
@@ -40,18 +49,33 @@ enum class SortBy
     unit,
     runit,
     status,
-    rstatus
+    rstatus,
+    relevance,
+    none
 };
 
-
-static void SortItems(SortBy sortby, std::vector<DB::Item::Item>& items);
+struct ItemQuery;
+struct ItemRow;
+
+static DB::Item::SearchKey GetSortKey(SortBy sort);
+static bool IsSortDescending(SortBy sort);
+static int CompareItems(SortBy sort, const DB::Item::Item* a, const DB::Item::Item* b);
+static bool SortItems(SortBy sortby, SortBy thenBy, std::vector<const DB::Item::Item*>& items, bool isPresorted);
+static void ToggleSort(SortBy& sortby, SortBy column);
+static const char* GetSortText(SortBy sortby, SortBy column);
+static void UpdateViewModel(SortBy sortby);
+static bool RunQuery(const ItemQuery& query, std::vector<const DB::Item::Item*>& items);
+static bool MakeRows(const ItemQuery& query, std::vector<ItemRow>& rows);
+static void ShowRows(const ItemQuery& query, std::vector<ItemRow>& rows);
 static void RenderFilterBar();
 static bool CheckDoesItemMatchFilter(const DB::Item::Item& item);
 static void MakeNewPopup();
 static void MakeEditPopup(bool isRetry = false);
 static void MakeDeletePopup();
+static void MakeBulkEditPopup();
 static void SaveNewItem();
 static void SaveEditedItem();
+static void SaveBulkEdit();
 static void DeleteItem();
 static void CancelAction();
 
@@ -65,6 +89,11 @@ static void HandlePopupPriceInput();
 static void HandlePopupQuantityInput();
 static void HandlePopupUnitInput();
 static void HandlePopupStatusInput();
+static void HandlePopupBulkInput(bool& isChanged, const char* id, void (*input)());
+static void HandlePopupBulkLocationInput();
+static void HandlePopupBulkPriceInput();
+static void HandlePopupBulkUnitInput();
+static void HandlePopupBulkStatusInput();
 
 static int GetCategoryNumber(const DB::Category::Category& cat);
 static bool VerifyItem(DB::Item::Item& item);
@@ -85,6 +114,15 @@ static float tmpQty = 0.0f;
 static char tmpUnit[MAX_INPUT_LENGTH] = { 0 };
 static int tmpStatus = 0;
 static std::wstring tmpOutputFilePath = L"";
+//! The fields changed by a bulk edit.
+static bool tmpChangeLocation = false;
+static bool tmpChangePrice = false;
+static bool tmpChangeUnit = false;
+static bool tmpChangeStatus = false;
+//! The ids of the Items selected for a bulk edit.
+static std::set<std::string> selectedIds;
+//! Revision of the filter the Items were selected with. Changing the filter clears the selection.
+static unsigned int selectedFilterRevision = 0;
 
 const static std::vector<std::string> cats = { "ID",
                                                "Description",
@@ -94,13 +132,72 @@ const static std::vector<std::string> cats = { "ID",
                                                "Price",
                                                "Quantity",
                                                "Unit",
-                                               "Status" };
+                                               "Status",
+                                               "All Fields" };
 static FilterUtils::FilterHandler filter(cats);
 
+/**
+ * @struct  ItemRow
+ * @brief   A copy of an Item as displayed in the list, with its text already formatted.
+ *          It stays valid when the cache is modified, the cached Item is looked up by id when acted upon.
+ */
+struct ItemRow
+{
+    std::string id = "";
+    std::string description = "";
+    std::string category = "";
+    std::string referenceLink = "";
+    std::string location = "";
+    std::string price = "";
+    float quantity = 0.0f;          /**< Formatted when drawn, along with the pending adjustments */
+    std::string unit = "";
+    std::string status = "";
+    bool isLink = false;            /**< The reference is a link that can be opened */
+};
+
+/**
+ * @struct  ItemViewModel
+ * @brief   The filtered and sorted list of Items displayed, along with what it was computed from.
+ *          It is only computed again when one of those changes.
+ */
+struct ItemViewModel
+{
+    unsigned int generation = 0;        /**< Generation of the Item cache */
+    unsigned int filterRevision = 0;    /**< Revision of the filter */
+    SortBy sortby = SortBy::id;
+    SortBy thenBy = SortBy::none;
+    bool isValid = false;
+    std::vector<ItemRow> rows;
+};
+static ItemViewModel viewModel;
+
+/**
+ * @struct  ItemQuery
+ * @brief   What the list of Items displayed is filtered and sorted by.
+ */
+struct ItemQuery
+{
+    FilterUtils::FilterHandler filter;  /**< Copy of the filter, the UI thread keeps using the original */
+    SortBy sortby = SortBy::id;
+    SortBy thenBy = SortBy::none;
+    unsigned int generation = 0;        /**< Generation of the Item cache */
+    unsigned int filterRevision = 0;    /**< Revision of the filter */
+};
+//! The query being run in the background.
+static ItemQuery pendingQuery;
+//! The rows found by the query being run in the background, only touched by the UI thread once it's done.
+static std::vector<ItemRow> pendingRows;
+//! Whether the query being run in the background completed, not valid if there is none.
+static std::future<bool> pendingResult;
+//! The column settling the ties of the sort, SortBy::none if there is none.
+static SortBy thenBy = SortBy::none;
+
 void ItemViewer::Render()
 {
     static bool isEditOpen = false;
     static bool isDeleteOpen = false;
+    static bool isSelectOpen = false;
+    static SortBy sortby = SortBy::id;
 
     DB::Item::Refresh();
 
@@ -129,6 +226,39 @@ void ItemViewer::Render()
             isDeleteOpen = !isDeleteOpen;
             isEditOpen = false;
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Select"))
+        {
+            isSelectOpen = !isSelectOpen;
+            // Don't keep Items selected while their checkboxes are hidden.
+            if (isSelectOpen == false)
+            {
+                selectedIds.clear();
+            }
+        }
+
+        // Edit all the selected Items at once.
+        if (isSelectOpen == true)
+        {
+            if (ImGui::SmallButton("All"))
+            {
+                for (const ItemRow& row : viewModel.rows)
+                {
+                    selectedIds.insert(row.id);
+                }
+            }
+            ImGui::SameLine();
+            if (ImGui::SmallButton("None"))
+            {
+                selectedIds.clear();
+            }
+            ImGui::SameLine();
+            std::string label = "Bulk Edit (" + StringUtils::NumToString(unsigned(selectedIds.size()), false) + ")";
+            if (ImGui::SmallButton(label.c_str()) && selectedIds.empty() == false)
+            {
+                MakeBulkEditPopup();
+            }
+        }
     }
 #pragma endregion
 
@@ -138,12 +268,31 @@ void ItemViewer::Render()
     const static float w2 = ImGui::GetColumnWidth(-1) * 1.5f;
     ImGui::SetColumnWidth(-1, w2);
     filter.Render();
+    // Only the Items shown can be selected, the ones filtered out mustn't be edited.
+    if (filter.GetRevision() != selectedFilterRevision)
+    {
+        selectedIds.clear();
+        selectedFilterRevision = filter.GetRevision();
+    }
     ImGui::NextColumn();
 
     if (ImGui::Button("Export"))
     {
         ExportItems();
     }
+    // Ranking the Items only makes sense when the filter tolerates typos.
+    if (filter.IsFuzzy() == true)
+    {
+        ImGui::SameLine();
+        if (ImGui::Selectable("Relevance", sortby == SortBy::relevance, 0, ImGui::CalcTextSize("Relevance")))
+        {
+            sortby = SortBy::relevance;
+        }
+    }
+    else if (sortby == SortBy::relevance)
+    {
+        sortby = SortBy::id;
+    }
 
     ImGui::NextColumn();
     ImGui::Columns(1);
@@ -153,8 +302,6 @@ void ItemViewer::Render()
                            ImVec2(0, (ImGui::GetWindowHeight() - ImGui::GetCursorPosY() - 25)));
     ImGui::PopStyleColor();
 
-    static SortBy sortby = SortBy::id;
-
 #pragma region Header
     ImGui::Columns(9);
 #pragma region ID
@@ -164,7 +311,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("ID", IS_SORT_ACTIVE(id), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::id ? SortBy::rid : SortBy::id;
+        ToggleSort(sortby, SortBy::id);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(id));
@@ -181,7 +328,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Description", IS_SORT_ACTIVE(description), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::description ? SortBy::rdescription : SortBy::description;
+        ToggleSort(sortby, SortBy::description);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(description));
@@ -198,7 +345,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Category", IS_SORT_ACTIVE(category), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::category ? SortBy::rcategory : SortBy::category;
+        ToggleSort(sortby, SortBy::category);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(category));
@@ -215,7 +362,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Reference", IS_SORT_ACTIVE(referenceLink), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::referenceLink ? SortBy::rreferenceLink : SortBy::referenceLink;
+        ToggleSort(sortby, SortBy::referenceLink);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(referenceLink));
@@ -232,7 +379,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Location", IS_SORT_ACTIVE(location), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::location ? SortBy::rlocation : SortBy::location;
+        ToggleSort(sortby, SortBy::location);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(location));
@@ -249,7 +396,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Price/Unit", IS_SORT_ACTIVE(price), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::price ? SortBy::rprice : SortBy::price;
+        ToggleSort(sortby, SortBy::price);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(price));
@@ -266,7 +413,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Quantity", IS_SORT_ACTIVE(quantity), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::quantity ? SortBy::rquantity : SortBy::quantity;
+        ToggleSort(sortby, SortBy::quantity);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(quantity));
@@ -283,7 +430,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Unit", IS_SORT_ACTIVE(unit), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::unit ? SortBy::runit : SortBy::unit;
+        ToggleSort(sortby, SortBy::unit);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(unit));
@@ -300,7 +447,7 @@ void ItemViewer::Render()
     ImGui::Columns(2, nullptr, false);
     if (ImGui::Selectable("Status", IS_SORT_ACTIVE(status), ImGuiSelectableFlags_SpanAllColumns))
     {
-        sortby = sortby == SortBy::status ? SortBy::rstatus : SortBy::status;
+        ToggleSort(sortby, SortBy::status);
     }
     ImGui::NextColumn();
     ImGui::Text(SORT_TXT(status));
@@ -312,120 +459,153 @@ void ItemViewer::Render()
 
 #pragma endregion
 
-    std::vector<DB::Item::Item> items = DB::Item::GetAll();
-    SortItems(sortby, items);
+    UpdateViewModel(sortby);
 #pragma region Content
-    for (auto& item : items)
+    // Only the visible rows are drawn.
+    ImGuiListClipper clipper(int(viewModel.rows.size()));
+    while (clipper.Step())
     {
-        if (filter.CheckMatch(item) == false)
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
         {
-            continue;
-        }
-        ImGui::Separator();
-        if (isEditOpen == true)
-        {
-            std::string l = "Edit##" + item.GetId();
-            if (ImGui::SmallButton(l.c_str()))
+            const ItemRow& row = viewModel.rows[i];
+            // Every widget of the row is identified by the Item's id.
+            ImGui::PushID(row.id.c_str());
+            ImGui::Separator();
+            if (isSelectOpen == true)
             {
-                isEditOpen = false;
-                tmpItem = DB::Item::Item(item);
-                MakeEditPopup();
+                bool isSelected = selectedIds.count(row.id) != 0;
+                if (ImGui::Checkbox("##Select", &isSelected))
+                {
+                    if (isSelected == true)
+                    {
+                        selectedIds.insert(row.id);
+                    }
+                    else
+                    {
+                        selectedIds.erase(row.id);
+                    }
+                }
+                ImGui::SameLine();
             }
-            ImGui::SameLine();
-        }
-        else if (isDeleteOpen == true)
-        {
-            std::string l = "Delete##" + item.GetId();
-            if (ImGui::SmallButton(l.c_str()))
+            if (isEditOpen == true)
+            {
+                if (ImGui::SmallButton("Edit"))
+                {
+                    // The row might be a few frames behind, edit the Item as it is now.
+                    const DB::Item::Item* item = DB::Item::FindItemByID(row.id);
+                    if (item != nullptr)
+                    {
+                        isEditOpen = false;
+                        tmpItem = DB::Item::Item(*item);
+                        MakeEditPopup();
+                    }
+                }
+                ImGui::SameLine();
+            }
+            else if (isDeleteOpen == true)
             {
-                isDeleteOpen = false;
-                tmpItem = DB::Item::Item(item);
-                MakeDeletePopup();
+                if (ImGui::SmallButton("Delete"))
+                {
+                    const DB::Item::Item* item = DB::Item::FindItemByID(row.id);
+                    if (item != nullptr)
+                    {
+                        isDeleteOpen = false;
+                        tmpItem = DB::Item::Item(*item);
+                        MakeDeletePopup();
+                    }
+                }
+                ImGui::SameLine();
             }
-            ImGui::SameLine();
-        }
 
-        ImGui::Text(item.GetId().c_str());
-        ImGui::NextColumn();
+            ImGui::Text(row.id.c_str());
+            ImGui::NextColumn();
 
-        ImGui::Text(item.GetDescription().c_str());
-        ImGui::NextColumn();
+            ImGui::Text(row.description.c_str());
+            ImGui::NextColumn();
 
-        DB::Category::Category cat = DB::Category::GetCategoryByName(item.GetCategory().GetName());
-        ImGui::Text(cat.GetName().c_str());
-        ImGui::NextColumn();
+            ImGui::Text(row.category.c_str());
+            ImGui::NextColumn();
 
-        if (StringUtils::StringIsValidUrl(item.GetReferenceLink()))
-        {
-            if (ImGui::SmallButton(std::string("Link##" + item.GetId()).c_str()))
+            if (row.isLink)
             {
-                ShellExecute(nullptr, nullptr, item.GetReferenceLink().c_str(), nullptr, nullptr, SW_SHOW);
+                if (ImGui::SmallButton("Link"))
+                {
+                    ShellExecute(nullptr, nullptr, row.referenceLink.c_str(), nullptr, nullptr, SW_SHOW);
+                }
             }
-        }
-        else
-        {
-            ImGui::Text(item.GetReferenceLink().c_str());
-        }
-        ImGui::NextColumn();
-
-        ImGui::Text(item.GetLocation().c_str());
-        ImGui::NextColumn();
+            else
+            {
+                ImGui::Text(row.referenceLink.c_str());
+            }
+            ImGui::NextColumn();
 
-        ImGui::Text("%0.3f $CDN", item.GetPrice());
-        ImGui::NextColumn();
+            ImGui::Text(row.location.c_str());
+            ImGui::NextColumn();
 
-        {
-            ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4());
-            ImGui::BeginChildFrame(ImGui::GetID(std::string("Qty" + item.GetId()).c_str()),
-                                   ImVec2(0, ImGui::GetFrameHeight()));
-            ImGui::PopStyleColor();
-            ImGui::Columns(2, nullptr, false);
-            ImGui::Text("%0.2f", item.GetQuantity());
+            ImGui::Text(row.price.c_str());
             ImGui::NextColumn();
-            if (ImGui::SmallButton("Set"))
+
             {
-                if (DB::HasUserWritePrivileges() == false)
+                ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4());
+                ImGui::BeginChildFrame(ImGui::GetID("Qty"), ImVec2(0, ImGui::GetFrameHeight()));
+                ImGui::PopStyleColor();
+                ImGui::Columns(2, nullptr, false);
+                // The adjustments still pending are only known by the UI thread.
+                float pending = DB::Item::GetPendingAdjustment(row.id);
+                if (pending != 0.0f)
                 {
-                    Popup::Init("Unauthorized");
-                    Popup::AddCall(Popup::TextStylized, "You must be logged in to do this action", "Bold/4278190335", true);
+                    ImGui::Text("%0.2f (%+0.2f)", row.quantity, pending);
                 }
                 else
                 {
-                    ImGui::OpenPopup(std::string("QtySet##" + item.GetId()).c_str());
+                    ImGui::Text("%0.2f", row.quantity);
                 }
-            }
-            ImGui::NextColumn();
-            ImGui::Columns(1);
-
-            if (ImGui::BeginPopup(std::string("QtySet##" + item.GetId()).c_str()))
-            {
-                static float incVal = 1.0f;
-                if (ImGui::SmallButton(std::string("+##" + item.GetId()).c_str()))
+                ImGui::NextColumn();
+                if (ImGui::SmallButton("Set"))
                 {
-                    DB::Item::Item tmp = item;
-                    tmp.SetQuantity(tmp.GetQuantity() + incVal);
-                    DB::Item::EditItem(item, tmp);
+                    if (DB::HasUserWritePrivileges() == false)
+                    {
+                        Popup::Init("Unauthorized");
+                        Popup::AddCall(Popup::TextStylized, "You must be logged in to do this action", "Bold/4278190335", true);
+                    }
+                    else
+                    {
+                        ImGui::OpenPopup("QtySet");
+                    }
                 }
-                ImGui::SameLine();
-                if (ImGui::SmallButton(std::string("-##" + item.GetId()).c_str()))
+                ImGui::NextColumn();
+                ImGui::Columns(1);
+
+                if (ImGui::BeginPopup("QtySet"))
                 {
-                    DB::Item::Item tmp = item;
-                    tmp.SetQuantity(tmp.GetQuantity() - incVal);
-                    DB::Item::EditItem(item, tmp);
+                    static float incVal = 1.0f;
+                    const DB::Item::Item* item = DB::Item::FindItemByID(row.id);
+                    if (ImGui::SmallButton("+") && item != nullptr)
+                    {
+                        DB::Item::AdjustQuantity(*item, incVal);
+                    }
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("-") && item != nullptr)
+                    {
+                        DB::Item::AdjustQuantity(*item, -incVal);
+                    }
+                    ImGui::InputFloat("Step Size", &incVal, 0.01f, 1.0f, 2);
+                    ImGui::EndPopup();
                 }
-                ImGui::InputFloat("Step Size", &incVal, 0.01f, 1.0f, 2);
-                ImGui::EndPopup();
+                ImGui::EndChildFrame();
             }
-            ImGui::EndChildFrame();
-        }
-        ImGui::NextColumn();
+            ImGui::NextColumn();
+
+            ImGui::Text(row.unit.c_str());
+            ImGui::NextColumn();
 
-        ImGui::Text(item.GetUnit().c_str());
-        ImGui::NextColumn();
+            ImGui::Text(row.status.c_str());
+            ImGui::NextColumn();
 
-        ImGui::Text(item.GetStatusAsString().c_str());
-        ImGui::NextColumn();
+            ImGui::PopID();
+        }
     }
+    clipper.End();
 
     ImGui::Columns(1);
     ImGui::Separator();
@@ -434,206 +614,424 @@ void ItemViewer::Render()
     ImGui::EndChildFrame();
 }
 
-void SortItems(SortBy sortby, std::vector<DB::Item::Item>& items)
+/**
+ * @brief   Filter, sort and format the Items of the cache, unless nothing changed since the last time.
+ *          It is done in the background, the current rows are copies that keep being shown in the meantime.
+ * @param   sortby: How the Items should be sorted.
+ * @retval  None
+ */
+void UpdateViewModel(SortBy sortby)
 {
-    switch (sortby)
+    // If the Items are being filtered and sorted in the background:
+    if (pendingResult.valid() == true)
     {
-#pragma region Sort Ascend
-        case SortBy::id:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetId();
-                          std::string sb = b.GetId();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::description:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetDescription();
-                          std::string sb = b.GetDescription();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::category:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetCategory().GetName();
-                          std::string sb = b.GetCategory().GetName();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::referenceLink:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetReferenceLink();
-                          std::string sb = b.GetReferenceLink();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::location:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetLocation();
-                          std::string sb = b.GetLocation();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::price:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          float sa = a.GetPrice();
-                          float sb = b.GetPrice();
-                          return(sa <= sb ? true : false);
-                      });
-            break;
-        case SortBy::quantity:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          float sa = a.GetQuantity();
-                          float sb = b.GetQuantity();
-                          return(sa <= sb ? true : false);
-                      });
-            break;
-        case SortBy::unit:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetUnit();
-                          std::string sb = b.GetUnit();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) <= 0 ? true : false);
-                      });
-            break;
-        case SortBy::status:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          int sa = a.GetStatus();
-                          int sb = b.GetStatus();
-                          return(sa <= sb ? true : false);
-                      });
-            break;
-#pragma endregion
+        // Keep showing the current rows until it's done.
+        if (pendingResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return;
+        }
 
-#pragma region Sort Descend
-        case SortBy::rid:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetId();
-                          std::string sb = b.GetId();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+        // If it was interrupted to let the cache be modified, it is simply run again.
+        if (pendingResult.get() == true)
+        {
+            ShowRows(pendingQuery, pendingRows);
+        }
+    }
+
+    if (viewModel.isValid == true &&
+        viewModel.generation == DB::Item::GetGeneration() &&
+        viewModel.filterRevision == filter.GetRevision() &&
+        viewModel.sortby == sortby &&
+        viewModel.thenBy == thenBy)
+    {
+        return;
+    }
+
+    // Filter and sort the Items in the background, with a copy of the filter.
+    pendingQuery.filter = filter;
+    pendingQuery.sortby = sortby;
+    pendingQuery.thenBy = thenBy;
+    pendingQuery.generation = DB::Item::GetGeneration();
+    pendingQuery.filterRevision = filter.GetRevision();
+    pendingResult = TaskPool::Submit([query = pendingQuery]() { return MakeRows(query, pendingRows); });
+}
+
+/**
+ * @brief   Filter and sort the Items of the cache. The work is split in chunks over the workers
+ *          of the TaskPool, and their results merged in the order of the chunks so that it doesn't
+ *          depend on which one finished first.
+ *          From any other thread than the UI thread, the cache must be locked for reading.
+ * @param   query: What to filter and sort the Items by.
+ * @param   items: Where to put the Items to display, in order.
+ * @retval  True if done, false if it was interrupted because the cache is about to be modified.
+ */
+bool RunQuery(const ItemQuery& query, std::vector<const DB::Item::Item*>& items)
+{
+    // If possible, only check the Items the text index says might match.
+    // Typos defeat the index, so a fuzzy filter always looks at everything.
+    std::vector<const DB::Item::Item*> candidates;
+    bool isPresorted = false;
+    if (query.filter.IsFuzzy() == true ||
+        DB::Item::FindCandidates(query.filter.GetText(),
+                                 DB::Item::SearchKey(query.filter.GetSelectedCategory()),
+                                 candidates) == false)
+    {
+        if (query.sortby < SortBy::relevance)
+        {
+            // Go through the Items in the order of the sort, the matches come out sorted.
+            DB::Item::GetSorted(GetSortKey(query.sortby), IsSortDescending(query.sortby), candidates);
+            isPresorted = true;
+        }
+        else
+        {
+            candidates.reserve(DB::Item::GetAll().size());
+            for (const DB::Item::Item& item : DB::Item::GetAll())
+            {
+                candidates.push_back(&item);
+            }
+        }
+    }
+
+    // Filter the candidates, a chunk per worker.
+    // The UI thread can't modify the cache in the meantime, so stop early if it's waiting to.
+    std::atomic<bool> isInterrupted(false);
+    size_t chunks = TaskPool::GetChunkCount(candidates.size());
+    std::vector<std::vector<std::pair<int, const DB::Item::Item*>>> found(chunks);
+    TaskPool::ParallelFor(chunks, [&](size_t chunk)
+                          {
+                              size_t end = candidates.size() * (chunk + 1) / chunks;
+                              for (size_t i = candidates.size() * chunk / chunks; i < end; i++)
+                              {
+                                  if (i % 1024 == 0 && (isInterrupted == true || DB::Item::IsWriterWaiting() == true))
+                                  {
+                                      isInterrupted = true;
+                                      return;
+                                  }
+                                  int score = query.filter.GetScore(*candidates[i]);
+                                  if (score != -1)
+                                  {
+                                      found[chunk].emplace_back(score, candidates[i]);
+                                  }
+                              }
+                          });
+    if (isInterrupted == true)
+    {
+        return false;
+    }
+
+    std::vector<std::pair<int, const DB::Item::Item*>> matches;
+    for (const std::vector<std::pair<int, const DB::Item::Item*>>& chunk : found)
+    {
+        matches.insert(matches.end(), chunk.begin(), chunk.end());
+    }
+
+    // Sort them, giving up as well if the UI thread is waiting.
+    if (query.sortby == SortBy::relevance)
+    {
+        // Closest matches first, then by ID.
+        if (TaskPool::ParallelSort(matches.begin(), matches.end(),
+                                   [](const std::pair<int, const DB::Item::Item*>& a,
+                                      const std::pair<int, const DB::Item::Item*>& b)
+                                   {
+                                       if (a.first != b.first)
+                                       {
+                                           return a.first < b.first;
+                                       }
+                                       return a.second->GetId() < b.second->GetId();
+                                   },
+                                   DB::Item::IsWriterWaiting) == false)
+        {
+            return false;
+        }
+    }
+    items.clear();
+    items.reserve(matches.size());
+    for (const std::pair<int, const DB::Item::Item*>& match : matches)
+    {
+        items.push_back(match.second);
+    }
+
+    return SortItems(query.sortby, query.thenBy, items, isPresorted);
+}
+
+/**
+ * @brief   Filter and sort the Items of the cache, and copy the ones to display into rows.
+ *          Meant to run on a worker of the TaskPool, the cache is locked for reading until it's done.
+ * @param   query: What to filter and sort the Items by.
+ * @param   rows: Where to put the rows, in order.
+ * @retval  True if done, false if it was interrupted because the cache is about to be modified.
+ */
+bool MakeRows(const ItemQuery& query, std::vector<ItemRow>& rows)
+{
+    // The UI thread modifies the cache, it has to wait until we're done.
+    std::shared_lock<std::shared_mutex> lock = DB::Item::LockForReading();
+
+    std::vector<const DB::Item::Item*> items;
+    if (RunQuery(query, items) == false)
+    {
+        return false;
+    }
+
+    // Copy and format the Items, a chunk per worker.
+    std::atomic<bool> isInterrupted(false);
+    rows.clear();
+    rows.resize(items.size());
+    size_t chunks = TaskPool::GetChunkCount(items.size());
+    TaskPool::ParallelFor(chunks, [&](size_t chunk)
+                          {
+                              char buff[64] = { 0 };
+                              size_t end = items.size() * (chunk + 1) / chunks;
+                              for (size_t i = items.size() * chunk / chunks; i < end; i++)
+                              {
+                                  if (i % 1024 == 0 && (isInterrupted == true || DB::Item::IsWriterWaiting() == true))
+                                  {
+                                      isInterrupted = true;
+                                      return;
+                                  }
+                                  const DB::Item::Item* item = items[i];
+                                  ItemRow& row = rows[i];
+                                  row.id = item->GetId();
+                                  row.description = item->GetDescription();
+                                  row.category = item->GetCategory().GetName();
+                                  row.referenceLink = item->GetReferenceLink();
+                                  row.location = item->GetLocation();
+                                  sprintf_s(buff, sizeof(buff), "%0.3f $CDN", item->GetPrice());
+                                  row.price = buff;
+                                  row.quantity = item->GetQuantity();
+                                  row.unit = item->GetUnit();
+                                  row.status = item->GetStatusAsString();
+                                  row.isLink = StringUtils::StringIsValidUrl(row.referenceLink);
+                              }
+                          });
+
+    return isInterrupted == false;
+}
+
+/**
+ * @brief   Show the rows made in the background, and remember what they were computed from.
+ * @param   query: What the Items were filtered and sorted by.
+ * @param   rows: The rows to show, in order. Moved into the view model.
+ * @retval  None
+ */
+void ShowRows(const ItemQuery& query, std::vector<ItemRow>& rows)
+{
+    viewModel.isValid = true;
+    viewModel.generation = query.generation;
+    viewModel.filterRevision = query.filterRevision;
+    viewModel.sortby = query.sortby;
+    viewModel.thenBy = query.thenBy;
+    viewModel.rows = std::move(rows);
+
+    // Looking up a category might query the database, do it here once per category.
+    std::unordered_map<std::string, std::string> categories;
+    for (ItemRow& row : viewModel.rows)
+    {
+        auto category = categories.find(row.category);
+        if (category == categories.end())
+        {
+            category = categories.emplace(row.category, DB::Category::GetCategoryByName(row.category).GetName()).first;
+        }
+        row.category = category->second;
+    }
+}
+
+/**
+ * @brief   Get the field of the Items a sort orders them by.
+ * @param   sort: The sort, not SortBy::relevance nor SortBy::none.
+ * @retval  The field.
+ */
+DB::Item::SearchKey GetSortKey(SortBy sort)
+{
+    switch (sort)
+    {
+        case SortBy::description:
         case SortBy::rdescription:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetDescription();
-                          std::string sb = b.GetDescription();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::description;
+        case SortBy::category:
         case SortBy::rcategory:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetCategory().GetName();
-                          std::string sb = b.GetCategory().GetName();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::category;
+        case SortBy::referenceLink:
         case SortBy::rreferenceLink:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetReferenceLink();
-                          std::string sb = b.GetReferenceLink();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::referenceLink;
+        case SortBy::location:
         case SortBy::rlocation:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetLocation();
-                          std::string sb = b.GetLocation();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::location;
+        case SortBy::price:
         case SortBy::rprice:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          float sa = a.GetPrice();
-                          float sb = b.GetPrice();
-                          return(sa > sb ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::price;
+        case SortBy::quantity:
         case SortBy::rquantity:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          float sa = a.GetQuantity();
-                          float sb = b.GetQuantity();
-                          return(sa > sb ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::quantity;
+        case SortBy::unit:
         case SortBy::runit:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          std::string sa = a.GetUnit();
-                          std::string sb = b.GetUnit();
-                          boost::to_upper(sa);
-                          boost::to_upper(sb);
-                          return(sa.compare(sb.c_str()) > 0 ? true : false);
-                      });
-            break;
+            return DB::Item::SearchKey::unit;
+        case SortBy::status:
         case SortBy::rstatus:
-            std::sort(items.begin(), items.end(),
-                      [](DB::Item::Item& a, DB::Item::Item& b)
-                      {
-                          int sa = a.GetStatus();
-                          int sb = b.GetStatus();
-                          return(sa > sb ? true : false);
-                      });
-            break;
-#pragma endregion
+            return DB::Item::SearchKey::status;
+        case SortBy::id:
+        case SortBy::rid:
         default:
-            break;
+            return DB::Item::SearchKey::id;
     }
 }
 
+/**
+ * @brief   Check if a sort is in descending order.
+ * @param   sort: The sort, not SortBy::relevance nor SortBy::none.
+ * @retval  True if it is.
+ */
+bool IsSortDescending(SortBy sort)
+{
+    return int(sort) % 2 == 1;
+}
+
+/**
+ * @brief   Compare two Items according to a sort.
+ * @param   sort: The sort, not SortBy::relevance nor SortBy::none.
+ * @param   a: The first Item.
+ * @param   b: The second Item.
+ * @retval  A negative number if `a` comes first, a positive one if `b` does, 0 if they're tied.
+ */
+int CompareItems(SortBy sort, const DB::Item::Item* a, const DB::Item::Item* b)
+{
+    int cmp = DB::Item::CompareItems(*a, *b, GetSortKey(sort));
+    return IsSortDescending(sort) ? -cmp : cmp;
+}
+
+/**
+ * @brief   Sort Items by a column, then by a second one, then by id.
+ *          The cache is locked while sorting, so it is given up when the UI thread is waiting to modify it.
+ * @param   sortby: The first column.
+ * @param   thenBy: The second column, SortBy::none if there is none.
+ * @param   items: The Items to sort.
+ * @param   isPresorted: If true, the Items are already in the order of `sortby` (see DB::Item::GetSorted)
+ *                       and only the ties are left to sort.
+ * @retval  True if sorted, false if it was interrupted because the cache is about to be modified.
+ */
+bool SortItems(SortBy sortby, SortBy thenBy, std::vector<const DB::Item::Item*>& items, bool isPresorted)
+{
+    if (sortby >= SortBy::relevance)
+    {
+        return true;
+    }
+
+    // Ties are always settled by id, in the same direction as the first column.
+    SortBy byId = IsSortDescending(sortby) ? SortBy::rid : SortBy::id;
+    auto isBefore = [sortby, thenBy, byId](const DB::Item::Item* a, const DB::Item::Item* b)
+    {
+        int cmp = CompareItems(sortby, a, b);
+        if (cmp == 0 && thenBy < SortBy::relevance)
+        {
+            cmp = CompareItems(thenBy, a, b);
+        }
+        if (cmp == 0)
+        {
+            cmp = CompareItems(byId, a, b);
+        }
+        return cmp < 0;
+    };
+
+    if (isPresorted == false)
+    {
+        return TaskPool::ParallelSort(items.begin(), items.end(), isBefore, DB::Item::IsWriterWaiting);
+    }
+    // If there's no second column, the Items already are in the right order.
+    if (thenBy >= SortBy::relevance)
+    {
+        return true;
+    }
+
+    // Sort each group of Items tied on the first column.
+    size_t begin = 0;
+    size_t checked = 0;
+    while (begin < items.size())
+    {
+        // Every 1024 Items or so, check if the UI thread is waiting.
+        if (begin - checked >= 1024)
+        {
+            if (DB::Item::IsWriterWaiting() == true)
+            {
+                return false;
+            }
+            checked = begin;
+        }
+
+        size_t end = begin + 1;
+        while (end < items.size() && CompareItems(sortby, items[begin], items[end]) == 0)
+        {
+            end++;
+        }
+        // A large group, e.g. a whole category, is sorted in steps so that it can be given up too.
+        if (end - begin > TASK_MIN_CHUNK_SIZE)
+        {
+            if (TaskPool::ParallelSort(items.begin() + begin, items.begin() + end, isBefore,
+                                       DB::Item::IsWriterWaiting) == false)
+            {
+                return false;
+            }
+        }
+        else if (end - begin > 1)
+        {
+            std::sort(items.begin() + begin, items.begin() + end, isBefore);
+        }
+        begin = end;
+    }
+
+    return true;
+}
+
+/**
+ * @brief   Handle a click on the header of a column: sort by that column, or reverse the sort if it
+ *          already is. With shift held, the column is used to settle the ties of the current sort instead.
+ * @param   sortby: The current sort.
+ * @param   column: The ascending sort of the column.
+ * @retval  None
+ */
+void ToggleSort(SortBy& sortby, SortBy column)
+{
+    SortBy reversed = SortBy(int(column) + 1);
+    if (ImGui::GetIO().KeyShift == true && sortby != column && sortby != reversed && sortby != SortBy::relevance)
+    {
+        thenBy = thenBy == column ? reversed : column;
+        return;
+    }
+
+    sortby = sortby == column ? reversed : column;
+    // A column can't settle its own ties.
+    if (thenBy == column || thenBy == reversed)
+    {
+        thenBy = SortBy::none;
+    }
+}
+
+/**
+ * @brief   Get the text shown next to the header of a column, telling how the Items are sorted by it.
+ * @param   sortby: The current sort.
+ * @param   column: The ascending sort of the column.
+ * @retval  The text.
+ */
+const char* GetSortText(SortBy sortby, SortBy column)
+{
+    SortBy reversed = SortBy(int(column) + 1);
+    if (sortby == column)
+    {
+        return SORT_ASCEND;
+    }
+    else if (sortby == reversed)
+    {
+        return SORT_DESCEND;
+    }
+    else if (thenBy == column)
+    {
+        return SORT_THEN_ASCEND;
+    }
+    else if (thenBy == reversed)
+    {
+        return SORT_THEN_DESCEND;
+    }
+    return " ";
+}
+
 void RenderFilterBar()
 {
 
@@ -712,11 +1110,55 @@ static void MakeDeletePopup()
 }
 
 
+/**
+ * @brief   Handle the creation of the pop up for editing all the selected Items at once.
+ *          Only the fields the user checks are changed.
+ * @param   None
+ * @retval  None
+ */
+static void MakeBulkEditPopup()
+{
+    CancelAction();
+    tmpChangeLocation = false;
+    tmpChangePrice = false;
+    tmpChangeUnit = false;
+    tmpChangeStatus = false;
+
+    Popup::Init("Bulk Edit", false);
+    Popup::AddCall(Popup::TextStylized,
+                   "Edit " + StringUtils::NumToString(unsigned(selectedIds.size()), false) +
+                   " Items, only the checked fields are changed", "Bold", true);
+    Popup::AddCall(HandlePopupBulkLocationInput);
+    Popup::AddCall(HandlePopupBulkPriceInput);
+    Popup::AddCall(HandlePopupBulkUnitInput);
+    Popup::AddCall(HandlePopupBulkStatusInput);
+    Popup::AddCall(Popup::Button, "Accept", SaveBulkEdit, true);
+    Popup::AddCall(Popup::SameLine);
+    Popup::AddCall(Popup::Button, "Cancel", CancelAction, true);
+}
+
 void SaveNewItem()
 {
     DB::Item::Item newItem;
     if (VerifyItem(newItem) == true)
     {
+        // The id shown in the popup is only a preview, get one that no other terminal will take.
+        // It is only reserved once the Item is valid, so that a refused Item doesn't use up an id.
+        if (tmpAutoId == true)
+        {
+            tmpId = DB::Item::ReserveIds(categories.at(tmpCat));
+            if (tmpId == -1)
+            {
+                Popup::Init("Add Item");
+                Popup::AddCall(ImGui::Spacing);
+                Popup::AddCall(Popup::TextCentered, "Unable to reserve an id, the item wasn't created!");
+                CancelAction();
+                return;
+            }
+            // Form the Item again, with the reserved id.
+            VerifyItem(newItem);
+        }
+
         if (DB::Item::AddItem(newItem) == false)
         {
             // If unable to add item to DB.
@@ -758,6 +1200,50 @@ void SaveEditedItem()
     }
 }
 
+/**
+ * @brief   Apply the checked fields of the bulk edit pop up to all the selected Items.
+ *          The Items are all sent to the database in the same batch.
+ * @param   None
+ * @retval  None
+ */
+void SaveBulkEdit()
+{
+    std::vector<DB::Item::Item> oldItems;
+    std::vector<DB::Item::Item> newItems;
+    for (const std::string& id : selectedIds)
+    {
+        const DB::Item::Item* item = DB::Item::FindItemByID(id);
+        // If the Item was deleted since it was selected, there's nothing to edit.
+        if (item == nullptr)
+        {
+            continue;
+        }
+
+        oldItems.push_back(*item);
+        newItems.push_back(DB::Item::Item(item->GetOid(),
+                                          item->GetId(),
+                                          item->GetDescription(),
+                                          item->GetCategory(),
+                                          item->GetReferenceLink(),
+                                          tmpChangeLocation ? std::string(tmpLoc) : item->GetLocation(),
+                                          tmpChangePrice ? tmpPrice : item->GetPrice(),
+                                          item->GetQuantity(),
+                                          tmpChangeUnit ? std::string(tmpUnit) : item->GetUnit(),
+                                          tmpChangeStatus ? DB::Item::ItemStatus(tmpStatus) :
+                                          DB::Item::ItemStatus(item->GetStatus())));
+    }
+
+    if (oldItems.empty() == false && DB::Item::EditItems(oldItems, newItems) == false)
+    {
+        Popup::Init("Bulk Edit");
+        Popup::AddCall(ImGui::Spacing);
+        Popup::AddCall(Popup::TextCentered, "Unable to edit the items!");
+    }
+
+    selectedIds.clear();
+    CancelAction();
+}
+
 void DeleteItem()
 {
     DB::Item::DeleteItem(tmpItem);
@@ -900,6 +1386,49 @@ void HandlePopupStatusInput()
     ImGui::Combo("Status", &tmpStatus, statuses.data(), int(statuses.size()));
 }
 
+/**
+ * @brief   Draw the input of a field of the bulk edit pop up, along with the checkbox enabling it.
+ * @param   isChanged: Set to true if the field is to be changed.
+ * @param   id: The unique id of the checkbox.
+ * @param   input: Draws the input of the field.
+ * @retval  None
+ */
+void HandlePopupBulkInput(bool& isChanged, const char* id, void (*input)())
+{
+    ImGui::Checkbox(id, &isChanged);
+    ImGui::SameLine();
+    // Show the field as disabled while it isn't checked.
+    if (isChanged == false)
+    {
+        ImGui::PushStyleColor(ImGuiCol_Text, ImGui::GetStyleColorVec4(ImGuiCol_TextDisabled));
+    }
+    input();
+    if (isChanged == false)
+    {
+        ImGui::PopStyleColor();
+    }
+}
+
+void HandlePopupBulkLocationInput()
+{
+    HandlePopupBulkInput(tmpChangeLocation, "##ChangeLocation", HandlePopupLocationInput);
+}
+
+void HandlePopupBulkPriceInput()
+{
+    HandlePopupBulkInput(tmpChangePrice, "##ChangePrice", HandlePopupPriceInput);
+}
+
+void HandlePopupBulkUnitInput()
+{
+    HandlePopupBulkInput(tmpChangeUnit, "##ChangeUnit", HandlePopupUnitInput);
+}
+
+void HandlePopupBulkStatusInput()
+{
+    HandlePopupBulkInput(tmpChangeStatus, "##ChangeStatus", HandlePopupStatusInput);
+}
+
 int GetCategoryNumber(const DB::Category::Category& cat)
 {
     int i = 0;
@@ -958,21 +1487,14 @@ bool VerifyItem(DB::Item::Item& item)
 
 void ExportItems()
 {
-    // Form a list of all desired items.
-    std::vector<DB::Item::Item> items = DB::Item::GetAll();
-    for (auto item = items.begin(); item != items.end();)
-    {
-        // We don't `item++` in the loop because it is virtually done by `items.erase`.
-        if (filter.CheckMatch(*item) == false)
-        {
-            items.erase(item);
-        }
-        else
-        {
-            // We want to increment here because the item wasn't removed from the list.
-            item++;
-        }
-    }
+    // Form a list of all desired items, in the order they are displayed.
+    ItemQuery query;
+    query.filter = filter;
+    query.sortby = viewModel.sortby;
+    query.thenBy = thenBy;
+    // Only the UI thread modifies the cache, the query can't be interrupted from here.
+    std::vector<const DB::Item::Item*> items;
+    RunQuery(query, items);
 
     // Make the user select the desired output file.
     tmpOutputFilePath = L"";
@@ -991,17 +1513,17 @@ void ExportItems()
     outputFile << "Id,Description,Category,Reference Link,Location,Price,Quantity,Unit,Status" << std::endl;
 
     // Write the items.
-    for (auto& item : items)
-    {
-        outputFile << item.GetId() << ","
-            << "\"" << item.GetDescription() << "\","
-            << item.GetCategory().GetName() << ","
-            << item.GetReferenceLink() << ","
-            << item.GetLocation() << ","
-            << item.GetPrice() << ","
-            << item.GetQuantity() << ","
-            << item.GetUnit() << ","
-            << item.GetStatusAsString() << std::endl;
+    for (const DB::Item::Item* item : items)
+    {
+        outputFile << item->GetId() << ","
+            << "\"" << item->GetDescription() << "\","
+            << item->GetCategory().GetName() << ","
+            << item->GetReferenceLink() << ","
+            << item->GetLocation() << ","
+            << item->GetPrice() << ","
+            << item->GetQuantity() << ","
+            << item->GetUnit() << ","
+            << item->GetStatusAsString() << std::endl;
     }
 
     outputFile.close();
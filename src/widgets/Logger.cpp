@@ -2,6 +2,7 @@
 #include "Application.h"
 #include "utils/Config.h"
 #include "utils/db/MongoCore.h"
+#include "utils/db/WriteQueue.h"
 #include "utils/Fonts.h"
 #include "widgets/MainMenu.h"
 #include <iostream>
@@ -142,7 +143,7 @@ void Logger::Draw(const char* title)
 
 void Logging::Init()
 {
-    bsoncxx::stdx::optional<mongocxx::cursor> entries = DB::GetAllDocuments(DATABASE, "AuditLog");
+    bsoncxx::stdx::optional<DB::Cursor> entries = DB::GetAllDocuments(DATABASE, "AuditLog");
     if (entries)
     {
         for (auto& e : entries.value())
@@ -331,5 +332,5 @@ void SaveToDB(const std::string & msg)
     auto builder = bsoncxx::builder::basic::document{};
     builder.append(kvp("entry", msg));
 
-    DB::InsertDocument(builder.extract(), DATABASE, "AuditLog");
+    DB::WriteQueue::Insert(builder.extract(), DATABASE, "AuditLog");
 }
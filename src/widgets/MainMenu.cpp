@@ -1,6 +1,9 @@
 ﻿#include "MainMenu.h"
 #include "vendor/json/json.hpp"
 #include "widgets/Logger.h"
+#include "utils/Redraw.h"
+#include "utils/SearchBenchmark.h"
+#include "utils/TaskPool.h"
 #include "widgets/Options.h"
 #include "widgets/CategoryViewer.h"
 #include "widgets/Login.h"
@@ -13,6 +16,11 @@ static void DrawStyleEditor();
 static void DrawPerfMonitor();
 static bool isEditorActive = false;
 static bool isPerMonitorActive = false;
+#ifdef _DEBUG
+static void PollSearchBenchmark();
+//! The results of the search benchmark running in the background, if it was started.
+static std::future<std::vector<std::string>> searchBenchmark;
+#endif
 
 void MainMenu::Process()
 {
@@ -45,6 +53,10 @@ void MainMenu::Process()
     {
         DrawPerfMonitor();
     }
+
+#ifdef _DEBUG
+    PollSearchBenchmark();
+#endif
 }
 
 void MainMenu::FileMenu()
@@ -93,6 +105,13 @@ void MainMenu::HelpMenu()
     {
         isPerMonitorActive = true;
     }
+#ifdef _DEBUG
+    // It takes a few seconds, run it in the background. Only one at a time.
+    if (ImGui::MenuItem("Search Benchmark", nullptr, false, searchBenchmark.valid() == false))
+    {
+        searchBenchmark = TaskPool::Submit([]() { return SearchBenchmark::Run(); });
+    }
+#endif
 }
 
 void DrawStyleEditor()
@@ -106,5 +125,35 @@ void DrawStyleEditor()
 
 void DrawPerfMonitor()
 {
+    // Frames are only drawn when something changes, show how many were spared.
+    ImGui::Begin("Dear ImGui Metrics", &isPerMonitorActive);
+    ImGui::Text("Frames rendered: %llu, skipped: %llu",
+                (unsigned long long)Redraw::GetRenderedFrames(),
+                (unsigned long long)Redraw::GetSkippedFrames());
+    ImGui::End();
+
     ImGui::ShowMetricsWindow(&isPerMonitorActive);
 }
+
+#ifdef _DEBUG
+/**
+ * @brief   Log the results of the search benchmark once it is done.
+ *          The logger is only used from the UI thread, so the benchmark can't log them itself.
+ * @param   None
+ * @retval  None
+ */
+void PollSearchBenchmark()
+{
+    if (searchBenchmark.valid() == false ||
+        searchBenchmark.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return;
+    }
+
+    for (const std::string& result : searchBenchmark.get())
+    {
+        Logging::System.Info(result);
+    }
+    Logging::OpenConsole();
+}
+#endif
@@ -1,10 +1,13 @@
 ﻿#include "Viewer.h"
 #include "version.h"
 #include "utils/Config.h"
+#include "utils/TaskPool.h"
 #include "utils/db/MongoCore.h"
 #include "utils/db/Category.h"
 #include "utils/db/Item.h"
 #include "utils/db/Bom.h"
+#include "utils/db/ChangeStream.h"
+#include "utils/db/WriteQueue.h"
 #include "vendor/imgui/imgui.h"
 #include "widgets/BomViewer.h"
 #include "widgets/ItemViewer.h"
@@ -49,12 +52,27 @@ void Viewer::Init()
     {
         DB::Init(uri);
     }
+    DB::WriteQueue::Init();
+    TaskPool::Init();
     DB::Category::Init();
     DB::Item::Init();
     DB::BOM::Init();
 
 }
 
+/**
+ * @brief   Execute the writes still pending and stop the background threads of the database.
+ * @param   None
+ * @retval  None
+ */
+void Viewer::Shutdown()
+{
+    DB::Item::FlushAdjustments(true);
+    DB::ChangeStream::StopAll();
+    DB::WriteQueue::Shutdown();
+    TaskPool::Shutdown();
+}
+
 void Viewer::Render()
 {
     static bool hasVersionBeenChecked = false;
@@ -105,7 +123,7 @@ bool VerifySoftwareVersion(bool showChangeLog)
 {
     bool isUpToDate = true;
     bool isNewerVersion = false;
-    bsoncxx::stdx::optional<mongocxx::cursor> docs = DB::GetAllDocuments("CEP", "Version");
+    bsoncxx::stdx::optional<DB::Cursor> docs = DB::GetAllDocuments("CEP", "Version");
     bsoncxx::document::view doc;
 
     // Get the last document from the collection. That will be the latest version of the software.
@@ -288,7 +306,7 @@ void SaveChanges()
 
     builder.append(kvp("ChangeLog", array_builder));
 
-    DB::InsertDocument(builder.extract(), "CEP", "Version");
+    DB::WriteQueue::Insert(builder.extract(), "CEP", "Version");
 }
 
 void SendFeedback()
@@ -313,7 +331,7 @@ void SendFeedback()
 
     builder.append(kvp("FeedbackEntry", fb));
 
-    DB::InsertDocument(builder.extract(), "CEP", "Feedback");
+    DB::WriteQueue::Insert(builder.extract(), "CEP", "Feedback");
 
     Popup::Init("Thank you for your feedback!");
     Popup::AddCall(Popup::Text, "I will read it as soon as possible!");
@@ -321,10 +339,13 @@ void SendFeedback()
 
 void Refresh()
 {
+    // Report the writes acknowledged by the database since the last frame.
+    DB::WriteQueue::Poll();
+
     static double elapsedTime = 0;
     static int frameCount = 0;
-    // deltaTime is the time between two frames (e.g. deltaTime @ 60fps is ~16.667ms).
-    const static float deltaTime = ImGui::GetIO().DeltaTime;
+    // deltaTime is the time since the last frame, frames are only drawn when something changes.
+    const float deltaTime = ImGui::GetIO().DeltaTime;
 
     // If we're at a new frame:
     if (frameCount != ImGui::GetFrameCount())
@@ -34,6 +34,7 @@ namespace Viewer
 /*****************************************************************************/
 /* Exported functions */
 void Init();
+void Shutdown();
 void Render();
 void ShowChangeLog();
 void ShowSuggestionBox();